@@ -0,0 +1,232 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "activity.h"
+
+/*
+ * Tile size. Every evolver call has a fixed cost (the extreme rule fills two
+ * rows of extremities before its first), so tiles are not much smaller than
+ * this; much larger, and a single changing pixel keeps too much busy.
+ */
+#define ACTIVE_TILE_COLUMNS 64
+#define ACTIVE_TILE_ROWS 32
+
+struct Activity {
+    size_t width;
+    size_t height;
+    size_t tile_columns;
+    size_t tile_rows;
+    /* Nonzero for every tile that changed in the last generation. */
+    unsigned char *changed;
+    /* Nonzero for every tile to evolve in this one. */
+    unsigned char *dirty;
+    /* Tiles evolved or copied in this generation. */
+    size_t *tasks;
+    /* Source of the last generation, which still holds its frame. */
+    const Image *last_src;
+    /* Tiles evolved, and tiles in every generation, summed. */
+    size_t n_evolved;
+    size_t n_total;
+};
+
+Activity *activity_create(size_t width, size_t height) {
+    Activity *activity = malloc(sizeof(*activity));
+    size_t n_tiles;
+
+    if (!activity) {
+        return NULL;
+    }
+    activity->width = width;
+    activity->height = height;
+    activity->tile_columns = (width + ACTIVE_TILE_COLUMNS - 1) /
+                             ACTIVE_TILE_COLUMNS;
+    activity->tile_rows = (height + ACTIVE_TILE_ROWS - 1) / ACTIVE_TILE_ROWS;
+    n_tiles = activity->tile_columns * activity->tile_rows;
+    activity->changed = malloc(n_tiles);
+    activity->dirty = malloc(n_tiles);
+    activity->tasks = malloc(n_tiles * sizeof(*activity->tasks));
+    if (!activity->changed || !activity->dirty || !activity->tasks) {
+        activity_free(activity);
+        return NULL;
+    }
+    /* Nothing is known of the frame before the first. */
+    memset(activity->changed, 1, n_tiles);
+    activity->last_src = NULL;
+    activity->n_evolved = activity->n_total = 0;
+    return activity;
+}
+
+/**
+ * Columns [first, first + n) of image, as an image of its own: a window into
+ * the same pixels, whose halo is the pixels on either side (or the halo of
+ * image, at its edges).
+ */
+static Image image_columns(const Image *image, size_t first, size_t n) {
+    Image columns = *image;
+    int c;
+
+    if (image->planar) {
+        for (c = 0; c < 3; ++c) {
+            columns.planes.channel[c] += first;
+        }
+    } else {
+        columns.pixels += first;
+    }
+    columns.width = n;
+    return columns;
+}
+
+/**
+ * Whether rows [first_row, last_row) of images a and b, of the same size and
+ * layout, differ.
+ */
+static int rows_differ(const Image *a, const Image *b, size_t first_row,
+                       size_t last_row) {
+    size_t j;
+    int c;
+
+    for (j = first_row; j < last_row; ++j) {
+        if (a->planar) {
+            for (c = 0; c < 3; ++c) {
+                if (memcmp(a->planes.channel[c] + j * a->stride,
+                           b->planes.channel[c] + j * b->stride,
+                           a->width)) {
+                    return 1;
+                }
+            }
+        } else if (memcmp(a->pixels + j * a->stride, b->pixels + j * b->stride,
+                          a->width * sizeof(*a->pixels))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * One generation shared by all tile tasks.
+ */
+typedef struct Active_job {
+    Activity *activity;
+    Image_evolver image_evolver;
+    Image *dst_image;
+    const Image *src_image;
+    const Rng *rng;
+    size_t frame;
+} Active_job;
+
+/**
+ * Evolve tile tasks[task] if it is dirty, copy it from the source if not.
+ */
+static void run_active_tile(void *arg, size_t task) {
+    const Active_job *job = arg;
+    Activity *activity = job->activity;
+    size_t tile = activity->tasks[task];
+    size_t first_column = tile % activity->tile_columns * ACTIVE_TILE_COLUMNS;
+    size_t first_row = tile / activity->tile_columns * ACTIVE_TILE_ROWS;
+    size_t columns = activity->width - first_column, last_row, j;
+    Image dst, src;
+
+    if (columns > ACTIVE_TILE_COLUMNS) {
+        columns = ACTIVE_TILE_COLUMNS;
+    }
+    last_row = first_row + ACTIVE_TILE_ROWS;
+    if (last_row > activity->height) {
+        last_row = activity->height;
+    }
+    dst = image_columns(job->dst_image, first_column, columns);
+    src = image_columns(job->src_image, first_column, columns);
+    if (activity->dirty[tile]) {
+        (*job->image_evolver)(&dst, &src, job->rng, job->frame, first_row,
+                              last_row);
+        activity->changed[tile] = (unsigned char)rows_differ(&dst, &src,
+                                                             first_row,
+                                                             last_row);
+        return;
+    }
+    for (j = first_row; j < last_row; ++j) {
+        if (dst.planar) {
+            int c;
+            for (c = 0; c < 3; ++c) {
+                memcpy(dst.planes.channel[c] + j * dst.stride,
+                       src.planes.channel[c] + j * src.stride, columns);
+            }
+        } else {
+            memcpy(dst.pixels + j * dst.stride, src.pixels + j * src.stride,
+                   columns * sizeof(*dst.pixels));
+        }
+    }
+}
+
+void evolve_active_tiles(Activity *activity, Thread_pool *pool,
+                         Image_evolver image_evolver, Image *dst_image,
+                         const Image *src_image, const Rng *rng,
+                         size_t frame) {
+    size_t tile_columns = activity->tile_columns;
+    size_t tile_rows = activity->tile_rows;
+    size_t x, y, dx, dy, n_tasks = 0, n_evolved = 0;
+    /* Then dst_image holds the frame before src_image. */
+    int in_place = dst_image == activity->last_src;
+    Active_job job;
+
+    assert(dst_image->width == activity->width);
+    assert(dst_image->height == activity->height);
+    /*
+     * A tile is dirty if it or a neighbour changed. The rest stay as they
+     * are, and so unchanged: in place, they need not even be copied.
+     */
+    for (y = 0; y < tile_rows; ++y) {
+        for (x = 0; x < tile_columns; ++x) {
+            unsigned char dirty = 0;
+            for (dy = tile_rows - 1; dy <= tile_rows + 1; ++dy) {
+                for (dx = tile_columns - 1; dx <= tile_columns + 1; ++dx) {
+                    dirty |= activity->changed[(y + dy) % tile_rows *
+                                                   tile_columns +
+                                               (x + dx) % tile_columns];
+                }
+            }
+            activity->dirty[y * tile_columns + x] = dirty;
+        }
+    }
+    for (x = 0; x < tile_rows * tile_columns; ++x) {
+        if (activity->dirty[x]) {
+            activity->tasks[n_tasks++] = x;
+            ++n_evolved;
+        } else {
+            activity->changed[x] = 0;
+            if (!in_place) {
+                activity->tasks[n_tasks++] = x;
+            }
+        }
+    }
+
+    job.activity = activity;
+    job.image_evolver = image_evolver;
+    job.dst_image = dst_image;
+    job.src_image = src_image;
+    job.rng = rng;
+    job.frame = frame;
+    thread_pool_run(pool, &run_active_tile, &job, n_tasks);
+    refresh_halo(dst_image);
+    activity->last_src = src_image;
+    activity->n_evolved += n_evolved;
+    activity->n_total += tile_rows * tile_columns;
+}
+
+void activity_report(const Activity *activity, FILE *file) {
+    fprintf(file, "Active tiles: evolved %lu of %lu (%.1f%%), %lux%lu"
+                  " pixels each.\n",
+            (unsigned long)activity->n_evolved,
+            (unsigned long)activity->n_total,
+            activity->n_total ? 100.0 * (double)activity->n_evolved /
+                                    (double)activity->n_total
+                              : 0.0,
+            (unsigned long)ACTIVE_TILE_COLUMNS,
+            (unsigned long)ACTIVE_TILE_ROWS);
+}
+
+void activity_free(Activity *activity) {
+    free(activity->changed);
+    free(activity->dirty);
+    free(activity->tasks);
+    free(activity);
+}
@@ -0,0 +1,50 @@
+#ifndef ACTIVITY_H
+#define ACTIVITY_H
+#include <stdio.h>
+#include "evolve_image.h"
+#include "image.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+/**
+ * Incremental evolution for deterministic rules, such as 8_parent_extreme,
+ * that draw no random bytes: a pixel depends only on its 3x3 neighbourhood
+ * in the frame before, so where that did not change in the last generation,
+ * the pixel does not change in this one.
+ *
+ * Frames are cut into tiles, and a map records which tiles changed in the
+ * last generation. A tile is evolved again only if it or one of its 8
+ * neighbours (wrapping around the frame) changed; the others keep their
+ * pixels, copied from the source, or left as they are when the destination
+ * still holds the frame before the source. Once a run settles into a mostly
+ * static pattern, a generation costs in proportion to the tiles still
+ * changing rather than to the whole frame. Frames are the same as from
+ * evolve_image_parallel, bit for bit.
+ */
+typedef struct Activity Activity;
+
+/**
+ * Tiles for width x height frames, all of them to be evolved the first time.
+ * NULL if out of memory.
+ */
+Activity *activity_create(size_t width, size_t height);
+
+/**
+ * Evolve src_image, frame number frame, into dst_image with image_evolver,
+ * which must not use random bytes, on the threads of pool, evolving only the
+ * tiles that may have changed. The halo of dst_image is refreshed.
+ */
+void evolve_active_tiles(Activity *activity, Thread_pool *pool,
+                         Image_evolver image_evolver, Image *dst_image,
+                         const Image *src_image, const Rng *rng,
+                         size_t frame);
+
+/**
+ * Print how many tiles were evolved, out of how many there were, on one
+ * line.
+ */
+void activity_report(const Activity *activity, FILE *file);
+
+void activity_free(Activity *activity);
+
+#endif /* ACTIVITY_H */
@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "evolve_row.h"
+#include "frame_alloc.h"
+
+/* Longest job line, newline included. */
+#define BATCH_LINE_LENGTH 1024
+/* Most words in a job line. */
+#define BATCH_MAX_WORDS 16
+
+/**
+ * Where a batch of jobs came from, and where their answers go.
+ */
+typedef struct Client {
+    FILE *replies;
+    /* Jobs queued or running. */
+    size_t n_outstanding;
+    /* Jobs answered, failed ones included, and their latencies. */
+    size_t n_jobs;
+    size_t n_failed;
+    double latency_sum;
+    double latency_max;
+} Client;
+
+typedef struct Batch_job {
+    Row_job job;
+    /* The line, split in place into the words job points into. */
+    char line[BATCH_LINE_LENGTH];
+    unsigned long line_number;
+    double queued;
+    Client *client;
+    struct Batch_job *next;
+} Batch_job;
+
+typedef struct Batch_server {
+    pthread_t *workers;
+    size_t n_workers;
+
+    pthread_mutex_t lock;
+    /* Signalled when a job is queued or the server closes. */
+    pthread_cond_t job_queued;
+    /* Signalled when a job is answered. */
+    pthread_cond_t job_answered;
+
+    /* Jobs not yet taken by a worker, oldest first. */
+    Batch_job *first;
+    Batch_job *last;
+    int closing;
+} Batch_server;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + 1e-9 * (double)time.tv_nsec;
+}
+
+/**
+ * Account for an answered job of client, latency seconds after it was
+ * queued. Called with lock held.
+ */
+static void count_answer(Client *client, int ok, double latency) {
+    ++client->n_jobs;
+    client->n_failed += !ok;
+    client->latency_sum += latency;
+    if (client->latency_max < latency) {
+        client->latency_max = latency;
+    }
+}
+
+static void *batch_worker_main(void *arg) {
+    Batch_server *server = arg;
+    Batch_job *job;
+    char error[ROW_JOB_ERROR_LENGTH];
+    double start, end;
+    int ok;
+
+    pthread_mutex_lock(&server->lock);
+    for (;;) {
+        while (!server->first && !server->closing) {
+            pthread_cond_wait(&server->job_queued, &server->lock);
+        }
+        if (!server->first) {
+            break;
+        }
+        job = server->first;
+        server->first = job->next;
+        pthread_mutex_unlock(&server->lock);
+
+        /* Jobs share nothing but the buffers frame_alloc hands out. */
+        start = now();
+        ok = run_row_job(&job->job, NULL, error);
+        end = now();
+
+        pthread_mutex_lock(&server->lock);
+        if (ok) {
+            fprintf(job->client->replies,
+                    "ok %lu %s %lux%lu strategy %d seed %lu: waited %.3f ms,"
+                    " ran %.3f ms\n",
+                    job->line_number, job->job.path,
+                    (unsigned long)job->job.width,
+                    (unsigned long)job->job.height, job->job.strategy,
+                    job->job.seed, 1e3 * (start - job->queued),
+                    1e3 * (end - start));
+        } else {
+            fprintf(job->client->replies, "error %lu: %s\n",
+                    job->line_number, error);
+        }
+        fflush(job->client->replies);
+        count_answer(job->client, ok, end - job->queued);
+        --job->client->n_outstanding;
+        pthread_cond_broadcast(&server->job_answered);
+        free(job);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+static void start_server(Batch_server *server, size_t n_threads) {
+    size_t i;
+
+    if (n_threads == 0) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? (size_t)n_cpus : 1;
+    }
+    server->n_workers = n_threads;
+    server->workers = malloc(n_threads * sizeof(*server->workers));
+    if (!server->workers) {
+        fprintf(stderr, "Failed to allocate workers.\n");
+        exit(1);
+    }
+    server->first = server->last = NULL;
+    server->closing = 0;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->job_queued, NULL);
+    pthread_cond_init(&server->job_answered, NULL);
+    for (i = 0; i < n_threads; ++i) {
+        if (pthread_create(server->workers + i, NULL, &batch_worker_main,
+                           server)) {
+            fprintf(stderr, "Failed to start worker thread.\n");
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Join the workers once the queue is empty, and report on the buffers they
+ * recycled.
+ */
+static void stop_server(Batch_server *server) {
+    size_t i;
+
+    pthread_mutex_lock(&server->lock);
+    server->closing = 1;
+    pthread_cond_broadcast(&server->job_queued);
+    pthread_mutex_unlock(&server->lock);
+    for (i = 0; i < server->n_workers; ++i) {
+        pthread_join(server->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->job_queued);
+    pthread_cond_destroy(&server->job_answered);
+    free(server->workers);
+    frame_alloc_report(stderr);
+}
+
+/**
+ * Split line in place into at most BATCH_MAX_WORDS words. Returns how many
+ * there are, BATCH_MAX_WORDS + 1 if too many.
+ */
+static int split_words(char *line, char *words[]) {
+    int n = 0;
+
+    for (;;) {
+        while (*line == ' ' || *line == '\t' || *line == '\r' ||
+               *line == '\n') {
+            *line++ = '\0';
+        }
+        if (*line == '\0') {
+            return n;
+        }
+        if (n == BATCH_MAX_WORDS) {
+            return n + 1;
+        }
+        words[n++] = line;
+        while (*line != '\0' && *line != ' ' && *line != '\t' &&
+               *line != '\r' && *line != '\n') {
+            ++line;
+        }
+    }
+}
+
+/**
+ * Queue the jobs read from input, one per line, answering them on client's
+ * replies, until the end of input or a "shutdown" line, then wait for all of
+ * them to be answered and write the summary. Returns 1 if "shutdown" was
+ * read.
+ */
+static int serve_client(Batch_server *server, FILE *input, Client *client) {
+    unsigned long line_number = 0;
+    char *words[BATCH_MAX_WORDS + 1];
+    char error[ROW_JOB_ERROR_LENGTH];
+    Batch_job *job = NULL;
+    int n_words, shutdown = 0;
+    size_t length;
+
+    client->n_outstanding = client->n_jobs = client->n_failed = 0;
+    client->latency_sum = client->latency_max = 0.0;
+    for (;;) {
+        if (!job) {
+            job = malloc(sizeof(*job));
+            if (!job) {
+                fprintf(stderr, "Failed to allocate job.\n");
+                exit(1);
+            }
+        }
+        if (!fgets(job->line, BATCH_LINE_LENGTH, input)) {
+            break;
+        }
+        ++line_number;
+        length = strlen(job->line);
+        if (length == BATCH_LINE_LENGTH - 1 &&
+            job->line[length - 1] != '\n') {
+            /* Skip the rest of the line. */
+            while (fgets(job->line, BATCH_LINE_LENGTH, input) &&
+                   job->line[strlen(job->line) - 1] != '\n') {
+            }
+            sprintf(error, "Line is longer than %d bytes.",
+                    BATCH_LINE_LENGTH - 2);
+            n_words = -1;
+        } else {
+            n_words = split_words(job->line, words);
+            if (n_words == 0 || words[0][0] == '#') {
+                continue;
+            }
+            if (n_words == 1 && strcmp(words[0], "shutdown") == 0) {
+                shutdown = 1;
+                break;
+            }
+            if (n_words > BATCH_MAX_WORDS) {
+                sprintf(error, "More than %d words.", BATCH_MAX_WORDS);
+                n_words = -1;
+            }
+        }
+
+        pthread_mutex_lock(&server->lock);
+        if (n_words < 0 || !parse_row_job(&job->job, n_words, words, error)) {
+            fprintf(client->replies, "error %lu: %s\n", line_number, error);
+            fflush(client->replies);
+            count_answer(client, 0, 0.0);
+        } else {
+            job->line_number = line_number;
+            job->queued = now();
+            job->client = client;
+            job->next = NULL;
+            if (server->first) {
+                server->last->next = job;
+            } else {
+                server->first = job;
+            }
+            server->last = job;
+            ++client->n_outstanding;
+            pthread_cond_signal(&server->job_queued);
+            job = NULL;
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+    free(job);
+
+    pthread_mutex_lock(&server->lock);
+    while (client->n_outstanding > 0) {
+        pthread_cond_wait(&server->job_answered, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+    fprintf(client->replies,
+            "done %lu jobs, %lu failed: latency mean %.3f ms, max %.3f ms\n",
+            (unsigned long)client->n_jobs, (unsigned long)client->n_failed,
+            client->n_jobs ? 1e3 * client->latency_sum / (double)client->n_jobs
+                           : 0.0,
+            1e3 * client->latency_max);
+    fflush(client->replies);
+    return shutdown;
+}
+
+int serve_batch_file(const char *path, size_t n_threads) {
+    Batch_server server;
+    Client client;
+    FILE *input;
+
+    input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!input) {
+        fprintf(stderr, "Failed to open job file %s.\n", path);
+        return 0;
+    }
+    start_server(&server, n_threads);
+    client.replies = stdout;
+    serve_client(&server, input, &client);
+    stop_server(&server);
+    if (input != stdin) {
+        fclose(input);
+    }
+    return client.n_failed == 0;
+}
+
+int serve_batch_socket(const char *path, size_t n_threads) {
+    struct sockaddr_un address;
+    Batch_server server;
+    Client client;
+    FILE *input;
+    int listener, connection, shutdown = 0;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return 0;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, 16) != 0) {
+        fprintf(stderr, "Failed to listen on %s.\n", path);
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 0;
+    }
+    /* A client that hangs up early must not take the server with it. */
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Listening on %s.\n", path);
+
+    start_server(&server, n_threads);
+    while (!shutdown) {
+        connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+        /* Separate streams, so that reading does not disturb the replies. */
+        input = fdopen(connection, "r");
+        client.replies = fdopen(dup(connection), "w");
+        if (!input || !client.replies) {
+            fprintf(stderr, "Failed to open connection.\n");
+            exit(1);
+        }
+        shutdown = serve_client(&server, input, &client);
+        fclose(input);
+        fclose(client.replies);
+    }
+    stop_server(&server);
+    close(listener);
+    unlink(path);
+    return 1;
+}
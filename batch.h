@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stddef.h>
+
+/**
+ * Batch job server for main_row: one process making many images, so that
+ * threads and frame buffers (see frame_alloc.h) are set up once and reused
+ * from job to job rather than paid for by every image.
+ *
+ * Jobs come one per line, in the syntax of main_row's arguments (width,
+ * height, strategy index, file name, and --seed N, --planar, --stream or
+ * --ascii anywhere among them). Blank lines and lines starting with '#' are
+ * skipped. Jobs run concurrently, one per worker thread, each generating its
+ * image serially, and are answered in the order they finish, one line each:
+ *     ok <line> <file> <width>x<height> strategy <s> seed <n>: waited <w> ms,
+ *         ran <r> ms
+ *     error <line>: <why>
+ * (on one line), where <line> is the job's line number, <w> the time it was
+ * queued before a worker took it and <r> the time it took to run. Once every
+ * job is answered, a summary follows:
+ *     done <n> jobs, <f> failed: latency mean <m> ms, max <x> ms
+ * File names cannot contain whitespace.
+ */
+
+/**
+ * Run the jobs of the file at path (standard input if "-") on n_threads
+ * worker threads (one per CPU if 0), answering on standard output. Returns
+ * 0 if the file cannot be opened or any job failed.
+ */
+int serve_batch_file(const char *path, size_t n_threads);
+
+/**
+ * Listen on a Unix domain socket at path, which must not exist, and serve
+ * connections one after the other on n_threads worker threads (one per CPU
+ * if 0): the jobs a client sends run concurrently and are answered on the
+ * same connection, with a summary once the client shuts down its side. A
+ * line "shutdown" ends the connection, and the server once its jobs are
+ * answered; the socket is then removed. SIGPIPE is ignored from then on,
+ * for the whole process, so that a client hanging up does not end it.
+ * Returns 0 if it cannot listen.
+ */
+int serve_batch_socket(const char *path, size_t n_threads);
+
+#endif /* BATCH_H */
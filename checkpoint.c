@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "deflate.h"
+#include "trace.h"
+
+#define CHECKPOINT_MAGIC "IMGGENCK"
+#define CHECKPOINT_VERSION 1
+#define HEADER_BYTES 80
+#define RULE_BYTES 32
+#define MAX_PATH_LENGTH 4096
+
+struct Checkpointer {
+    char path[MAX_PATH_LENGTH];
+    char temporary_path[MAX_PATH_LENGTH + 4];
+    size_t every;
+    /* Header of the checkpoint being written, frame included. */
+    unsigned char header[HEADER_BYTES];
+    size_t width;
+    size_t height;
+    /* Copy of the frame being written, interleaved. */
+    Pixel *pixels;
+    /* Frame of the last checkpoint started. */
+    size_t last_frame;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* Signalled when a copy is ready to write, or on closing. */
+    pthread_cond_t copied_signal;
+    /* Nonzero from the start of a copy until its write is done. */
+    int busy;
+    /* Nonzero once the copy is done, until its write is. */
+    int copied;
+    int closing;
+};
+
+static void put_u32(unsigned char *bytes, uint32_t value) {
+    int k;
+    for (k = 0; k < 4; ++k) {
+        bytes[k] = (unsigned char)(value >> (8 * k));
+    }
+}
+
+static void put_u64(unsigned char *bytes, uint64_t value) {
+    put_u32(bytes, (uint32_t)value);
+    put_u32(bytes + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t get_u32(const unsigned char *bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char *bytes) {
+    return (uint64_t)get_u32(bytes) | (uint64_t)get_u32(bytes + 4) << 32;
+}
+
+/**
+ * Write the copied frame to the temporary file, then rename it over the
+ * checkpoint. Returns 0 on failure.
+ */
+static int write_checkpoint(const Checkpointer *checkpointer) {
+    size_t bytes = checkpointer->width * checkpointer->height *
+                   sizeof(*checkpointer->pixels);
+    uint32_t adler;
+    unsigned char trailer[4];
+    FILE *file = fopen(checkpointer->temporary_path, "wb");
+    int ok;
+
+    if (!file) {
+        return 0;
+    }
+    adler = adler32_update(1, checkpointer->header, HEADER_BYTES);
+    adler = adler32_update(adler, (const unsigned char *)checkpointer->pixels,
+                           bytes);
+    put_u32(trailer, adler);
+    ok = fwrite(checkpointer->header, 1, HEADER_BYTES, file) == HEADER_BYTES &&
+         fwrite(checkpointer->pixels, 1, bytes, file) == bytes &&
+         fwrite(trailer, 1, 4, file) == 4 && fflush(file) == 0 &&
+         fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(checkpointer->temporary_path, checkpointer->path) == 0;
+}
+
+static void *checkpointer_main(void *arg) {
+    Checkpointer *checkpointer = arg;
+    size_t frame;
+    double start;
+
+    pthread_mutex_lock(&checkpointer->lock);
+    for (;;) {
+        while (!checkpointer->copied && !checkpointer->closing) {
+            pthread_cond_wait(&checkpointer->copied_signal,
+                              &checkpointer->lock);
+        }
+        if (!checkpointer->copied) {
+            break;
+        }
+        /* The copy is ours until busy is cleared. */
+        pthread_mutex_unlock(&checkpointer->lock);
+        frame = (size_t)get_u64(checkpointer->header + 24);
+        start = trace_begin();
+        if (!write_checkpoint(checkpointer)) {
+            fprintf(stderr, "Failed to write checkpoint %s of frame %lu.\n",
+                    checkpointer->path, (unsigned long)frame);
+        }
+        trace_end(TRACE_WRITE, start, frame);
+        pthread_mutex_lock(&checkpointer->lock);
+        checkpointer->copied = checkpointer->busy = 0;
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+    return NULL;
+}
+
+Checkpointer *checkpointer_create(const char *path, size_t every,
+                                  unsigned long seed, const char *rule,
+                                  size_t width, size_t height) {
+    Checkpointer *checkpointer;
+
+    if (strlen(path) >= MAX_PATH_LENGTH || strlen(rule) > RULE_BYTES) {
+        return NULL;
+    }
+    checkpointer = malloc(sizeof(*checkpointer));
+    if (!checkpointer) {
+        return NULL;
+    }
+    checkpointer->pixels = malloc(width * height *
+                                  sizeof(*checkpointer->pixels));
+    if (!checkpointer->pixels) {
+        free(checkpointer);
+        return NULL;
+    }
+    strcpy(checkpointer->path, path);
+    sprintf(checkpointer->temporary_path, "%s.tmp", path);
+    checkpointer->every = every > 0 ? every : 1;
+    checkpointer->width = width;
+    checkpointer->height = height;
+    checkpointer->last_frame = 0;
+    checkpointer->busy = checkpointer->copied = 0;
+    checkpointer->closing = 0;
+
+    memset(checkpointer->header, 0, HEADER_BYTES);
+    memcpy(checkpointer->header, CHECKPOINT_MAGIC, 8);
+    put_u32(checkpointer->header + 8, CHECKPOINT_VERSION);
+    put_u64(checkpointer->header + 16, seed);
+    put_u64(checkpointer->header + 32, width);
+    put_u64(checkpointer->header + 40, height);
+    memcpy(checkpointer->header + 48, rule, strlen(rule));
+
+    pthread_mutex_init(&checkpointer->lock, NULL);
+    pthread_cond_init(&checkpointer->copied_signal, NULL);
+    if (pthread_create(&checkpointer->thread, NULL, &checkpointer_main,
+                       checkpointer)) {
+        fprintf(stderr, "Failed to start checkpoint thread.\n");
+        exit(1);
+    }
+    return checkpointer;
+}
+
+void checkpointer_offer(Checkpointer *checkpointer, const Image *image,
+                        size_t frame) {
+    size_t width = checkpointer->width, j;
+    Planes row;
+    double start;
+    int due;
+
+    pthread_mutex_lock(&checkpointer->lock);
+    due = !checkpointer->busy &&
+          frame / checkpointer->every !=
+              checkpointer->last_frame / checkpointer->every;
+    if (due) {
+        checkpointer->busy = 1;
+        checkpointer->last_frame = frame;
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+    if (!due) {
+        return;
+    }
+
+    start = trace_begin();
+    for (j = 0; j < checkpointer->height; ++j) {
+        if (image->planar) {
+            row = planes_row(image, j);
+            interleave_planes(checkpointer->pixels + j * width,
+                              row.channel[0], row.channel[1], row.channel[2],
+                              width);
+        } else {
+            memcpy(checkpointer->pixels + j * width,
+                   image->pixels + j * image->stride,
+                   width * sizeof(*image->pixels));
+        }
+    }
+    put_u64(checkpointer->header + 24, frame);
+    trace_end(TRACE_CHECKPOINT, start, frame);
+
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->copied = 1;
+    pthread_cond_signal(&checkpointer->copied_signal);
+    pthread_mutex_unlock(&checkpointer->lock);
+}
+
+void checkpointer_free(Checkpointer *checkpointer) {
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->closing = 1;
+    pthread_cond_signal(&checkpointer->copied_signal);
+    pthread_mutex_unlock(&checkpointer->lock);
+    /* The thread writes what was copied before it stops. */
+    pthread_join(checkpointer->thread, NULL);
+    pthread_mutex_destroy(&checkpointer->lock);
+    pthread_cond_destroy(&checkpointer->copied_signal);
+    free(checkpointer->pixels);
+    free(checkpointer);
+}
+
+/**
+ * Read row j of checkpoint->image from file into buffer, adding it to adler,
+ * and from there into the image. Returns 0 on a short read.
+ */
+static int read_row(FILE *file, Checkpoint *checkpoint, size_t j,
+                    Pixel *buffer, uint32_t *adler) {
+    Image *image = checkpoint->image;
+    size_t width = checkpoint->width, i;
+    Planes row;
+
+    if (fread(buffer, sizeof(*buffer), width, file) != width) {
+        return 0;
+    }
+    *adler = adler32_update(*adler, (const unsigned char *)buffer,
+                            width * sizeof(*buffer));
+    if (!image->planar) {
+        memcpy(image->pixels + j * image->stride, buffer,
+               width * sizeof(*buffer));
+        return 1;
+    }
+    row = planes_row(image, j);
+    for (i = 0; i < width; ++i) {
+        row.channel[0][i] = buffer[i].r;
+        row.channel[1][i] = buffer[i].g;
+        row.channel[2][i] = buffer[i].b;
+    }
+    return 1;
+}
+
+FILE *checkpoint_read_header(const char *path, Checkpoint *checkpoint) {
+    unsigned char header[HEADER_BYTES];
+    uint64_t width, height;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open checkpoint %s.\n", path);
+        return NULL;
+    }
+    if (fread(header, 1, HEADER_BYTES, file) != HEADER_BYTES ||
+        memcmp(header, CHECKPOINT_MAGIC, 8) != 0 ||
+        get_u32(header + 8) != CHECKPOINT_VERSION) {
+        fprintf(stderr, "%s is not a checkpoint.\n", path);
+        fclose(file);
+        return NULL;
+    }
+    width = get_u64(header + 32);
+    height = get_u64(header + 40);
+    if (width == 0 || height == 0 || width > (size_t)-1 / 3 / height) {
+        fprintf(stderr, "Checkpoint %s has bad dimensions.\n", path);
+        fclose(file);
+        return NULL;
+    }
+    checkpoint->seed = (unsigned long)get_u64(header + 16);
+    checkpoint->frame = (size_t)get_u64(header + 24);
+    checkpoint->width = (size_t)width;
+    checkpoint->height = (size_t)height;
+    memcpy(checkpoint->rule, header + 48, RULE_BYTES);
+    checkpoint->rule[RULE_BYTES] = '\0';
+    checkpoint->image = NULL;
+    return file;
+}
+
+int checkpoint_read_frame(FILE *file, const char *path,
+                          Checkpoint *checkpoint, int planar) {
+    unsigned char header[HEADER_BYTES], trailer[4];
+    uint32_t adler;
+    Pixel *buffer;
+    size_t j;
+    int ok;
+
+    checkpoint->image = malloc_image_layout(checkpoint->width,
+                                            checkpoint->height, 1, planar);
+    buffer = malloc(checkpoint->width * sizeof(*buffer));
+    if (!checkpoint->image || !buffer) {
+        fprintf(stderr, "Failed to allocate checkpoint image.\n");
+        exit(1);
+    }
+    /* The checksum covers the header too; it is read again for it. */
+    rewind(file);
+    ok = fread(header, 1, HEADER_BYTES, file) == HEADER_BYTES;
+    adler = adler32_update(1, header, HEADER_BYTES);
+    for (j = 0; ok && j < checkpoint->height; ++j) {
+        ok = read_row(file, checkpoint, j, buffer, &adler);
+    }
+    ok = ok && fread(trailer, 1, 4, file) == 4 && get_u32(trailer) == adler;
+    free(buffer);
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Checkpoint %s is truncated or corrupt.\n", path);
+        free_image(checkpoint->image);
+        checkpoint->image = NULL;
+        return 0;
+    }
+    refresh_halo(checkpoint->image);
+    return 1;
+}
@@ -0,0 +1,87 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <stddef.h>
+#include <stdio.h>
+#include "image.h"
+
+/**
+ * Checkpoints of long frame-evolution runs, to resume them from after they
+ * are killed.
+ *
+ * Random bytes are a pure function of the seed and the pixel's frame, row
+ * and column (see rng.h), so a frame, its number and the seed are all the
+ * state a run has: evolving the frame after it with the same rule gives the
+ * same frames as the uninterrupted run, bit for bit.
+ *
+ * A checkpoint file is a fixed 80-byte header, the pixels as interleaved RGB
+ * bytes, row by row, and the Adler-32 of everything before it:
+ *     magic      8 bytes, "IMGGENCK"
+ *     version    4 bytes, 1
+ *     reserved   4 bytes, 0
+ *     seed       8 bytes
+ *     frame      8 bytes
+ *     width      8 bytes
+ *     height     8 bytes
+ *     rule       32 bytes, name in FRAME_RULES (see rule.h), 0-padded
+ * Integers are little-endian. Files are written under a temporary name and
+ * renamed into place, so a checkpoint is either the previous one or the new
+ * one, never half of each.
+ */
+typedef struct Checkpoint {
+    unsigned long seed;
+    size_t frame;
+    size_t width;
+    size_t height;
+    char rule[33];
+    /* The frame, with an up-to-date halo. */
+    Image *image;
+} Checkpoint;
+
+/**
+ * Open the checkpoint at path and read its header into checkpoint, whose
+ * image is left NULL, so that it can be checked against the run before the
+ * frame is allocated. Returns the file, for checkpoint_read_frame or fclose,
+ * or prints why and returns NULL if it is not a checkpoint.
+ */
+FILE *checkpoint_read_header(const char *path, Checkpoint *checkpoint);
+
+/**
+ * Read the frame of checkpoint, whose header checkpoint_read_header read
+ * from file, into a halo image, planar if planar is nonzero, and close file.
+ * Prints why and returns 0 if the checkpoint at path is truncated or corrupt.
+ */
+int checkpoint_read_frame(FILE *file, const char *path,
+                          Checkpoint *checkpoint, int planar);
+
+/**
+ * Saves checkpoints on a thread of its own, from a copy of the frame, so
+ * that generation never waits for the disk.
+ */
+typedef struct Checkpointer Checkpointer;
+
+/**
+ * Start a checkpointer saving frames of a width x height run of rule, seeded
+ * with seed, to path, about every `every` frames. NULL if out of memory.
+ */
+Checkpointer *checkpointer_create(const char *path, size_t every,
+                                  unsigned long seed, const char *rule,
+                                  size_t width, size_t height);
+
+/**
+ * Frame number frame of the run is done, and the run could resume from it.
+ * If a multiple of `every` has been passed since the last checkpoint, copies
+ * the frame and saves it in the background, unless the last checkpoint is
+ * still being written: then this frame is skipped rather than waited for,
+ * and the next one offered is saved instead. May be called from any
+ * thread; frames are expected in increasing order.
+ */
+void checkpointer_offer(Checkpointer *checkpointer, const Image *image,
+                        size_t frame);
+
+/**
+ * Wait for the checkpoint being written, if any, stop the thread and free
+ * checkpointer.
+ */
+void checkpointer_free(Checkpointer *checkpointer);
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,632 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deflate.h"
+
+/*
+ * Compressor: greedy LZ77 over a hash chained 32 KB window, then one dynamic
+ * Huffman block per BLOCK_SYMBOLS symbols, or stored blocks where the data
+ * does not compress (noisy images mostly do not).
+ */
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+/* Earlier positions tried per match: more compresses better, but slower. */
+#define MAX_CHAIN 8
+/* Stop looking once a match is this long. */
+#define NICE_MATCH 64
+#define BLOCK_SYMBOLS 16384
+#define MAX_STORED 65535
+
+#define N_LITLEN 286
+#define N_DIST 30
+#define N_CODELEN 19
+#define END_OF_BLOCK 256
+#define MAX_CODE_LENGTH 15
+#define MAX_CODELEN_LENGTH 7
+
+static const unsigned short length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short dist_base[N_DIST] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577};
+static const unsigned char dist_extra[N_DIST] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+/* Order in which code length code lengths are sent. */
+static const unsigned char codelen_order[N_CODELEN] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static const uint32_t crc_table[256] = {
+    0x00000000UL, 0x77073096UL, 0xEE0E612CUL, 0x990951BAUL,
+    0x076DC419UL, 0x706AF48FUL, 0xE963A535UL, 0x9E6495A3UL,
+    0x0EDB8832UL, 0x79DCB8A4UL, 0xE0D5E91EUL, 0x97D2D988UL,
+    0x09B64C2BUL, 0x7EB17CBDUL, 0xE7B82D07UL, 0x90BF1D91UL,
+    0x1DB71064UL, 0x6AB020F2UL, 0xF3B97148UL, 0x84BE41DEUL,
+    0x1ADAD47DUL, 0x6DDDE4EBUL, 0xF4D4B551UL, 0x83D385C7UL,
+    0x136C9856UL, 0x646BA8C0UL, 0xFD62F97AUL, 0x8A65C9ECUL,
+    0x14015C4FUL, 0x63066CD9UL, 0xFA0F3D63UL, 0x8D080DF5UL,
+    0x3B6E20C8UL, 0x4C69105EUL, 0xD56041E4UL, 0xA2677172UL,
+    0x3C03E4D1UL, 0x4B04D447UL, 0xD20D85FDUL, 0xA50AB56BUL,
+    0x35B5A8FAUL, 0x42B2986CUL, 0xDBBBC9D6UL, 0xACBCF940UL,
+    0x32D86CE3UL, 0x45DF5C75UL, 0xDCD60DCFUL, 0xABD13D59UL,
+    0x26D930ACUL, 0x51DE003AUL, 0xC8D75180UL, 0xBFD06116UL,
+    0x21B4F4B5UL, 0x56B3C423UL, 0xCFBA9599UL, 0xB8BDA50FUL,
+    0x2802B89EUL, 0x5F058808UL, 0xC60CD9B2UL, 0xB10BE924UL,
+    0x2F6F7C87UL, 0x58684C11UL, 0xC1611DABUL, 0xB6662D3DUL,
+    0x76DC4190UL, 0x01DB7106UL, 0x98D220BCUL, 0xEFD5102AUL,
+    0x71B18589UL, 0x06B6B51FUL, 0x9FBFE4A5UL, 0xE8B8D433UL,
+    0x7807C9A2UL, 0x0F00F934UL, 0x9609A88EUL, 0xE10E9818UL,
+    0x7F6A0DBBUL, 0x086D3D2DUL, 0x91646C97UL, 0xE6635C01UL,
+    0x6B6B51F4UL, 0x1C6C6162UL, 0x856530D8UL, 0xF262004EUL,
+    0x6C0695EDUL, 0x1B01A57BUL, 0x8208F4C1UL, 0xF50FC457UL,
+    0x65B0D9C6UL, 0x12B7E950UL, 0x8BBEB8EAUL, 0xFCB9887CUL,
+    0x62DD1DDFUL, 0x15DA2D49UL, 0x8CD37CF3UL, 0xFBD44C65UL,
+    0x4DB26158UL, 0x3AB551CEUL, 0xA3BC0074UL, 0xD4BB30E2UL,
+    0x4ADFA541UL, 0x3DD895D7UL, 0xA4D1C46DUL, 0xD3D6F4FBUL,
+    0x4369E96AUL, 0x346ED9FCUL, 0xAD678846UL, 0xDA60B8D0UL,
+    0x44042D73UL, 0x33031DE5UL, 0xAA0A4C5FUL, 0xDD0D7CC9UL,
+    0x5005713CUL, 0x270241AAUL, 0xBE0B1010UL, 0xC90C2086UL,
+    0x5768B525UL, 0x206F85B3UL, 0xB966D409UL, 0xCE61E49FUL,
+    0x5EDEF90EUL, 0x29D9C998UL, 0xB0D09822UL, 0xC7D7A8B4UL,
+    0x59B33D17UL, 0x2EB40D81UL, 0xB7BD5C3BUL, 0xC0BA6CADUL,
+    0xEDB88320UL, 0x9ABFB3B6UL, 0x03B6E20CUL, 0x74B1D29AUL,
+    0xEAD54739UL, 0x9DD277AFUL, 0x04DB2615UL, 0x73DC1683UL,
+    0xE3630B12UL, 0x94643B84UL, 0x0D6D6A3EUL, 0x7A6A5AA8UL,
+    0xE40ECF0BUL, 0x9309FF9DUL, 0x0A00AE27UL, 0x7D079EB1UL,
+    0xF00F9344UL, 0x8708A3D2UL, 0x1E01F268UL, 0x6906C2FEUL,
+    0xF762575DUL, 0x806567CBUL, 0x196C3671UL, 0x6E6B06E7UL,
+    0xFED41B76UL, 0x89D32BE0UL, 0x10DA7A5AUL, 0x67DD4ACCUL,
+    0xF9B9DF6FUL, 0x8EBEEFF9UL, 0x17B7BE43UL, 0x60B08ED5UL,
+    0xD6D6A3E8UL, 0xA1D1937EUL, 0x38D8C2C4UL, 0x4FDFF252UL,
+    0xD1BB67F1UL, 0xA6BC5767UL, 0x3FB506DDUL, 0x48B2364BUL,
+    0xD80D2BDAUL, 0xAF0A1B4CUL, 0x36034AF6UL, 0x41047A60UL,
+    0xDF60EFC3UL, 0xA867DF55UL, 0x316E8EEFUL, 0x4669BE79UL,
+    0xCB61B38CUL, 0xBC66831AUL, 0x256FD2A0UL, 0x5268E236UL,
+    0xCC0C7795UL, 0xBB0B4703UL, 0x220216B9UL, 0x5505262FUL,
+    0xC5BA3BBEUL, 0xB2BD0B28UL, 0x2BB45A92UL, 0x5CB36A04UL,
+    0xC2D7FFA7UL, 0xB5D0CF31UL, 0x2CD99E8BUL, 0x5BDEAE1DUL,
+    0x9B64C2B0UL, 0xEC63F226UL, 0x756AA39CUL, 0x026D930AUL,
+    0x9C0906A9UL, 0xEB0E363FUL, 0x72076785UL, 0x05005713UL,
+    0x95BF4A82UL, 0xE2B87A14UL, 0x7BB12BAEUL, 0x0CB61B38UL,
+    0x92D28E9BUL, 0xE5D5BE0DUL, 0x7CDCEFB7UL, 0x0BDBDF21UL,
+    0x86D3D2D4UL, 0xF1D4E242UL, 0x68DDB3F8UL, 0x1FDA836EUL,
+    0x81BE16CDUL, 0xF6B9265BUL, 0x6FB077E1UL, 0x18B74777UL,
+    0x88085AE6UL, 0xFF0F6A70UL, 0x66063BCAUL, 0x11010B5CUL,
+    0x8F659EFFUL, 0xF862AE69UL, 0x616BFFD3UL, 0x166CCF45UL,
+    0xA00AE278UL, 0xD70DD2EEUL, 0x4E048354UL, 0x3903B3C2UL,
+    0xA7672661UL, 0xD06016F7UL, 0x4969474DUL, 0x3E6E77DBUL,
+    0xAED16A4AUL, 0xD9D65ADCUL, 0x40DF0B66UL, 0x37D83BF0UL,
+    0xA9BCAE53UL, 0xDEBB9EC5UL, 0x47B2CF7FUL, 0x30B5FFE9UL,
+    0xBDBDF21CUL, 0xCABAC28AUL, 0x53B39330UL, 0x24B4A3A6UL,
+    0xBAD03605UL, 0xCDD70693UL, 0x54DE5729UL, 0x23D967BFUL,
+    0xB3667A2EUL, 0xC4614AB8UL, 0x5D681B02UL, 0x2A6F2B94UL,
+    0xB40BBE37UL, 0xC30C8EA1UL, 0x5A05DF1BUL, 0x2D02EF8DUL
+};
+
+void byte_buffer_append(Byte_buffer *buffer, const void *bytes, size_t n) {
+    if (buffer->size + n > buffer->capacity) {
+        size_t capacity = buffer->capacity ? 2 * buffer->capacity : 4096;
+        while (capacity < buffer->size + n) {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        if (!buffer->data) {
+            fprintf(stderr, "Failed to grow byte buffer.\n");
+            exit(1);
+        }
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, bytes, n);
+    buffer->size += n;
+}
+
+void byte_buffer_free(Byte_buffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = buffer->capacity = 0;
+}
+
+/**
+ * Deflate bit stream: bits go out least significant first, 32 at a time.
+ */
+typedef struct Bit_writer {
+    Byte_buffer *out;
+    uint64_t bits;
+    int n_bits;
+} Bit_writer;
+
+/**
+ * Append n <= 16 bits of value.
+ */
+static void put_bits(Bit_writer *writer, unsigned long value, int n) {
+    writer->bits |= (uint64_t)value << writer->n_bits;
+    writer->n_bits += n;
+    if (writer->n_bits >= 32) {
+        unsigned char bytes[4];
+        bytes[0] = (unsigned char)writer->bits;
+        bytes[1] = (unsigned char)(writer->bits >> 8);
+        bytes[2] = (unsigned char)(writer->bits >> 16);
+        bytes[3] = (unsigned char)(writer->bits >> 24);
+        byte_buffer_append(writer->out, bytes, 4);
+        writer->bits >>= 32;
+        writer->n_bits -= 32;
+    }
+}
+
+/**
+ * Pad with zero bits up to the next byte boundary, and write out every
+ * complete byte.
+ */
+static void align_bits(Bit_writer *writer) {
+    if (writer->n_bits % 8 != 0) {
+        put_bits(writer, 0, 8 - writer->n_bits % 8);
+    }
+    while (writer->n_bits > 0) {
+        unsigned char byte = (unsigned char)writer->bits;
+        byte_buffer_append(writer->out, &byte, 1);
+        writer->bits >>= 8;
+        writer->n_bits -= 8;
+    }
+}
+
+typedef struct Weighted_symbol {
+    unsigned long weight;
+    int symbol;
+} Weighted_symbol;
+
+static int compare_weighted(const void *a, const void *b) {
+    const Weighted_symbol *x = a, *y = b;
+    if (x->weight != y->weight) {
+        return x->weight < y->weight ? -1 : 1;
+    }
+    return x->symbol - y->symbol;
+}
+
+/**
+ * Huffman code lengths for n_symbols (at most N_LITLEN) symbols with the
+ * given frequencies, none longer than limit. Always gives at least two
+ * symbols a code, so the code is complete.
+ */
+static void build_lengths(const unsigned long *freq, int n_symbols, int limit,
+                          unsigned char *lengths) {
+    Weighted_symbol leaves[N_LITLEN];
+    unsigned long weight[2 * N_LITLEN], scaled[N_LITLEN];
+    int parent[2 * N_LITLEN], depth[2 * N_LITLEN];
+    int n_leaves, n_nodes, next_leaf, next_node, k, s, max_depth;
+
+    n_leaves = 0;
+    for (s = 0; s < n_symbols; ++s) {
+        scaled[s] = freq[s];
+        n_leaves += freq[s] > 0;
+    }
+    for (s = 0; n_leaves < 2; ++s) {
+        if (scaled[s] == 0) {
+            scaled[s] = 1;
+            ++n_leaves;
+        }
+    }
+
+    for (;;) {
+        n_leaves = 0;
+        for (s = 0; s < n_symbols; ++s) {
+            if (scaled[s] > 0) {
+                leaves[n_leaves].weight = scaled[s];
+                leaves[n_leaves].symbol = s;
+                ++n_leaves;
+            }
+        }
+        qsort(leaves, (size_t)n_leaves, sizeof(*leaves), &compare_weighted);
+        for (k = 0; k < n_leaves; ++k) {
+            weight[k] = leaves[k].weight;
+        }
+
+        /*
+         * Two-queue construction: leaves in weight order, then internal
+         * nodes, which are created in weight order too.
+         */
+        n_nodes = n_leaves;
+        next_leaf = 0;
+        next_node = n_leaves;
+        for (k = 0; k < n_leaves - 1; ++k) {
+            int pick[2], p;
+            for (p = 0; p < 2; ++p) {
+                if (next_leaf < n_leaves &&
+                    (next_node >= n_nodes ||
+                     weight[next_leaf] <= weight[next_node])) {
+                    pick[p] = next_leaf++;
+                } else {
+                    pick[p] = next_node++;
+                }
+            }
+            weight[n_nodes] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = n_nodes;
+            ++n_nodes;
+        }
+
+        /* Parents come after their children. */
+        depth[n_nodes - 1] = 0;
+        max_depth = 0;
+        for (k = n_nodes - 2; k >= 0; --k) {
+            depth[k] = depth[parent[k]] + 1;
+            if (depth[k] > max_depth) {
+                max_depth = depth[k];
+            }
+        }
+        if (max_depth <= limit) {
+            break;
+        }
+        /* Too deep: flatten the distribution and try again. */
+        for (s = 0; s < n_symbols; ++s) {
+            if (scaled[s] > 0) {
+                scaled[s] = (scaled[s] + 1) / 2;
+            }
+        }
+    }
+
+    memset(lengths, 0, (size_t)n_symbols);
+    for (k = 0; k < n_leaves; ++k) {
+        lengths[leaves[k].symbol] = (unsigned char)depth[k];
+    }
+}
+
+/**
+ * Canonical codes for lengths, bit reversed for put_bits.
+ */
+static void build_codes(const unsigned char *lengths, int n_symbols,
+                        unsigned short *codes) {
+    int count[MAX_CODE_LENGTH + 1], next_code[MAX_CODE_LENGTH + 1];
+    int s, length, code, bit;
+
+    memset(count, 0, sizeof(count));
+    for (s = 0; s < n_symbols; ++s) {
+        ++count[lengths[s]];
+    }
+    count[0] = 0;
+    code = 0;
+    for (length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code = (code + count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+    for (s = 0; s < n_symbols; ++s) {
+        int reversed = 0;
+        length = lengths[s];
+        if (length == 0) {
+            continue;
+        }
+        code = next_code[length]++;
+        for (bit = 0; bit < length; ++bit) {
+            reversed = (reversed << 1) | ((code >> bit) & 1);
+        }
+        codes[s] = (unsigned short)reversed;
+    }
+}
+
+typedef struct Deflate_state {
+    /* Position + 1 of the latest occurrence of each hash, 0 if none. */
+    uint32_t head[HASH_SIZE];
+    /* Position + 1 of the previous occurrence of the same hash. */
+    uint32_t prev[WINDOW_SIZE];
+
+    /* Symbols of the current block: a literal, or a length and distance. */
+    unsigned short litlen[BLOCK_SYMBOLS];
+    unsigned short dist[BLOCK_SYMBOLS];
+    size_t n_symbols;
+    unsigned long litlen_freq[N_LITLEN];
+    unsigned long dist_freq[N_DIST];
+
+    /* Length code - 257 of each match length, distance code of distances. */
+    unsigned char length_code[MAX_MATCH + 1];
+    unsigned char dist_code[512];
+} Deflate_state;
+
+static void init_code_tables(Deflate_state *state) {
+    int code, extra;
+    unsigned length, dist;
+
+    for (code = 0; code < 29; ++code) {
+        for (extra = 0; extra < (1 << length_extra[code]); ++extra) {
+            length = length_base[code] + (unsigned)extra;
+            if (length <= MAX_MATCH) {
+                state->length_code[length] = (unsigned char)code;
+            }
+        }
+    }
+    /* 258 has its own code, though 227 + 31 would also reach it. */
+    state->length_code[MAX_MATCH] = 28;
+    for (code = 0; code < N_DIST; ++code) {
+        for (dist = dist_base[code];
+             dist < dist_base[code] + (1U << dist_extra[code]); ++dist) {
+            if (dist - 1 < 256) {
+                state->dist_code[dist - 1] = (unsigned char)code;
+            } else {
+                state->dist_code[256 + ((dist - 1) >> 7)] =
+                    (unsigned char)code;
+            }
+        }
+    }
+}
+
+static int dist_code(const Deflate_state *state, unsigned dist) {
+    return dist - 1 < 256 ? state->dist_code[dist - 1]
+                          : state->dist_code[256 + ((dist - 1) >> 7)];
+}
+
+static void emit_stored(Bit_writer *writer, const unsigned char *raw,
+                        size_t n, int last) {
+    do {
+        size_t piece = n < MAX_STORED ? n : MAX_STORED;
+        put_bits(writer, (unsigned long)(last && piece == n), 1);
+        put_bits(writer, 0, 2);
+        align_bits(writer);
+        put_bits(writer, (unsigned long)piece, 16);
+        put_bits(writer, (unsigned long)(~piece & 0xFFFF), 16);
+        if (piece > 0) {
+            byte_buffer_append(writer->out, raw, piece);
+            raw += piece;
+        }
+        n -= piece;
+    } while (n > 0);
+}
+
+/**
+ * Write the symbols collected in state as one block, covering raw bytes of
+ * input; stored instead if that is smaller.
+ */
+static void emit_block(Deflate_state *state, Bit_writer *writer,
+                       const unsigned char *raw, size_t n_raw, int last) {
+    unsigned char litlen_lengths[N_LITLEN], dist_lengths[N_DIST];
+    unsigned short litlen_codes[N_LITLEN], dist_codes[N_DIST];
+    unsigned char lengths[N_LITLEN + N_DIST];
+    unsigned char codelen_lengths[N_CODELEN];
+    unsigned short codelen_codes[N_CODELEN];
+    unsigned long codelen_freq[N_CODELEN];
+    /* Run-length coded lengths: symbol, and value of its extra bits. */
+    unsigned char rle_symbols[N_LITLEN + N_DIST];
+    unsigned char rle_extra[N_LITLEN + N_DIST];
+    static const int rle_extra_bits[3] = {2, 3, 7};
+    int n_litlen, n_dist, n_codelen, n_lengths, n_rle, i, k;
+    unsigned long dynamic_bits, stored_bits;
+    size_t s;
+
+    state->litlen_freq[END_OF_BLOCK] = 1;
+    build_lengths(state->litlen_freq, N_LITLEN, MAX_CODE_LENGTH,
+                  litlen_lengths);
+    build_lengths(state->dist_freq, N_DIST, MAX_CODE_LENGTH, dist_lengths);
+    for (n_litlen = N_LITLEN; litlen_lengths[n_litlen - 1] == 0; --n_litlen) {
+    }
+    for (n_dist = N_DIST; dist_lengths[n_dist - 1] == 0; --n_dist) {
+    }
+    memcpy(lengths, litlen_lengths, (size_t)n_litlen);
+    memcpy(lengths + n_litlen, dist_lengths, (size_t)n_dist);
+    n_lengths = n_litlen + n_dist;
+
+    /* Run-length code the code lengths with symbols 16, 17 and 18. */
+    n_rle = 0;
+    for (i = 0; i < n_lengths; i += k) {
+        int run = 1;
+        while (i + run < n_lengths && lengths[i + run] == lengths[i]) {
+            ++run;
+        }
+        if (lengths[i] == 0 && run >= 11) {
+            k = run < 138 ? run : 138;
+            rle_symbols[n_rle] = 18;
+            rle_extra[n_rle++] = (unsigned char)(k - 11);
+        } else if (lengths[i] == 0 && run >= 3) {
+            k = run;
+            rle_symbols[n_rle] = 17;
+            rle_extra[n_rle++] = (unsigned char)(k - 3);
+        } else if (lengths[i] != 0 && i > 0 && lengths[i - 1] == lengths[i] &&
+                   run >= 3) {
+            k = run < 6 ? run : 6;
+            rle_symbols[n_rle] = 16;
+            rle_extra[n_rle++] = (unsigned char)(k - 3);
+        } else {
+            k = 1;
+            rle_symbols[n_rle] = lengths[i];
+            rle_extra[n_rle++] = 0;
+        }
+    }
+    memset(codelen_freq, 0, sizeof(codelen_freq));
+    for (i = 0; i < n_rle; ++i) {
+        ++codelen_freq[rle_symbols[i]];
+    }
+    build_lengths(codelen_freq, N_CODELEN, MAX_CODELEN_LENGTH,
+                  codelen_lengths);
+    for (n_codelen = N_CODELEN;
+         n_codelen > 4 && codelen_lengths[codelen_order[n_codelen - 1]] == 0;
+         --n_codelen) {
+    }
+
+    /* Sizes of the two encodings, in bits. */
+    dynamic_bits = 3 + 5 + 5 + 4 + 3 * (unsigned long)n_codelen;
+    for (i = 0; i < n_rle; ++i) {
+        dynamic_bits += codelen_lengths[rle_symbols[i]];
+        if (rle_symbols[i] >= 16) {
+            dynamic_bits += (unsigned long)rle_extra_bits[rle_symbols[i] - 16];
+        }
+    }
+    for (i = 0; i < N_LITLEN; ++i) {
+        dynamic_bits += state->litlen_freq[i] * litlen_lengths[i];
+        if (i > END_OF_BLOCK) {
+            dynamic_bits += state->litlen_freq[i] * length_extra[i - 257];
+        }
+    }
+    for (i = 0; i < N_DIST; ++i) {
+        dynamic_bits += state->dist_freq[i] * (dist_lengths[i] + dist_extra[i]);
+    }
+    stored_bits = (unsigned long)(n_raw / MAX_STORED + 1) * (3 + 7 + 32) +
+                  8 * (unsigned long)n_raw;
+
+    if (stored_bits < dynamic_bits) {
+        emit_stored(writer, raw, n_raw, last);
+    } else {
+        build_codes(litlen_lengths, N_LITLEN, litlen_codes);
+        build_codes(dist_lengths, N_DIST, dist_codes);
+        build_codes(codelen_lengths, N_CODELEN, codelen_codes);
+
+        put_bits(writer, (unsigned long)last, 1);
+        put_bits(writer, 2, 2);
+        put_bits(writer, (unsigned long)(n_litlen - 257), 5);
+        put_bits(writer, (unsigned long)(n_dist - 1), 5);
+        put_bits(writer, (unsigned long)(n_codelen - 4), 4);
+        for (i = 0; i < n_codelen; ++i) {
+            put_bits(writer, codelen_lengths[codelen_order[i]], 3);
+        }
+        for (i = 0; i < n_rle; ++i) {
+            int symbol = rle_symbols[i];
+            put_bits(writer, codelen_codes[symbol], codelen_lengths[symbol]);
+            if (symbol >= 16) {
+                put_bits(writer, rle_extra[i], rle_extra_bits[symbol - 16]);
+            }
+        }
+
+        for (s = 0; s < state->n_symbols; ++s) {
+            unsigned length = state->litlen[s], dist = state->dist[s];
+            if (dist == 0) {
+                put_bits(writer, litlen_codes[length], litlen_lengths[length]);
+            } else {
+                int code = state->length_code[length];
+                int d_code = dist_code(state, dist);
+                put_bits(writer, litlen_codes[257 + code],
+                         litlen_lengths[257 + code]);
+                put_bits(writer, length - length_base[code],
+                         length_extra[code]);
+                put_bits(writer, dist_codes[d_code], dist_lengths[d_code]);
+                put_bits(writer, dist - dist_base[d_code], dist_extra[d_code]);
+            }
+        }
+        put_bits(writer, litlen_codes[END_OF_BLOCK],
+                 litlen_lengths[END_OF_BLOCK]);
+    }
+
+    state->n_symbols = 0;
+    memset(state->litlen_freq, 0, sizeof(state->litlen_freq));
+    memset(state->dist_freq, 0, sizeof(state->dist_freq));
+}
+
+static size_t hash_at(const unsigned char *data) {
+    return (((size_t)data[0] << 10) ^ ((size_t)data[1] << 5) ^ data[2]) &
+           (HASH_SIZE - 1);
+}
+
+/**
+ * Make position pos the latest occurrence of its hash.
+ */
+static void insert_position(Deflate_state *state, const unsigned char *data,
+                            size_t pos) {
+    size_t hash = hash_at(data + pos);
+    state->prev[pos % WINDOW_SIZE] = state->head[hash];
+    state->head[hash] = (uint32_t)(pos + 1);
+}
+
+void deflate_segment(Byte_buffer *out, const unsigned char *data, size_t n,
+                     int final) {
+    Deflate_state *state = calloc(1, sizeof(*state));
+    Bit_writer writer;
+    size_t pos, block_start;
+
+    if (!state) {
+        fprintf(stderr, "Failed to allocate deflate state.\n");
+        exit(1);
+    }
+    init_code_tables(state);
+    writer.out = out;
+    writer.bits = 0;
+    writer.n_bits = 0;
+
+    pos = block_start = 0;
+    while (pos < n) {
+        size_t best_length = 0, best_dist = 0;
+        if (n - pos >= MIN_MATCH) {
+            size_t max_length = n - pos < MAX_MATCH ? n - pos : MAX_MATCH;
+            uint32_t candidate = state->head[hash_at(data + pos)];
+            int chain = MAX_CHAIN;
+            while (candidate != 0 && chain-- > 0) {
+                size_t match = candidate - 1, length = 0;
+                if (pos - match > WINDOW_SIZE) {
+                    break;
+                }
+                if (data[match + best_length] == data[pos + best_length]) {
+                    while (length < max_length &&
+                           data[match + length] == data[pos + length]) {
+                        ++length;
+                    }
+                    if (length > best_length) {
+                        best_length = length;
+                        best_dist = pos - match;
+                        if (length >= NICE_MATCH || length == max_length) {
+                            break;
+                        }
+                    }
+                }
+                candidate = state->prev[match % WINDOW_SIZE];
+            }
+            insert_position(state, data, pos);
+        }
+
+        if (best_length >= MIN_MATCH) {
+            size_t end = pos + best_length;
+            state->litlen[state->n_symbols] = (unsigned short)best_length;
+            state->dist[state->n_symbols++] = (unsigned short)best_dist;
+            ++state->litlen_freq[257 + state->length_code[best_length]];
+            ++state->dist_freq[dist_code(state, (unsigned)best_dist)];
+            for (++pos; pos < end; ++pos) {
+                if (n - pos >= MIN_MATCH) {
+                    insert_position(state, data, pos);
+                }
+            }
+        } else {
+            state->litlen[state->n_symbols] = data[pos];
+            state->dist[state->n_symbols++] = 0;
+            ++state->litlen_freq[data[pos]];
+            ++pos;
+        }
+
+        if (state->n_symbols == BLOCK_SYMBOLS && pos < n) {
+            emit_block(state, &writer, data + block_start, pos - block_start,
+                       0);
+            block_start = pos;
+        }
+    }
+    emit_block(state, &writer, data + block_start, pos - block_start, final);
+    if (!final) {
+        /* Empty stored block: ends the segment on a byte boundary. */
+        emit_stored(&writer, NULL, 0, 0);
+    }
+    align_bits(&writer);
+    free(state);
+}
+
+uint32_t adler32_update(uint32_t adler, const unsigned char *data, size_t n) {
+    /* Largest run of bytes before the sums must be reduced mod 65521. */
+    const size_t max_run = 5552;
+    unsigned long a = adler & 0xFFFF, b = (adler >> 16) & 0xFFFF;
+
+    while (n > 0) {
+        size_t run = n < max_run ? n : max_run;
+        n -= run;
+        while (run-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (uint32_t)((b << 16) | a);
+}
+
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t n) {
+    crc = ~crc;
+    while (n-- > 0) {
+        crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc & 0xFFFFFFFFUL;
+}
@@ -0,0 +1,46 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Growable array of bytes.
+ */
+typedef struct Byte_buffer {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} Byte_buffer;
+
+/**
+ * Append n bytes to buffer, growing it as needed.
+ */
+void byte_buffer_append(Byte_buffer *buffer, const void *bytes, size_t n);
+
+void byte_buffer_free(Byte_buffer *buffer);
+
+/**
+ * Compress n bytes of data into raw deflate (RFC 1951) blocks appended to out.
+ *
+ * Segments compressed separately can be concatenated into one stream, so a
+ * large input can be split and its parts compressed in parallel: a segment
+ * that is not final ends with an empty stored block, which leaves the stream
+ * byte aligned, and only the final segment marks its last block as final.
+ * Matches never reach back into a previous segment.
+ */
+void deflate_segment(Byte_buffer *out, const unsigned char *data, size_t n,
+                     int final);
+
+/**
+ * Running Adler-32 (zlib stream checksum) of data, starting from adler (1
+ * for a new checksum).
+ */
+uint32_t adler32_update(uint32_t adler, const unsigned char *data, size_t n);
+
+/**
+ * Running CRC-32 (PNG chunk checksum) of data, starting from crc (0 for a new
+ * checksum).
+ */
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t n);
+
+#endif /* DEFLATE_H */
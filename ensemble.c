@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ensemble.h"
+#include "evolve_plane.h"
+
+/*
+ * Members evolved in lockstep at most. Rows of more members no longer stay
+ * in cache, which costs more than the longer runs save.
+ */
+#define ENSEMBLE_GROUP 16
+
+/*
+ * Ensemble row evolvers: one run of the evolve_plane_* kernel of the
+ * strategy per plane, parents n_members bytes to the left and right.
+ */
+
+void evolve_ensemble_single_parent(const Planes *dst_row,
+                                   const Planes *src_row, size_t n,
+                                   size_t n_members,
+                                   const Planes *choice_row,
+                                   const Planes *noise_row) {
+    int c;
+    (void)n_members;
+    (void)choice_row;
+    for (c = 0; c < 3; ++c) {
+        evolve_plane_single_parent(dst_row->channel[c], src_row->channel[c],
+                                   noise_row->channel[c], n);
+    }
+}
+
+void evolve_ensemble_dad_mom_genes(const Planes *dst_row,
+                                   const Planes *src_row, size_t n,
+                                   size_t n_members,
+                                   const Planes *choice_row,
+                                   const Planes *noise_row) {
+    int c;
+    for (c = 0; c < 3; ++c) {
+        const unsigned char *src = src_row->channel[c];
+        evolve_plane_dad_mom_genes(dst_row->channel[c], src - n_members,
+                                   src + n_members, choice_row->channel[c],
+                                   noise_row->channel[c], n);
+    }
+}
+
+void evolve_ensemble_dad_or_mom(const Planes *dst_row, const Planes *src_row,
+                                size_t n, size_t n_members,
+                                const Planes *choice_row,
+                                const Planes *noise_row) {
+    int c;
+    (void)noise_row;
+    for (c = 0; c < 3; ++c) {
+        const unsigned char *src = src_row->channel[c];
+        /* The whole pixel follows the choice of its red channel. */
+        evolve_plane_dad_or_mom(dst_row->channel[c], src - n_members,
+                                src + n_members, choice_row->channel[0], n);
+    }
+}
+
+void evolve_ensemble_3_parent_genes(const Planes *dst_row,
+                                    const Planes *src_row, size_t n,
+                                    size_t n_members,
+                                    const Planes *choice_row,
+                                    const Planes *noise_row) {
+    int c;
+    for (c = 0; c < 3; ++c) {
+        const unsigned char *src = src_row->channel[c];
+        evolve_plane_3_parent_genes(dst_row->channel[c], src - n_members,
+                                    src, src + n_members,
+                                    choice_row->channel[c],
+                                    noise_row->channel[c], n);
+    }
+}
+
+void evolve_ensemble_dad_mom_average(const Planes *dst_row,
+                                     const Planes *src_row, size_t n,
+                                     size_t n_members,
+                                     const Planes *choice_row,
+                                     const Planes *noise_row) {
+    int c;
+    (void)choice_row;
+    for (c = 0; c < 3; ++c) {
+        const unsigned char *src = src_row->channel[c];
+        evolve_plane_dad_mom_average(dst_row->channel[c], src - n_members,
+                                     src + n_members, noise_row->channel[c],
+                                     n);
+    }
+}
+
+void evolve_ensemble_dad_mom_dad_above(const Planes *dst_row,
+                                       const Planes *src_row, size_t n,
+                                       size_t n_members,
+                                       const Planes *choice_row,
+                                       const Planes *noise_row) {
+    int c;
+    (void)choice_row;
+    for (c = 0; c < 3; ++c) {
+        const unsigned char *src = src_row->channel[c];
+        evolve_plane_dad_mom_average(dst_row->channel[c], src,
+                                     src + n_members, noise_row->channel[c],
+                                     n);
+    }
+}
+
+/**
+ * Fill the padding of every plane of row, width pixels of n_members members:
+ * the last pixel before the first, the first after the last.
+ */
+static void pad_ensemble_row(const Planes *row, size_t width,
+                             size_t n_members) {
+    size_t n = width * n_members;
+    int c;
+    for (c = 0; c < 3; ++c) {
+        unsigned char *plane = row->channel[c];
+        memcpy(plane - n_members, plane + n - n_members, n_members);
+        memcpy(plane + n, plane, n_members);
+    }
+}
+
+/**
+ * Transpose the n_rows x n_columns bytes of src, rows src_stride bytes apart,
+ * into dst, rows dst_stride bytes apart: byte c of row r goes to byte r of
+ * row c.
+ */
+static void transpose_bytes(unsigned char *dst, size_t dst_stride,
+                            const unsigned char *src, size_t src_stride,
+                            size_t n_rows, size_t n_columns) {
+    size_t r = 0, c;
+#ifdef __SSE2__
+    /*
+     * 16x16 tiles: four rounds of interleaving the bytes of rows k and
+     * k + 8 (a perfect shuffle) transpose a tile held in 16 vectors.
+     */
+    __m128i v[16], w[16];
+    size_t k;
+    int round;
+
+    for (; r + 16 <= n_rows; r += 16) {
+        for (c = 0; c + 16 <= n_columns; c += 16) {
+            for (k = 0; k < 16; ++k) {
+                v[k] = _mm_loadu_si128((const __m128i *)(const void *)
+                                       (src + (r + k) * src_stride + c));
+            }
+            for (round = 0; round < 4; ++round) {
+                for (k = 0; k < 8; ++k) {
+                    w[2 * k] = _mm_unpacklo_epi8(v[k], v[k + 8]);
+                    w[2 * k + 1] = _mm_unpackhi_epi8(v[k], v[k + 8]);
+                }
+                memcpy(v, w, sizeof(v));
+            }
+            for (k = 0; k < 16; ++k) {
+                _mm_storeu_si128((__m128i *)(void *)
+                                 (dst + (c + k) * dst_stride + r), v[k]);
+            }
+        }
+        for (; c < n_columns; ++c) {
+            for (k = r; k < r + 16; ++k) {
+                dst[c * dst_stride + k] = src[k * src_stride + c];
+            }
+        }
+    }
+#endif
+    for (; r < n_rows; ++r) {
+        for (c = 0; c < n_columns; ++c) {
+            dst[c * dst_stride + r] = src[r * src_stride + c];
+        }
+    }
+}
+
+/**
+ * Copy row y of every member out of the ensemble row into its image, by way
+ * of planes, which hold the width bytes of one member after another.
+ */
+static void scatter_ensemble_row(Image **images, const Planes *row,
+                                 const Planes *planes, size_t width,
+                                 size_t n_members, size_t y) {
+    size_t m;
+    int c;
+
+    for (c = 0; c < 3; ++c) {
+        transpose_bytes(planes->channel[c], width, row->channel[c],
+                        n_members, width, n_members);
+    }
+    for (m = 0; m < n_members; ++m) {
+        interleave_planes(images[m]->pixels + y * images[m]->stride,
+                          planes->channel[0] + m * width,
+                          planes->channel[1] + m * width,
+                          planes->channel[2] + m * width, width);
+    }
+}
+
+/**
+ * Generate the images of n_members members in lockstep into images, which
+ * are allocated.
+ */
+static void generate_group(Image **images, size_t width, size_t height,
+                           Ensemble_row_evolver row_evolver, const Rng *rngs,
+                           size_t n_members) {
+    /* Bytes of a plane of an ensemble row, and of its padding. */
+    size_t n = width * n_members, padded = n + 2 * n_members;
+    unsigned char *row_bytes = malloc(2 * 3 * padded);
+    unsigned char *choice_bytes = malloc(3 * n);
+    unsigned char *noise_bytes = malloc(3 * n);
+    unsigned char *member_bytes = malloc(3 * n);
+    Planes rows[2], choice_row, noise_row, member_planes;
+    size_t j;
+    int k, c;
+
+    if (!row_bytes || !choice_bytes || !noise_bytes || !member_bytes) {
+        fprintf(stderr, "Failed to allocate ensemble rows.\n");
+        exit(1);
+    }
+    for (k = 0; k < 2; ++k) {
+        for (c = 0; c < 3; ++c) {
+            rows[k].channel[c] = row_bytes + (3 * k + c) * padded + n_members;
+        }
+    }
+    split_planes(&choice_row, choice_bytes, n);
+    split_planes(&noise_row, noise_bytes, n);
+    split_planes(&member_planes, member_bytes, n);
+
+    /* Row j lives in rows[j % 2], as in stream_planar_image. */
+    rng_fill_ensemble(rngs, n_members, 0, 0, RNG_INIT, &rows[0], 0, width);
+    pad_ensemble_row(&rows[0], width, n_members);
+    scatter_ensemble_row(images, &rows[0], &member_planes, width, n_members,
+                         0);
+    for (j = 1; j < height; ++j) {
+        rng_fill_ensemble(rngs, n_members, 0, j, RNG_CHOICE, &choice_row, 0,
+                          width);
+        rng_fill_ensemble(rngs, n_members, 0, j, RNG_NOISE, &noise_row, 0,
+                          width);
+        (*row_evolver)(&rows[j % 2], &rows[(j - 1) % 2], n, n_members,
+                       &choice_row, &noise_row);
+        pad_ensemble_row(&rows[j % 2], width, n_members);
+        scatter_ensemble_row(images, &rows[j % 2], &member_planes, width,
+                             n_members, j);
+    }
+    free(row_bytes);
+    free(choice_bytes);
+    free(noise_bytes);
+    free(member_bytes);
+}
+
+Image **generate_ensemble(size_t width, size_t height,
+                          Ensemble_row_evolver row_evolver, const Rng *rngs,
+                          size_t n_members) {
+    Image **images = malloc(n_members * sizeof(*images));
+    size_t m, n;
+
+    if (!images) {
+        fprintf(stderr, "Failed to allocate ensemble.\n");
+        exit(1);
+    }
+    for (m = 0; m < n_members; ++m) {
+        images[m] = malloc_image(width, height);
+        if (!images[m]) {
+            while (m > 0) {
+                free_image(images[--m]);
+            }
+            free(images);
+            return NULL;
+        }
+    }
+    for (m = 0; m < n_members; m += n) {
+        n = n_members - m < ENSEMBLE_GROUP ? n_members - m : ENSEMBLE_GROUP;
+        generate_group(images + m, width, height, row_evolver, rngs + m, n);
+    }
+    return images;
+}
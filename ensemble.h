@@ -0,0 +1,83 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+#include <stddef.h>
+#include "image.h"
+#include "rng.h"
+
+/**
+ * Ensembles: many images of the same size and strategy, each with a seed of
+ * its own, evolved in lockstep. Rows of every member are stored together,
+ * plane by plane, with the member innermost: byte i * n_members + m of a
+ * channel's plane is pixel i of member m. The same pixel of every member is
+ * a run of adjacent bytes, and the pixels either side of it in a member are
+ * n_members bytes away, so the evolve_plane_* kernels advance a row of all
+ * the members at once, a vector of members at a time, with parents at
+ * offsets -n_members and +n_members instead of -1 and +1. Small images,
+ * whose rows are too short to keep the vectors busy, make long runs that
+ * way.
+ *
+ * Large ensembles are evolved a group of members at a time.
+ *
+ * Every plane of an ensemble row is padded with a pixel of every member on
+ * either side, holding the pixels at the other end of the row, so that the
+ * first and last pixels need no wrapping either. Each member comes out the
+ * same, bit for bit, as the image of its seed from generate_image.
+ */
+
+/**
+ * Evolve the n bytes of every plane of dst_row, pixels of n_members members
+ * as above, from src_row, whose padding is filled in. choice_row and
+ * noise_row are filled by rng_fill_ensemble.
+ */
+void evolve_ensemble_single_parent(const Planes *dst_row,
+                                   const Planes *src_row, size_t n,
+                                   size_t n_members,
+                                   const Planes *choice_row,
+                                   const Planes *noise_row);
+
+void evolve_ensemble_dad_mom_genes(const Planes *dst_row,
+                                   const Planes *src_row, size_t n,
+                                   size_t n_members,
+                                   const Planes *choice_row,
+                                   const Planes *noise_row);
+
+void evolve_ensemble_dad_or_mom(const Planes *dst_row, const Planes *src_row,
+                                size_t n, size_t n_members,
+                                const Planes *choice_row,
+                                const Planes *noise_row);
+
+void evolve_ensemble_3_parent_genes(const Planes *dst_row,
+                                    const Planes *src_row, size_t n,
+                                    size_t n_members,
+                                    const Planes *choice_row,
+                                    const Planes *noise_row);
+
+void evolve_ensemble_dad_mom_average(const Planes *dst_row,
+                                     const Planes *src_row, size_t n,
+                                     size_t n_members,
+                                     const Planes *choice_row,
+                                     const Planes *noise_row);
+
+void evolve_ensemble_dad_mom_dad_above(const Planes *dst_row,
+                                       const Planes *src_row, size_t n,
+                                       size_t n_members,
+                                       const Planes *choice_row,
+                                       const Planes *noise_row);
+
+/**
+ * Function pointer for an ensemble row evolver.
+ */
+typedef void (*Ensemble_row_evolver)(const Planes *, const Planes *, size_t,
+                                     size_t, const Planes *, const Planes *);
+
+/**
+ * Generate n_members images of width x height pixels, image m drawing its
+ * random bytes from rngs[m], with row_evolver. Returns the images,
+ * interleaved, in an array of n_members; the caller frees both. Returns NULL
+ * if the images cannot be allocated.
+ */
+Image **generate_ensemble(size_t width, size_t height,
+                          Ensemble_row_evolver row_evolver, const Rng *rngs,
+                          size_t n_members);
+
+#endif /* ENSEMBLE_H */
@@ -1,220 +1,1094 @@
-#include <assert.h>
+#define _POSIX_C_SOURCE 200112L
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include "activity.h"
 #include "image.h"
-#include "evolve_pixel.h"
 #include "evolve_image.h"
+#include "evolve_plane.h"
+#include "frame_queue.h"
+#include "rng.h"
+#include "rule.h"
+#include "tiling.h"
+#include "trace.h"
 
-#define MAX_FILENAME_LENGTH 100
-#define WRITE_TO_DISK 0
+/* Bytes of a frame file name after its prefix, terminator included. */
+#define MAX_FILENAME_LENGTH 32
+/* Bands per thread, so that uneven bands still balance out. */
+#define BANDS_PER_THREAD 4
 
-void evolve_image_4_parent_genes(Image *dst_image, const Image *src_image) {
-    size_t i, j;
-    size_t width, height;
-    assert(dst_image->width == src_image->width);
-    assert(dst_image->height == src_image->height);
-    width = dst_image->width;
-    height = dst_image->height;
+/*
+ * All frame evolvers read the source through its halo: for destination pixel
+ * i of row j, the source neighbours are at fixed offsets from src_row + i,
+ * with no wrapping or bounds checks in the inner loop. Random bytes are keyed
+ * by frame row y, which is j except in the bands of tiling.c.
+ */
 
-    /* Need to evolve every pixel of dst_image based on src_image. */
-    for (j = 0; j < height; ++j) {
-        for (i = 0; i < width; ++i) {
-            evolve_pixel_4_parent_genes(
-                /* destination pixel */
-                pixel_at(dst_image, i, j),
-                /* source pixel below */
-                pixel_at(src_image, i, wrap(j, -1, height)),
-                /* source pixel above */
-                pixel_at(src_image, i, wrap(j, 1, height)),
-                /* source pixel left */
-                pixel_at(src_image, wrap(i, -1, width), j),
-                /* source pixel right */
-                pixel_at(src_image, wrap(i, 1, width), j));
-        }
-    }
-}
-
-void evolve_image_4_parent_average(Image *dst_image, const Image *src_image) {
-    size_t i, j;
-    size_t width, height;
-    assert(dst_image->width == src_image->width);
-    assert(dst_image->height == src_image->height);
-    width = dst_image->width;
-    height = dst_image->height;
-
-    /* Need to evolve every pixel of dst_image based on src_image. */
-    for (j = 0; j < height; ++j) {
-        for (i = 0; i < width; ++i) {
-            evolve_pixel_4_parent_average(
-                /* destination pixel */
-                pixel_at(dst_image, i, j),
-                /* source pixel below */
-                pixel_at(src_image, i, wrap(j, -1, height)),
-                /* source pixel above */
-                pixel_at(src_image, i, wrap(j, 1, height)),
-                /* source pixel left */
-                pixel_at(src_image, wrap(i, -1, width), j),
-                /* source pixel right */
-                pixel_at(src_image, wrap(i, 1, width), j));
-        }
-    }
-}
-
-void evolve_image_4_parent_pick_one(Image *dst_image, const Image *src_image) {
-    size_t i, j;
-    size_t width, height;
-    assert(dst_image->width == src_image->width);
-    assert(dst_image->height == src_image->height);
-    width = dst_image->width;
-    height = dst_image->height;
-
-    /* Need to evolve every pixel of dst_image based on src_image. */
-    for (j = 0; j < height; ++j) {
-        for (i = 0; i < width; ++i) {
-            evolve_pixel_4_parent_pick_one(
-                /* destination pixel */
-                pixel_at(dst_image, i, j),
-                /* source pixel below */
-                pixel_at(src_image, i, wrap(j, -1, height)),
-                /* source pixel above */
-                pixel_at(src_image, i, wrap(j, 1, height)),
-                /* source pixel left */
-                pixel_at(src_image, wrap(i, -1, width), j),
-                /* source pixel right */
-                pixel_at(src_image, wrap(i, 1, width), j));
-        }
-    }
-}
-
-void evolve_image_8_parent_pick_one(Image *dst_image, const Image *src_image) {
-    size_t i, j;
-    size_t width, height;
-    assert(dst_image->width == src_image->width);
-    assert(dst_image->height == src_image->height);
-    width = dst_image->width;
-    height = dst_image->height;
-
-    /* Need to evolve every pixel of dst_image based on src_image. */
-    for (j = 0; j < height; ++j) {
-        for (i = 0; i < width; ++i) {
-            evolve_pixel_8_parent_pick_one(
-                /* destination pixel */
-                pixel_at(dst_image, i, j),
-                /* source pixel below */
-                pixel_at(src_image, i, wrap(j, -1, height)),
-                /* source pixel below left */
-                pixel_at(src_image, wrap(i, -1, width), wrap(j, -1, height)),
-                /* source pixel below right */
-                pixel_at(src_image, wrap(i, 1, width), wrap(j, -1, height)),
-                /* source pixel above */
-                pixel_at(src_image, i, wrap(j, 1, height)),
-                /* source pixel above left */
-                pixel_at(src_image, wrap(i, -1, width), wrap(j, 1, height)),
-                /* source pixel above right */
-                pixel_at(src_image, wrap(i, 1, width), wrap(j, 1, height)),
-                /* source pixel left */
-                pixel_at(src_image, wrap(i, -1, width), j),
-                /* source pixel right */
-                pixel_at(src_image, wrap(i, 1, width), j));
-        }
-    }
-}
-
-void evolve_image_8_parent_extreme(Image *dst_image, const Image *src_image) {
-    size_t i, j;
-    size_t width, height;
-    Pixel **parents = malloc(8 * sizeof(*parents));
-    assert(dst_image->width == src_image->width);
-    assert(dst_image->height == src_image->height);
-    width = dst_image->width;
-    height = dst_image->height;
-
-    /* Need to evolve every pixel of dst_image based on src_image. */
-    for (j = 0; j < height; ++j) {
+/*
+ * Planar frame evolvers, dispatched to by the evolvers below for planar
+ * images. Every row of every plane is a single run of the evolve_plane_*
+ * kernel, with parents at the same offsets as in the interleaved loops.
+ */
+
+static void planar_4_parent_genes(Image *dst_image, const Image *src_image,
+                                  const Rng *rng, size_t frame,
+                                  size_t first_row, size_t last_row) {
+    size_t j, y;
+    size_t width = dst_image->width, stride = src_image->stride;
+    unsigned char *random_bytes = malloc(6 * width);
+    Planes choice_row, noise_row, dst_row, src_row;
+    int c;
+
+    if (!random_bytes) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    split_planes(&choice_row, random_bytes, width);
+    split_planes(&noise_row, random_bytes + 3 * width, width);
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        dst_row = planes_row(dst_image, j);
+        src_row = planes_row(src_image, j);
+        rng_fill_planes(rng, frame, y, RNG_CHOICE, &choice_row, 0, width);
+        rng_fill_planes(rng, frame, y, RNG_NOISE, &noise_row, 0, width);
+        for (c = 0; c < 3; ++c) {
+            const unsigned char *src = src_row.channel[c];
+            evolve_plane_4_parent_genes(dst_row.channel[c], src - stride,
+                                        src + stride, src - 1, src + 1,
+                                        choice_row.channel[c],
+                                        noise_row.channel[c], width);
+        }
+    }
+    free(random_bytes);
+}
+
+static void planar_4_parent_average(Image *dst_image, const Image *src_image,
+                                    const Rng *rng, size_t frame,
+                                    size_t first_row, size_t last_row) {
+    size_t j, y;
+    size_t width = dst_image->width, stride = src_image->stride;
+    unsigned char *random_bytes = malloc(3 * width);
+    Planes noise_row, dst_row, src_row;
+    int c;
+
+    if (!random_bytes) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    split_planes(&noise_row, random_bytes, width);
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        dst_row = planes_row(dst_image, j);
+        src_row = planes_row(src_image, j);
+        rng_fill_planes(rng, frame, y, RNG_NOISE, &noise_row, 0, width);
+        for (c = 0; c < 3; ++c) {
+            const unsigned char *src = src_row.channel[c];
+            evolve_plane_4_parent_average(dst_row.channel[c], src - stride,
+                                          src + stride, src - 1, src + 1,
+                                          noise_row.channel[c], width);
+        }
+    }
+    free(random_bytes);
+}
+
+static void planar_4_parent_pick_one(Image *dst_image,
+                                     const Image *src_image, const Rng *rng,
+                                     size_t frame, size_t first_row,
+                                     size_t last_row) {
+    size_t j, y;
+    size_t width = dst_image->width, stride = src_image->stride;
+    unsigned char *choice = malloc(width);
+    Planes dst_row, src_row;
+    int c;
+
+    if (!choice) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        dst_row = planes_row(dst_image, j);
+        src_row = planes_row(src_image, j);
+        /* The whole pixel follows the choice of its red channel. */
+        rng_fill_plane(rng, frame, y, RNG_CHOICE, 0, choice, 0, width);
+        for (c = 0; c < 3; ++c) {
+            const unsigned char *src = src_row.channel[c];
+            evolve_plane_4_parent_pick_one(dst_row.channel[c], src - stride,
+                                           src + stride, src - 1, src + 1,
+                                           choice, width);
+        }
+    }
+    free(choice);
+}
+
+static void planar_8_parent_pick_one(Image *dst_image,
+                                     const Image *src_image, const Rng *rng,
+                                     size_t frame, size_t first_row,
+                                     size_t last_row) {
+    size_t j, y;
+    size_t width = dst_image->width, stride = src_image->stride;
+    unsigned char *choice = malloc(width);
+    const unsigned char *parents[8];
+    Planes dst_row, src_row;
+    int c;
+
+    if (!choice) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        dst_row = planes_row(dst_image, j);
+        src_row = planes_row(src_image, j);
+        /* The whole pixel follows the choice of its red channel. */
+        rng_fill_plane(rng, frame, y, RNG_CHOICE, 0, choice, 0, width);
+        for (c = 0; c < 3; ++c) {
+            const unsigned char *src = src_row.channel[c];
+            parents[0] = src - stride;
+            parents[1] = src - stride - 1;
+            parents[2] = src - stride + 1;
+            parents[3] = src + stride;
+            parents[4] = src + stride - 1;
+            parents[5] = src + stride + 1;
+            parents[6] = src - 1;
+            parents[7] = src + 1;
+            evolve_plane_8_parent_pick_one(dst_row.channel[c], parents,
+                                           choice, width);
+        }
+    }
+    free(choice);
+}
+
+static void planar_8_parent_extreme(Image *dst_image, const Image *src_image,
+                                    const Rng *rng, size_t frame,
+                                    size_t first_row, size_t last_row) {
+    size_t j;
+    Planes dst_row, src_row;
+    /* This rule is deterministic. */
+    (void)rng;
+    (void)frame;
+
+    for (j = first_row; j < last_row; ++j) {
+        dst_row = planes_row(dst_image, j);
+        src_row = planes_row(src_image, j);
+        evolve_plane_8_parent_extreme(&dst_row, &src_row, src_image->stride,
+                                      dst_image->width);
+    }
+}
+
+/*
+ * Interleaved frame evolvers for the vector rules. Channels never mix, so an
+ * interleaved row is a run of 3 * width bytes for the same evolve_plane_*
+ * kernels, with the left and right neighbours 3 bytes away and the rows
+ * above and below 3 * stride, and random bytes drawn interleaved (see
+ * rng_fill_row) to match.
+ */
+
+/**
+ * Bytes of row j of an interleaved image.
+ */
+static unsigned char *interleaved_row(const Image *image, size_t j) {
+    return (unsigned char *)(image->pixels + j * image->stride);
+}
+
+/**
+ * Fill the 3 * width bytes of choice with the red choice bytes of row y,
+ * each repeated for all three channels of its pixel, which follows it.
+ */
+static void fill_pixel_choice(unsigned char *choice, const Rng *rng,
+                              size_t frame, size_t y, size_t width) {
+    size_t i;
+
+    /*
+     * Red bytes into the last third, then spread from the front, whose
+     * writes never catch up with the bytes still to be read.
+     */
+    rng_fill_plane(rng, frame, y, RNG_CHOICE, 0, choice + 2 * width, 0,
+                   width);
+    for (i = 0; i < width; ++i) {
+        unsigned char red = choice[2 * width + i];
+        choice[3 * i] = red;
+        choice[3 * i + 1] = red;
+        choice[3 * i + 2] = red;
+    }
+}
+
+static void interleaved_4_parent_genes(Image *dst_image,
+                                       const Image *src_image, const Rng *rng,
+                                       size_t frame, size_t first_row,
+                                       size_t last_row) {
+    size_t j, y, width = dst_image->width, n = 3 * width;
+    ptrdiff_t above = 3 * (ptrdiff_t)src_image->stride;
+    unsigned char *random_bytes = malloc(2 * n);
+    unsigned char *choice = random_bytes, *noise = random_bytes + n;
+    const unsigned char *src;
+
+    if (!random_bytes) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        src = interleaved_row(src_image, j);
+        rng_fill_row(rng, frame, y, RNG_CHOICE, (Pixel *)choice, 0, width);
+        rng_fill_row(rng, frame, y, RNG_NOISE, (Pixel *)noise, 0, width);
+        evolve_plane_4_parent_genes(interleaved_row(dst_image, j),
+                                    src - above, src + above, src - 3,
+                                    src + 3, choice, noise, n);
+    }
+    free(random_bytes);
+}
+
+static void interleaved_4_parent_average(Image *dst_image,
+                                         const Image *src_image,
+                                         const Rng *rng, size_t frame,
+                                         size_t first_row, size_t last_row) {
+    size_t j, y, width = dst_image->width, n = 3 * width;
+    ptrdiff_t above = 3 * (ptrdiff_t)src_image->stride;
+    unsigned char *noise = malloc(n);
+    const unsigned char *src;
+
+    if (!noise) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        src = interleaved_row(src_image, j);
+        rng_fill_row(rng, frame, y, RNG_NOISE, (Pixel *)noise, 0, width);
+        evolve_plane_4_parent_average(interleaved_row(dst_image, j),
+                                      src - above, src + above, src - 3,
+                                      src + 3, noise, n);
+    }
+    free(noise);
+}
+
+static void interleaved_4_parent_pick_one(Image *dst_image,
+                                          const Image *src_image,
+                                          const Rng *rng, size_t frame,
+                                          size_t first_row,
+                                          size_t last_row) {
+    size_t j, y, width = dst_image->width, n = 3 * width;
+    ptrdiff_t above = 3 * (ptrdiff_t)src_image->stride;
+    unsigned char *choice = malloc(n);
+    const unsigned char *src;
+
+    if (!choice) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        src = interleaved_row(src_image, j);
+        fill_pixel_choice(choice, rng, frame, y, width);
+        evolve_plane_4_parent_pick_one(interleaved_row(dst_image, j),
+                                       src - above, src + above, src - 3,
+                                       src + 3, choice, n);
+    }
+    free(choice);
+}
+
+static void interleaved_8_parent_pick_one(Image *dst_image,
+                                          const Image *src_image,
+                                          const Rng *rng, size_t frame,
+                                          size_t first_row,
+                                          size_t last_row) {
+    size_t j, y, width = dst_image->width, n = 3 * width;
+    ptrdiff_t above = 3 * (ptrdiff_t)src_image->stride;
+    unsigned char *choice = malloc(n);
+    const unsigned char *parents[8], *src;
+
+    if (!choice) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        y = image_frame_row(dst_image, j);
+        src = interleaved_row(src_image, j);
+        fill_pixel_choice(choice, rng, frame, y, width);
+        parents[0] = src - above;
+        parents[1] = src - above - 3;
+        parents[2] = src - above + 3;
+        parents[3] = src + above;
+        parents[4] = src + above - 3;
+        parents[5] = src + above + 3;
+        parents[6] = src - 3;
+        parents[7] = src + 3;
+        evolve_plane_8_parent_pick_one(interleaved_row(dst_image, j), parents,
+                                       choice, n);
+    }
+    free(choice);
+}
+
+/**
+ * Channels of row j of image, whose pixels are step bytes apart: 1 if the
+ * image is planar, 3 if not.
+ */
+static Planes rule_image_row(const Image *image, size_t j, size_t step) {
+    Planes row;
+    if (step == 1) {
+        return planes_row(image, j);
+    }
+    rule_pixel_planes(&row, image->pixels + j * image->stride);
+    return row;
+}
+
+/**
+ * Extremities of row j (-1 to height, ghost rows included) of an interleaved
+ * image, ghost columns included: extremities[-1] to extremities[width].
+ */
+static void extremity_row(unsigned char *extremities, const Image *image,
+                          ptrdiff_t j) {
+    const Pixel *pixels = image->pixels + j * (ptrdiff_t)image->stride;
+
+    evolve_plane_extremities(extremities - 1, pixels - 1, image->width + 2);
+}
+
+#define EXTREME_OFFSET(k, dx, dy) offsets[k] = (dx) + (dy) * (ptrdiff_t)stride;
+
+/**
+ * Rather than the extremity of all 8 parents of every pixel, the extremity of
+ * every source pixel is worked out once, into a ring of three rows sliding
+ * down the band: each serves as the row above, of and below three rows of
+ * destination pixels. A row of extremities is one vector pass over the
+ * interleaved pixels (evolve_plane_extremities) and the parents are picked
+ * from them in another; only the copy of the chosen pixels is scalar.
+ * planar_8_parent_extreme recomputes extremities in vector registers for less
+ * than loading them costs.
+ */
+static void interleaved_8_parent_extreme(Image *dst_image,
+                                         const Image *src_image,
+                                         const Rng *rng, size_t frame,
+                                         size_t first_row, size_t last_row) {
+    size_t width = dst_image->width, stride = src_image->stride, i, j;
+    /* Three extremity rows of width + 2, then the choice row. */
+    unsigned char *bytes = malloc(4 * (width + 2));
+    unsigned char *extremities[3], *choice = bytes + 3 * (width + 2);
+    ptrdiff_t offsets[8];
+    const Pixel *src;
+    Pixel *dst;
+    int k;
+    /* This rule is deterministic. */
+    (void)rng;
+    (void)frame;
+
+    if (!bytes) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    FRAME_PARENTS_8(EXTREME_OFFSET)
+    /* Extremities of source row r in extremities[(r + 1) % 3]. */
+    for (k = 0; k < 3; ++k) {
+        extremities[k] = bytes + k * (width + 2) + 1;
+    }
+    if (first_row < last_row) {
+        extremity_row(extremities[first_row % 3], src_image,
+                      (ptrdiff_t)first_row - 1);
+        extremity_row(extremities[(first_row + 1) % 3], src_image,
+                      (ptrdiff_t)first_row);
+    }
+    for (j = first_row; j < last_row; ++j) {
+        extremity_row(extremities[(j + 2) % 3], src_image,
+                      (ptrdiff_t)j + 1);
+        evolve_plane_extreme_choice(choice, extremities[j % 3],
+                                    extremities[(j + 1) % 3],
+                                    extremities[(j + 2) % 3], width);
+        dst = dst_image->pixels + j * dst_image->stride;
+        src = src_image->pixels + j * src_image->stride;
         for (i = 0; i < width; ++i) {
-            /* source pixel below */
-            parents[0] = pixel_at(src_image, i, wrap(j, -1, height));
-            /* source pixel below left */
-            parents[1] = pixel_at(src_image, wrap(i, -1, width),
-                                             wrap(j, -1, height));
-            /* source pixel below right */
-            parents[2] = pixel_at(src_image, wrap(i, 1, width),
-                                             wrap(j, -1, height));
-            /* source pixel above */
-            parents[3] = pixel_at(src_image, i, wrap(j, 1, height));
-            /* source pixel above left */
-            parents[4] = pixel_at(src_image, wrap(i, -1, width),
-                                             wrap(j, 1, height));
-            /* source pixel above right */
-            parents[5] = pixel_at(src_image, wrap(i, 1, width),
-                                             wrap(j, 1, height));
-            /* source pixel left */
-            parents[6] = pixel_at(src_image, wrap(i, -1, width), j);
-            /* source pixel right */
-            parents[7] = pixel_at(src_image, wrap(i, 1, width), j);
-
-            evolve_pixel_8_parent_extreme(pixel_at(dst_image, i, j), parents);
-        }
-    }
-    free(parents);
-}
-
-Image **generate_images(size_t n_images, size_t width, size_t height) {
+            dst[i] = src[(ptrdiff_t)i + offsets[choice[i] >> 5]];
+        }
+    }
+    free(bytes);
+}
+
+/*
+ * Frame evolvers expanded from FRAME_RULES (see rule.h). Random bytes are
+ * drawn as planes whatever the layout; they are the same bytes either way.
+ * Planar images go to the planar_* evolvers above if the rule has them, to
+ * expanded ones if not; interleaved images to the interleaved_* evolvers
+ * above for vector and full rules, to expanded ones otherwise.
+ */
+
+#define FRAME_PLANAR_vector(name)
+#define FRAME_PLANAR_full(name)
+#define FRAME_PLANAR_generic(name) \
+static void planar_##name(Image *dst_image, const Image *src_image, \
+                          const Rng *rng, size_t frame, size_t first_row, \
+                          size_t last_row) { \
+    rule_frame_##name(dst_image, src_image, rng, frame, first_row, last_row, \
+                      1); \
+}
+
+#define FRAME_INTERLEAVED_full(name)
+#define FRAME_INTERLEAVED_vector(name)
+#define FRAME_INTERLEAVED_generic(name) \
+static void interleaved_##name(Image *dst_image, const Image *src_image, \
+                               const Rng *rng, size_t frame, \
+                               size_t first_row, size_t last_row) { \
+    rule_frame_##name(dst_image, src_image, rng, frame, first_row, last_row, \
+                      3); \
+}
+
+#define DEFINE_FRAME_RULE(name, parents, combine_op, noise_op, kernels) \
+static __inline__ void rule_frame_##name(Image *dst_image, \
+                                         const Image *src_image, \
+                                         const Rng *rng, size_t frame, \
+                                         size_t first_row, size_t last_row, \
+                                         size_t step) { \
+    size_t i, j, y, random_step = 1; \
+    size_t width = dst_image->width, stride = src_image->stride; \
+    unsigned char *random_bytes = malloc(6 * width); \
+    Planes dst, src, choice, noise; \
+    if (!random_bytes) { \
+        fprintf(stderr, "Failed to allocate rows.\n"); \
+        exit(1); \
+    } \
+    split_planes(&choice, random_bytes, width); \
+    split_planes(&noise, random_bytes + 3 * width, width); \
+    for (j = first_row; j < last_row; ++j) { \
+        y = image_frame_row(dst_image, j); \
+        dst = rule_image_row(dst_image, j, step); \
+        src = rule_image_row(src_image, j, step); \
+        if (RULE_USES_CHOICE_##combine_op) { \
+            rng_fill_planes(rng, frame, y, RNG_CHOICE, &choice, 0, width); \
+        } \
+        if (RULE_USES_NOISE_##noise_op) { \
+            rng_fill_planes(rng, frame, y, RNG_NOISE, &noise, 0, width); \
+        } \
+        for (i = 0; i < width; ++i) { \
+            RULE_PIXEL(parents, combine_op, noise_op, RULE_LOAD_FRAME); \
+        } \
+    } \
+    free(random_bytes); \
+} \
+FRAME_PLANAR_##kernels(name) \
+FRAME_INTERLEAVED_##kernels(name) \
+void evolve_image_##name(Image *dst_image, const Image *src_image, \
+                         const Rng *rng, size_t frame, size_t first_row, \
+                         size_t last_row) { \
+    assert(dst_image->width == src_image->width); \
+    assert(dst_image->height == src_image->height); \
+    assert(first_row <= last_row && last_row <= dst_image->height); \
+    assert(src_image->halo); \
+    assert(dst_image->planar == src_image->planar); \
+    if (src_image->planar) { \
+        planar_##name(dst_image, src_image, rng, frame, first_row, \
+                      last_row); \
+        return; \
+    } \
+    interleaved_##name(dst_image, src_image, rng, frame, first_row, \
+                       last_row); \
+}
+
+FRAME_RULES(DEFINE_FRAME_RULE)
+
+/**
+ * One frame evolution shared by all band tasks.
+ */
+typedef struct Frame_job {
+    Image_evolver image_evolver;
+    Image *dst_image;
+    const Image *src_image;
+    const Rng *rng;
+    size_t frame;
+    size_t rows_per_band;
+} Frame_job;
+
+static void evolve_band(void *arg, size_t band) {
+    const Frame_job *job = arg;
+    size_t first_row = band * job->rows_per_band;
+    size_t last_row = first_row + job->rows_per_band;
+    if (last_row > job->dst_image->height) {
+        last_row = job->dst_image->height;
+    }
+    (*job->image_evolver)(job->dst_image, job->src_image, job->rng, job->frame,
+                          first_row, last_row);
+}
+
+void evolve_image_parallel(Thread_pool *pool, Image_evolver image_evolver,
+                           Image *dst_image, const Image *src_image,
+                           const Rng *rng, size_t frame) {
+    Frame_job job;
+    size_t height = dst_image->height;
+    size_t n_bands = BANDS_PER_THREAD * thread_pool_size(pool);
+
+    if (n_bands > height) {
+        n_bands = height;
+    }
+    job.image_evolver = image_evolver;
+    job.dst_image = dst_image;
+    job.src_image = src_image;
+    job.rng = rng;
+    job.frame = frame;
+    job.rows_per_band = (height + n_bands - 1) / n_bands;
+    thread_pool_run(pool, &evolve_band, &job,
+                    (height + job.rows_per_band - 1) / job.rows_per_band);
+}
+
+#define FRAME_RULE_ENTRY(name, parents, combine_op, noise_op, kernels) \
+    {#name, &evolve_image_##name, \
+     !RULE_USES_CHOICE_##combine_op && !RULE_USES_NOISE_##noise_op},
+
+static const Frame_rule frame_rules[] = {FRAME_RULES(FRAME_RULE_ENTRY)};
+
+#define N_FRAME_RULES (sizeof(frame_rules) / sizeof(*frame_rules))
+
+const Frame_rule *find_frame_rule(const char *name) {
+    size_t k;
+    for (k = 0; k < N_FRAME_RULES; ++k) {
+        if (strcmp(frame_rules[k].name, name) == 0) {
+            return frame_rules + k;
+        }
+    }
+    return NULL;
+}
+
+void print_frame_rules(FILE *file) {
+    size_t k;
+    for (k = 0; k < N_FRAME_RULES; ++k) {
+        fprintf(file, "\t%s\n", frame_rules[k].name);
+    }
+}
+
+/**
+ * How frames are evolved: with rule, through tiling if not NULL, blocked;
+ * through activity if not NULL, only where they may change; else whole, one
+ * at a time.
+ */
+struct Schedule {
+    const Frame_rule *rule;
+    Tiling *tiling;
+    Activity *activity;
+    /* Where to report on them, NULL for nowhere. */
+    FILE *log;
+};
+
+/**
+ * Schedule frames of options, depth generations per pass.
+ */
+static void create_schedule(Schedule *schedule, const Image_options *options,
+                            size_t depth, Thread_pool *pool) {
+    schedule->rule = find_frame_rule(options->rule);
+    schedule->tiling = NULL;
+    schedule->activity = NULL;
+    schedule->log = options->log;
+    assert(schedule->rule);
+    if (options->blocking.active) {
+        assert(depth == 1 && schedule->rule->deterministic);
+        schedule->activity = activity_create(options->width, options->height);
+        if (!schedule->activity) {
+            fprintf(stderr, "Failed to allocate tiles.\n");
+            exit(1);
+        }
+    }
+    if (depth <= 1) {
+        return;
+    }
+    schedule->tiling = tiling_create(options->width, options->height,
+                                     options->planar, depth, pool);
+    if (!schedule->tiling) {
+        fprintf(stderr, "Failed to allocate tiles.\n");
+        exit(1);
+    }
+    if (schedule->log) {
+        fprintf(schedule->log,
+                "Blocking: %lu generations per pass, tiles of %lu rows.\n",
+                (unsigned long)depth,
+                (unsigned long)tiling_tile_rows(schedule->tiling));
+    }
+}
+
+static void free_schedule(Schedule *schedule) {
+    if (schedule->tiling) {
+        tiling_free(schedule->tiling);
+    }
+    if (schedule->activity) {
+        if (schedule->log) {
+            activity_report(schedule->activity, schedule->log);
+        }
+        activity_free(schedule->activity);
+    }
+}
+
+/**
+ * Generations in the pass starting at frame i (the first one evolved), of
+ * n_images in all.
+ */
+static size_t pass_length(const Blocking *blocking, size_t i,
+                          size_t n_images) {
+    return n_images - i < blocking->depth ? n_images - i : blocking->depth;
+}
+
+/**
+ * Whether frame g of a pass of n generations is kept.
+ */
+static int frame_kept(const Blocking *blocking, size_t g, size_t n) {
+    return !blocking->keyframes || g == n - 1;
+}
+
+/**
+ * Evolve src_image, frame i - 1, into dst_images[0], ..., dst_images[n - 1],
+ * frames i to i + n - 1, as schedule says: through its tiling (where entries
+ * but the last may be NULL), else one frame at a time (where n is 1).
+ */
+static void evolve_pass(const Schedule *schedule, Thread_pool *pool,
+                        Image **dst_images, const Image *src_image, size_t n,
+                        const Rng *rng, size_t i) {
+    Image_evolver image_evolver = schedule->rule->evolver;
+    double start = trace_begin();
+
+    if (schedule->tiling) {
+        evolve_tiles(schedule->tiling, pool, image_evolver, dst_images,
+                     src_image, n, rng, i - 1);
+    } else if (schedule->activity) {
+        assert(n == 1);
+        /* The rule is deterministic. */
+        evolve_active_tiles(schedule->activity, pool, image_evolver,
+                            dst_images[0], src_image, rng, i);
+    } else {
+        assert(n == 1);
+        evolve_image_parallel(pool, image_evolver, dst_images[0], src_image,
+                              rng, i);
+        refresh_halo(dst_images[0]);
+    }
+    trace_end(TRACE_EVOLVE, start, i + n - 1);
+}
+
+Schedule *schedule_frames(const Image_options *options, Thread_pool *pool) {
+    Schedule *schedule = malloc(sizeof(*schedule));
+
+    if (!schedule) {
+        fprintf(stderr, "Failed to allocate schedule.\n");
+        exit(1);
+    }
+    create_schedule(schedule, options, 1, pool);
+    return schedule;
+}
+
+void evolve_scheduled_frame(Schedule *schedule, Thread_pool *pool,
+                            Image *dst_image, const Image *src_image,
+                            const Rng *rng, size_t frame) {
+    evolve_pass(schedule, pool, &dst_image, src_image, 1, rng, frame);
+}
+
+void free_scheduled_frames(Schedule *schedule) {
+    free_schedule(schedule);
+    free(schedule);
+}
+
+Image **generate_images(const Image_options *options, const Rng *rng,
+                        Thread_pool *pool) {
+    const Blocking *blocking = &options->blocking;
+    size_t n_images = options->n_images;
+    size_t width = options->width, height = options->height;
+    int planar = options->planar;
     Image **images;
-    size_t i;
+    Schedule schedule;
+    size_t i, g, n;
+    double start;
 
+    create_schedule(&schedule, options, blocking->depth, pool);
     images = malloc(n_images * sizeof(*images));
+    if (!images) {
+        fprintf(stderr, "Failed to allocate frames.\n");
+        exit(1);
+    }
 
-    images[0] = malloc_random_image(width, height);
-    for (i = 1; i < n_images; ++i) {
-        images[i] = malloc_image(width, height);
-        evolve_image_8_parent_extreme(images[i], images[i-1]);
-        fprintf(stderr, "\33[2K\rGenerated image %lu...", i);
-        fflush(stderr);
+    start = trace_begin();
+    images[0] = malloc_random_image_layout(width, height, 1, planar, rng, 0);
+    trace_end(TRACE_ALLOC, start, 0);
+    if (!images[0]) {
+        fprintf(stderr, "Failed to allocate frames.\n");
+        exit(1);
+    }
+    for (i = 1; i < n_images; i += n) {
+        n = pass_length(blocking, i, n_images);
+        for (g = 0; g < n; ++g) {
+            images[i + g] = NULL;
+            if (frame_kept(blocking, g, n)) {
+                start = trace_begin();
+                images[i + g] = malloc_image_layout(width, height, 1, planar);
+                trace_end(TRACE_ALLOC, start, i + g);
+                if (!images[i + g]) {
+                    fprintf(stderr, "Failed to allocate frames.\n");
+                    exit(1);
+                }
+            }
+        }
+        evolve_pass(&schedule, pool, images + i, images[i - 1], n, rng, i);
+    }
+    free_schedule(&schedule);
+    if (options->log) {
+        fprintf(options->log, "Done generating.\n");
+        fflush(options->log);
     }
-    fprintf(stderr, "\33[2K\rDone generating.\n");
-    fflush(stderr);
     return images;
 }
 
-void write_images(Image **images, size_t n_images) {
-    size_t i;
+static const char *frame_extension(Frame_format format) {
+    switch (format) {
+    case FRAME_PNG:
+        return "png";
+    case FRAME_Y4M:
+        return "y4m";
+    default:
+        return "ppm";
+    }
+}
 
-    for (i = 0; i < n_images; ++i) {
-        char filename[MAX_FILENAME_LENGTH];
-        FILE *file;
-        if (WRITE_TO_DISK) {
-            sprintf(filename, "images/random%07lu.ppm", i);
-            file = fopen(filename, "w");
-        } else {
-            file = stdout;
+/**
+ * Write frame i to output: to its stream, or to a file of its own if it has
+ * a prefix. pool (may be NULL) is for encoders that can use threads. A Y4M
+ * stream header goes before frame first, the first of the run, or before
+ * every frame written to a file.
+ */
+static void write_frame(const Image *image, size_t i,
+                        const Frame_output *output, Thread_pool *pool,
+                        size_t first) {
+    char *filename = NULL;
+    FILE *file = output->file;
+    double start = trace_begin();
+
+    if (output->prefix) {
+        filename = malloc(strlen(output->prefix) + MAX_FILENAME_LENGTH);
+        if (!filename) {
+            fprintf(stderr, "Failed to allocate file name.\n");
+            exit(1);
         }
-        if (file) {
-            write_image_P6(file, images[i]);
-            if (WRITE_TO_DISK) {
-                fclose(file);
+        sprintf(filename, "%s%07lu.%s", output->prefix, (unsigned long)i,
+                frame_extension(output->format));
+        file = fopen(filename, "wb");
+    }
+    if (file) {
+        if (output->format == FRAME_PNG) {
+            write_image_PNG(file, image, pool);
+        } else if (output->format == FRAME_Y4M) {
+            if (output->prefix || i == first) {
+                write_header_Y4M(file, image->width, image->height);
             }
-            fprintf(stderr, "\33[2K\rWrote image %lu...", i);
-            fflush(stderr);
+            write_image_Y4M(file, image, pool);
         } else {
-            fprintf(stderr, "Failed to open file %s\n", filename);
+            write_image_P6(file, image);
+        }
+        if (output->prefix) {
+            fclose(file);
+        }
+        trace_end(TRACE_OUTPUT, start, i);
+    } else {
+        fprintf(stderr, "Failed to open file %s\n", filename);
+        exit(1);
+    }
+    free(filename);
+}
+
+void write_images(Image **images, const Image_options *options,
+                  Thread_pool *pool) {
+    size_t i;
+
+    for (i = 0; i < options->n_images; ++i) {
+        if (images[i]) {
+            write_frame(images[i], i, &options->output, pool, 0);
+        }
+    }
+    if (options->log) {
+        fprintf(options->log, "Done writing.\n");
+    }
+}
+
+/**
+ * Fill image, which has a halo, with the first frame of a run and return its
+ * number: the frame checkpointing (may be NULL) resumes from, or else a
+ * random frame 0.
+ */
+static size_t start_frame(Image *image, const Checkpointing *checkpointing,
+                          const Rng *rng) {
+    if (checkpointing && checkpointing->resume) {
+        copy_image(image, checkpointing->resume->image);
+        return checkpointing->resume->frame;
+    }
+    set_random_image(image, rng, 0);
+    refresh_halo(image);
+    return 0;
+}
+
+/**
+ * Offer frame, the last of a pass, to the checkpointer of checkpointing (may
+ * be NULL), once it and every frame before it have been written to output.
+ */
+static void offer_checkpoint(const Checkpointing *checkpointing,
+                             const Frame_output *output, const Image *image,
+                             size_t frame) {
+    if (checkpointing && checkpointing->checkpointer) {
+        /* Output still in stdio buffers would be lost with the run. */
+        if (output->file) {
+            fflush(output->file);
+        }
+        checkpointer_offer(checkpointing->checkpointer, image, frame);
+    }
+}
+
+void stream_images(const Image_options *options, const Rng *rng,
+                   Thread_pool *pool, const Checkpointing *checkpointing) {
+    const Blocking *blocking = &options->blocking;
+    const Frame_output *output = &options->output;
+    size_t n_images = options->n_images;
+    /*
+     * frames[0] is the source of the next pass, and the others take the
+     * frames it makes: all of them, or only the last if that is all that is
+     * kept. Frames are swapped into frames[0] as they become sources.
+     */
+    size_t n_frames = (blocking->keyframes ? 1 : blocking->depth) + 1;
+    Image **frames, **dst_images, *last;
+    Schedule schedule;
+    size_t first, i, g, n, k;
+    double start;
+
+    if (n_images == 0) {
+        return;
+    }
+    create_schedule(&schedule, options, blocking->depth, pool);
+    frames = malloc(n_frames * sizeof(*frames));
+    dst_images = malloc(blocking->depth * sizeof(*dst_images));
+    if (!frames || !dst_images) {
+        fprintf(stderr, "Failed to allocate frames.\n");
+        exit(1);
+    }
+    start = trace_begin();
+    for (k = 0; k < n_frames; ++k) {
+        frames[k] = malloc_image_layout(options->width, options->height, 1,
+                                        options->planar);
+        if (!frames[k]) {
+            fprintf(stderr, "Failed to allocate frames.\n");
             exit(1);
         }
     }
-    fprintf(stderr, "\33[2K\rDone writing.\n");
+    trace_end(TRACE_ALLOC, start, TRACE_NO_FRAME);
+    first = start_frame(frames[0], checkpointing, rng);
+    write_frame(frames[0], first, output, pool, first);
+    for (i = first + 1; i < n_images; i += n) {
+        n = pass_length(blocking, i, n_images);
+        for (g = 0; g < n; ++g) {
+            k = blocking->keyframes ? 1 : g + 1;
+            dst_images[g] = frame_kept(blocking, g, n) ? frames[k] : NULL;
+        }
+        evolve_pass(&schedule, pool, dst_images, frames[0], n, rng, i);
+        for (g = 0; g < n; ++g) {
+            if (dst_images[g]) {
+                write_frame(dst_images[g], i + g, output, pool, first);
+            }
+        }
+        k = blocking->keyframes ? 1 : n;
+        last = frames[k];
+        frames[k] = frames[0];
+        frames[0] = last;
+        offer_checkpoint(checkpointing, output, frames[0], i + n - 1);
+    }
+    if (options->log) {
+        fprintf(options->log, "Done streaming.\n");
+    }
+    if (output->file) {
+        fflush(output->file);
+    }
+    for (k = 0; k < n_frames; ++k) {
+        free_image(frames[k]);
+    }
+    free(frames);
+    free(dst_images);
+    free_schedule(&schedule);
+}
+
+/**
+ * What writers of a pipelined run need to know about it.
+ */
+typedef struct Queued_run {
+    const Image_options *options;
+    /* First frame of the run. */
+    size_t first;
+    const Checkpointing *checkpointing;
+    /*
+     * Frames pushed and not yet written, at most one per buffer. Writers to
+     * files finish in any order, so a checkpoint waits for every frame
+     * before it to be out of here.
+     */
+    size_t *unwritten;
+    size_t n_unwritten;
+    pthread_mutex_t lock;
+    /* Signalled when a frame has been written. */
+    pthread_cond_t frame_written;
+} Queued_run;
+
+/**
+ * Push frame, held in image, to the writers of run.
+ */
+static void push_queued_frame(Queued_run *run, Frame_queue *queue,
+                              Image *image, size_t frame) {
+    pthread_mutex_lock(&run->lock);
+    run->unwritten[run->n_unwritten++] = frame;
+    pthread_mutex_unlock(&run->lock);
+    frame_queue_push(queue, image, frame);
+}
+
+/**
+ * Whether any frame before frame is still to be written. Called with the
+ * lock of run held.
+ */
+static int earlier_unwritten(const Queued_run *run, size_t frame) {
+    size_t k;
+    for (k = 0; k < run->n_unwritten; ++k) {
+        if (run->unwritten[k] < frame) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void write_queued_frame(void *arg, const Image *image, size_t frame) {
+    Queued_run *run = arg;
+    const Image_options *options = run->options;
+    int checkpoint = frame > run->first &&
+                     ((frame - run->first) % options->blocking.depth == 0 ||
+                      frame + 1 == options->n_images);
+    size_t k;
+
+    /* The pool is busy generating; parallelism comes from more writers. */
+    write_frame(image, frame, &options->output, NULL, run->first);
+    pthread_mutex_lock(&run->lock);
+    k = 0;
+    while (run->unwritten[k] != frame) {
+        ++k;
+    }
+    run->unwritten[k] = run->unwritten[--run->n_unwritten];
+    pthread_cond_broadcast(&run->frame_written);
+    /*
+     * Writers take frames oldest first, so the earlier frames waited for
+     * are already being written, and the oldest of them waits for none.
+     */
+    while (checkpoint && earlier_unwritten(run, frame)) {
+        pthread_cond_wait(&run->frame_written, &run->lock);
+    }
+    pthread_mutex_unlock(&run->lock);
+    if (checkpoint) {
+        offer_checkpoint(run->checkpointing, &options->output, image, frame);
+    }
+}
+
+void pipeline_images(const Image_options *options, const Rng *rng,
+                     Thread_pool *pool, const Checkpointing *checkpointing) {
+    const Blocking *blocking = &options->blocking;
+    size_t n_images = options->n_images, n_buffers = options->n_buffers;
+    Image **buffers, **dst_images;
+    Image *src;
+    Frame_queue *queue;
+    Frame_queue_stats stats;
+    Queued_run run;
+    Schedule schedule;
+    size_t i, g, n;
+    double start;
+
+    if (n_images == 0) {
+        return;
+    }
+    /* A pass holds its source and every frame it keeps. */
+    if (n_buffers < (blocking->keyframes ? 1 : blocking->depth) + 1) {
+        fprintf(stderr, "Need more frame buffers than generations per"
+                        " pass.\n");
+        exit(1);
+    }
+    create_schedule(&schedule, options, blocking->depth, pool);
+    start = trace_begin();
+    buffers = malloc(n_buffers * sizeof(*buffers));
+    dst_images = malloc(blocking->depth * sizeof(*dst_images));
+    if (!buffers || !dst_images) {
+        fprintf(stderr, "Failed to allocate frame buffers.\n");
+        exit(1);
+    }
+    for (i = 0; i < n_buffers; ++i) {
+        buffers[i] = malloc_image_layout(options->width, options->height, 1,
+                                         options->planar);
+        if (!buffers[i]) {
+            fprintf(stderr, "Failed to allocate frame buffers.\n");
+            exit(1);
+        }
+    }
+    trace_end(TRACE_ALLOC, start, TRACE_NO_FRAME);
+    run.options = options;
+    run.checkpointing = checkpointing;
+    run.unwritten = malloc(n_buffers * sizeof(*run.unwritten));
+    run.n_unwritten = 0;
+    if (!run.unwritten) {
+        fprintf(stderr, "Failed to allocate frame buffers.\n");
+        exit(1);
+    }
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.frame_written, NULL);
+    /* Frames must reach a stream in order; files can be written in any. */
+    queue = frame_queue_create(buffers, n_buffers, options->n_writers,
+                               &write_queued_frame, &run,
+                               !options->output.prefix);
+    if (!queue) {
+        fprintf(stderr, "Failed to create frame queue.\n");
+        exit(1);
+    }
+
+    src = frame_queue_acquire(queue);
+    /* Writers read run.first only once this frame is pushed. */
+    run.first = start_frame(src, checkpointing, rng);
+    push_queued_frame(&run, queue, src, run.first);
+    for (i = run.first + 1; i < n_images; i += n) {
+        n = pass_length(blocking, i, n_images);
+        for (g = 0; g < n; ++g) {
+            dst_images[g] = frame_kept(blocking, g, n)
+                                ? frame_queue_acquire(queue) : NULL;
+        }
+        evolve_pass(&schedule, pool, dst_images, src, n, rng, i);
+        for (g = 0; g < n; ++g) {
+            if (dst_images[g]) {
+                push_queued_frame(&run, queue, dst_images[g], i + g);
+            }
+            /* All but the last are done with; it is the next source. */
+            if (dst_images[g] && g + 1 < n) {
+                frame_queue_release(queue, dst_images[g]);
+            }
+        }
+        frame_queue_release(queue, src);
+        src = dst_images[n - 1];
+    }
+    frame_queue_release(queue, src);
+    frame_queue_finish(queue, &stats);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.frame_written);
+    free(run.unwritten);
+    if (options->output.file) {
+        fflush(options->output.file);
+    }
+    if (options->log) {
+        fprintf(options->log, "Done generating and writing.\n");
+        fprintf(options->log,
+                "Queue: %lu frames, %lu buffers, depth max %lu mean %.2f;"
+                " generator waited %.3f s for buffers, writers %.3f s for"
+                " frames.\n",
+                (unsigned long)stats.n_frames, (unsigned long)stats.n_buffers,
+                (unsigned long)stats.max_depth, stats.mean_depth,
+                stats.producer_wait, stats.writer_wait);
+    }
+
+    for (i = 0; i < n_buffers; ++i) {
+        free_image(buffers[i]);
+    }
+    free(buffers);
+    free(dst_images);
+    free_schedule(&schedule);
 }
 
 void free_images(Image **images, size_t n_images) {
     size_t i;
     for (i = 0; i < n_images; ++i) {
-        free_image(images[i]);
+        if (images[i]) {
+            free_image(images[i]);
+        }
     }
     free(images);
 }
-
-void main_image_generation(size_t n_images, size_t width, size_t height) {
-    Image **images = generate_images(n_images, width, height);
-    write_images(images, n_images);
-    free_images(images, n_images);
-}
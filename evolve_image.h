@@ -1,31 +1,248 @@
 #ifndef EVOLVE_IMAGE_H
 #define EVOLVE_IMAGE_H
+#include <stdio.h>
+#include "checkpoint.h"
 #include "image.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+/*
+ * Frame evolvers compute rows [first_row, last_row) of dst_image from
+ * src_image. Every destination pixel depends only on src_image, so bands can
+ * be evolved concurrently. Random bytes are drawn from rng, keyed by frame
+ * index, so the result does not depend on how the frame was split.
+ *
+ * src_image must have a halo (see malloc_halo_image) that is up to date; the
+ * neighbours of edge pixels are read from it.
+ *
+ * Frame evolvers are expanded from the rule descriptions in rule.h.
+ */
 
 /**
  * Evolve image dst_image based on src_image, using pixels up, down, left,
  * and right, genetic approach.
  */
-void evolve_image_4_parent_genes(Image *dst_image, const Image *src_image);
+void evolve_image_4_parent_genes(Image *dst_image, const Image *src_image,
+                                 const Rng *rng, size_t frame,
+                                 size_t first_row, size_t last_row);
 
 /**
  * Evolve image dst_image based on src_image, using pixels up, down, left,
  * and right, averaging approach.
  */
-void evolve_image_4_parent_average(Image *dst_image, const Image *src_image);
+void evolve_image_4_parent_average(Image *dst_image, const Image *src_image,
+                                   const Rng *rng, size_t frame,
+                                   size_t first_row, size_t last_row);
+
+void evolve_image_4_parent_pick_one(Image *dst_image, const Image *src_image,
+                                    const Rng *rng, size_t frame,
+                                    size_t first_row, size_t last_row);
+
+void evolve_image_8_parent_pick_one(Image *dst_image, const Image *src_image,
+                                    const Rng *rng, size_t frame,
+                                    size_t first_row, size_t last_row);
+
+void evolve_image_8_parent_extreme(Image *dst_image, const Image *src_image,
+                                   const Rng *rng, size_t frame,
+                                   size_t first_row, size_t last_row);
+
+/**
+ * Evolve image dst_image based on src_image by copying the brightest of the
+ * 8 neighbours, jittered.
+ */
+void evolve_image_8_parent_bright(Image *dst_image, const Image *src_image,
+                                  const Rng *rng, size_t frame,
+                                  size_t first_row, size_t last_row);
+
+/**
+ * Function pointer for a frame evolver.
+ */
+typedef void (*Image_evolver)(Image *, const Image *, const Rng *, size_t,
+                              size_t, size_t);
+
+/**
+ * Evolve all of dst_image from src_image, splitting it into row bands
+ * across the threads of pool.
+ */
+void evolve_image_parallel(Thread_pool *pool, Image_evolver image_evolver,
+                           Image *dst_image, const Image *src_image,
+                           const Rng *rng, size_t frame);
+
+/**
+ * A rule of FRAME_RULES (see rule.h), chosen by name at run time.
+ */
+typedef struct Frame_rule {
+    const char *name;
+    Image_evolver evolver;
+    /* Nonzero if it draws no random bytes, as evolve_active_tiles needs. */
+    int deterministic;
+} Frame_rule;
+
+/* Name of the rule frames are evolved with unless another is chosen. */
+#define DEFAULT_FRAME_RULE "8_parent_extreme"
+
+/**
+ * The rule of FRAME_RULES called name, NULL if there is none.
+ */
+const Frame_rule *find_frame_rule(const char *name);
+
+/**
+ * Print the names of FRAME_RULES, one per line.
+ */
+void print_frame_rules(FILE *file);
+
+/**
+ * Temporal blocking of frame generation (see tiling.h).
+ */
+typedef struct Blocking {
+    /* Generations per pass over the tiles, 1 to evolve frame by frame. */
+    size_t depth;
+    /*
+     * Nonzero to keep only the last frame of every pass: frames depth,
+     * 2 * depth, ... and the last one (and frame 0).
+     */
+    int keyframes;
+    /*
+     * Nonzero to evolve only the tiles whose neighbourhood changed in the
+     * last generation (see activity.h). Needs depth 1 and a deterministic
+     * rule.
+     */
+    int active;
+} Blocking;
 
-void evolve_image_4_parent_pick_one(Image *dst_image, const Image *src_image);
+/**
+ * File format of written frames.
+ */
+typedef enum Frame_format {
+    FRAME_PPM,
+    FRAME_PNG,
+    /* One YUV4MPEG2 stream: a single header, then every frame. */
+    FRAME_Y4M
+} Frame_format;
 
-void evolve_image_8_parent_pick_one(Image *dst_image, const Image *src_image);
+/**
+ * Where written frames go.
+ */
+typedef struct Frame_output {
+    Frame_format format;
+    /* Stream every frame is written to, in order, unless prefix is set. */
+    FILE *file;
+    /*
+     * If not NULL, every frame is written to a file of its own instead,
+     * named prefix, the frame number in 7 digits and the format's extension
+     * (a Y4M file per frame, each with its own header).
+     */
+    const char *prefix;
+} Frame_output;
+
+/**
+ * Options of a run of frame generation (see imggen.h for defaults).
+ */
+typedef struct Image_options {
+    size_t n_images;
+    size_t width;
+    size_t height;
+    unsigned long seed;
+    /* Name of the rule in FRAME_RULES. */
+    const char *rule;
+    /* Threads evolving each frame, 0 for one per online CPU. */
+    size_t n_threads;
+    /* Nonzero to store frames as planes (see image.h). */
+    int planar;
+    /* Nonzero to write frames as they are generated (see stream_images). */
+    int stream;
+    /* Writer threads, 0 to write on the generating thread. */
+    size_t n_writers;
+    /* Frame buffers shared by generator and writers, if n_writers > 0. */
+    size_t n_buffers;
+    Frame_output output;
+    /* Stream for progress and statistics, NULL for none. */
+    FILE *log;
+    Blocking blocking;
+    /*
+     * File to save checkpoints to, about every checkpoint_every frames, NULL
+     * for none. Needs stream or n_writers.
+     */
+    const char *checkpoint_path;
+    size_t checkpoint_every;
+    /*
+     * Checkpoint to resume from, NULL to start from frame 0. The seed is the
+     * checkpoint's. Needs stream or n_writers.
+     */
+    const char *resume_path;
+} Image_options;
 
-void evolve_image_8_parent_extreme(Image *dst_image, const Image *src_image);
+/**
+ * Generate the frames options describe, evolved with its rule on the threads
+ * of pool and blocked as its blocking says. Output is the same either way.
+ * Frames not kept are NULL.
+ */
+Image **generate_images(const Image_options *options, const Rng *rng,
+                        Thread_pool *pool);
 
-Image **generate_images(size_t n_images, size_t width, size_t height);
+/**
+ * Write the frames of options to its output, using pool (may be NULL) for
+ * encoders that can use threads. NULL frames are skipped.
+ */
+void write_images(Image **images, const Image_options *options,
+                  Thread_pool *pool);
 
-void write_images(Image **images, size_t n_images);
+/**
+ * Checkpoints of a streamed run (see checkpoint.h).
+ */
+typedef struct Checkpointing {
+    /*
+     * Frame to start from instead of a random frame 0, NULL for none. Frames
+     * before it are neither generated nor written.
+     */
+    const Checkpoint *resume;
+    /*
+     * Offered the last frame of every pass once it and every frame before
+     * it have been written, NULL for none.
+     */
+    Checkpointer *checkpointer;
+} Checkpointing;
+
+/**
+ * Generate frames as generate_images does and write each one as soon as it
+ * is done, as write_images does, keeping only two frames in memory (or one
+ * more than the frames kept per pass). checkpointing may be NULL.
+ */
+void stream_images(const Image_options *options, const Rng *rng,
+                   Thread_pool *pool, const Checkpointing *checkpointing);
+
+/**
+ * Generate frames as stream_images does, but hand each one to the
+ * options->n_writers writer threads through a queue of options->n_buffers
+ * recycled frame buffers (see frame_queue.h), so that generation and output
+ * overlap. Logs queue statistics when done. A pass needs one buffer more
+ * than the frames it keeps.
+ */
+void pipeline_images(const Image_options *options, const Rng *rng,
+                     Thread_pool *pool, const Checkpointing *checkpointing);
 
 void free_images(Image **images, size_t n_images);
 
-void main_image_generation(size_t n_images, size_t width, size_t height);
+/*
+ * Frame by frame generation, for imggen.h: a Schedule evolves frames as the
+ * blocking of a run says, with its rule.
+ */
+typedef struct Schedule Schedule;
+
+/**
+ * Schedule for frames of options, evolved one at a time (a blocking depth
+ * above 1 is taken as 1).
+ */
+Schedule *schedule_frames(const Image_options *options, Thread_pool *pool);
+
+/**
+ * Evolve src_image, frame number frame - 1, into dst_image as schedule says,
+ * refreshing its halo.
+ */
+void evolve_scheduled_frame(Schedule *schedule, Thread_pool *pool,
+                            Image *dst_image, const Image *src_image,
+                            const Rng *rng, size_t frame);
+
+void free_scheduled_frames(Schedule *schedule);
 
 #endif /* EVOLVE_IMAGE_H */
@@ -0,0 +1,457 @@
+#include <stddef.h>
+#include "evolve_pixel.h"
+#include "evolve_plane.h"
+#include "rng.h"
+#include "simd.h"
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+/*
+ * Every kernel runs a vector loop over VEC_BYTES pixels at a time where
+ * available, then finishes the run (or all of it) one byte at a time.
+ */
+
+#ifdef SIMD
+/* 0xFF where bit is set in c. */
+#define vec_bit(c, bit) vec_cmpeq(vec_and((c), vec_set1(bit)), vec_set1(bit))
+/* Byte / 2 and byte / 4, rounding down. */
+#define vec_half(v) vec_and(vec_srli_u16((v), 1), vec_set1(0x7F))
+#define vec_quarter(v) vec_and(vec_srli_u16((v), 2), vec_set1(0x3F))
+#endif
+
+void evolve_plane_single_parent(unsigned char *dst,
+                                const unsigned char *parent,
+                                const unsigned char *noise, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        /* RNG_BELOW(noise, 16) is the top nibble. */
+        Vec amount = vec_and(vec_srli_u16(vec_load(noise + i), 4),
+                             vec_set1(0x0F));
+        vec_store(dst + i, vec_add(vec_load(parent + i), amount));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = (unsigned char)(parent[i] + RNG_BELOW(noise[i], 16));
+    }
+}
+
+void evolve_plane_dad_mom_genes(unsigned char *dst, const unsigned char *dad,
+                                const unsigned char *mom,
+                                const unsigned char *choice,
+                                const unsigned char *noise, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        Vec take_dad = vec_bit(vec_load(choice + i), 0x80);
+        Vec gene = vec_select(take_dad, vec_load(dad + i), vec_load(mom + i));
+        vec_store(dst + i, vec_jitter(gene, vec_load(noise + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = jitter(RNG_BELOW(choice[i], 2) ? dad[i] : mom[i], noise[i]);
+    }
+}
+
+void evolve_plane_dad_or_mom(unsigned char *dst, const unsigned char *dad,
+                             const unsigned char *mom,
+                             const unsigned char *choice, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        Vec take_dad = vec_bit(vec_load(choice + i), 0x80);
+        vec_store(dst + i, vec_select(take_dad, vec_load(dad + i),
+                                      vec_load(mom + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = RNG_BELOW(choice[i], 2) ? dad[i] : mom[i];
+    }
+}
+
+void evolve_plane_3_parent_genes(unsigned char *dst,
+                                 const unsigned char *parent1,
+                                 const unsigned char *parent2,
+                                 const unsigned char *parent3,
+                                 const unsigned char *choice,
+                                 const unsigned char *noise, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        /* RNG_BELOW(choice, 3) is 0 up to 85, 1 up to 170, else 2. */
+        Vec c = vec_load(choice + i);
+        Vec gene = vec_select(
+            vec_le(c, vec_set1(85)), vec_load(parent1 + i),
+            vec_select(vec_le(c, vec_set1(170)), vec_load(parent2 + i),
+                       vec_load(parent3 + i)));
+        vec_store(dst + i, vec_jitter(gene, vec_load(noise + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        switch (RNG_BELOW(choice[i], 3)) {
+            case 0: dst[i] = jitter(parent1[i], noise[i]); break;
+            case 1: dst[i] = jitter(parent2[i], noise[i]); break;
+            case 2: dst[i] = jitter(parent3[i], noise[i]); break;
+        }
+    }
+}
+
+void evolve_plane_dad_mom_average(unsigned char *dst,
+                                  const unsigned char *dad,
+                                  const unsigned char *mom,
+                                  const unsigned char *noise, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        Vec sum = vec_add(vec_half(vec_load(dad + i)),
+                          vec_half(vec_load(mom + i)));
+        vec_store(dst + i, vec_sub(vec_add(sum, vec_below(vec_load(noise + i),
+                                                          17)),
+                                   vec_set1(8)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = (unsigned char)(dad[i] / 2 + mom[i] / 2 +
+                                 RNG_BELOW(noise[i], 17) - 8);
+    }
+}
+
+void evolve_plane_4_parent_genes(unsigned char *dst,
+                                 const unsigned char *parent1,
+                                 const unsigned char *parent2,
+                                 const unsigned char *parent3,
+                                 const unsigned char *parent4,
+                                 const unsigned char *choice,
+                                 const unsigned char *noise, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        /* RNG_BELOW(choice, 4) is the top two bits. */
+        Vec c = vec_load(choice + i);
+        Vec odd = vec_bit(c, 0x40);
+        Vec gene = vec_select(
+            vec_bit(c, 0x80),
+            vec_select(odd, vec_load(parent4 + i), vec_load(parent3 + i)),
+            vec_select(odd, vec_load(parent2 + i), vec_load(parent1 + i)));
+        vec_store(dst + i, vec_jitter(gene, vec_load(noise + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        switch (RNG_BELOW(choice[i], 4)) {
+            case 0: dst[i] = jitter(parent1[i], noise[i]); break;
+            case 1: dst[i] = jitter(parent2[i], noise[i]); break;
+            case 2: dst[i] = jitter(parent3[i], noise[i]); break;
+            case 3: dst[i] = jitter(parent4[i], noise[i]); break;
+        }
+    }
+}
+
+void evolve_plane_4_parent_average(unsigned char *dst,
+                                   const unsigned char *parent1,
+                                   const unsigned char *parent2,
+                                   const unsigned char *parent3,
+                                   const unsigned char *parent4,
+                                   const unsigned char *noise, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        /* (int)(value / 4.0) is value / 4 for bytes. */
+        Vec sum = vec_add(vec_add(vec_quarter(vec_load(parent1 + i)),
+                                  vec_quarter(vec_load(parent2 + i))),
+                          vec_add(vec_quarter(vec_load(parent3 + i)),
+                                  vec_quarter(vec_load(parent4 + i))));
+        vec_store(dst + i, vec_sub(vec_add(sum, vec_below(vec_load(noise + i),
+                                                          17)),
+                                   vec_set1(8)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = (unsigned char)(parent1[i] / 4 + parent2[i] / 4 +
+                                 parent3[i] / 4 + parent4[i] / 4 +
+                                 RNG_BELOW(noise[i], 17) - 8);
+    }
+}
+
+void evolve_plane_4_parent_pick_one(unsigned char *dst,
+                                    const unsigned char *parent1,
+                                    const unsigned char *parent2,
+                                    const unsigned char *parent3,
+                                    const unsigned char *parent4,
+                                    const unsigned char *choice, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        Vec c = vec_load(choice + i);
+        Vec odd = vec_bit(c, 0x40);
+        vec_store(dst + i, vec_select(
+            vec_bit(c, 0x80),
+            vec_select(odd, vec_load(parent4 + i), vec_load(parent3 + i)),
+            vec_select(odd, vec_load(parent2 + i), vec_load(parent1 + i))));
+    }
+#endif
+    for (; i < n; ++i) {
+        switch (RNG_BELOW(choice[i], 4)) {
+            case 0: dst[i] = parent1[i]; break;
+            case 1: dst[i] = parent2[i]; break;
+            case 2: dst[i] = parent3[i]; break;
+            case 3: dst[i] = parent4[i]; break;
+        }
+    }
+}
+
+void evolve_plane_8_parent_pick_one(unsigned char *dst,
+                                    const unsigned char *parents[8],
+                                    const unsigned char *choice, size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        /* RNG_BELOW(choice, 8) is the top three bits: pick by halving. */
+        Vec c = vec_load(choice + i);
+        Vec bit0 = vec_bit(c, 0x20), bit1 = vec_bit(c, 0x40);
+        Vec low = vec_select(
+            bit1,
+            vec_select(bit0, vec_load(parents[3] + i),
+                       vec_load(parents[2] + i)),
+            vec_select(bit0, vec_load(parents[1] + i),
+                       vec_load(parents[0] + i)));
+        Vec high = vec_select(
+            bit1,
+            vec_select(bit0, vec_load(parents[7] + i),
+                       vec_load(parents[6] + i)),
+            vec_select(bit0, vec_load(parents[5] + i),
+                       vec_load(parents[4] + i)));
+        vec_store(dst + i, vec_select(vec_bit(c, 0x80), high, low));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = parents[RNG_BELOW(choice[i], 8)][i];
+    }
+}
+
+#ifdef SIMD
+/* extremity for VEC_BYTES pixels: the same two exchanges, as min and max. */
+static __inline__ Vec vec_extremity(Vec r, Vec g, Vec b) {
+    Vec low = vec_min(g, b), high = vec_max(g, b);
+    Vec middle = vec_max(r, low);
+    return vec_sub(vec_max(middle, high), vec_min(middle, high));
+}
+#endif
+
+void evolve_plane_8_parent_extreme(const Planes *dst, const Planes *src,
+                                   size_t stride, size_t n) {
+    /* Parent offsets in evolve_image_8_parent_extreme order. */
+    ptrdiff_t offsets[8];
+    const unsigned char *r = src->channel[0];
+    const unsigned char *g = src->channel[1];
+    const unsigned char *b = src->channel[2];
+    unsigned char rgb[3];
+    size_t i;
+    int k, best;
+
+    offsets[0] = -(ptrdiff_t)stride;
+    offsets[1] = -(ptrdiff_t)stride - 1;
+    offsets[2] = -(ptrdiff_t)stride + 1;
+    offsets[3] = (ptrdiff_t)stride;
+    offsets[4] = (ptrdiff_t)stride - 1;
+    offsets[5] = (ptrdiff_t)stride + 1;
+    offsets[6] = -1;
+    offsets[7] = 1;
+
+    i = 0;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        Vec best_r = vec_load(r + (ptrdiff_t)i + offsets[0]);
+        Vec best_g = vec_load(g + (ptrdiff_t)i + offsets[0]);
+        Vec best_b = vec_load(b + (ptrdiff_t)i + offsets[0]);
+        Vec best_extremity = vec_extremity(best_r, best_g, best_b);
+        for (k = 1; k < 8; ++k) {
+            Vec cur_r = vec_load(r + (ptrdiff_t)i + offsets[k]);
+            Vec cur_g = vec_load(g + (ptrdiff_t)i + offsets[k]);
+            Vec cur_b = vec_load(b + (ptrdiff_t)i + offsets[k]);
+            Vec cur_extremity = vec_extremity(cur_r, cur_g, cur_b);
+            /* Keep the earlier parent unless strictly more extreme. */
+            Vec keep = vec_le(cur_extremity, best_extremity);
+            best_r = vec_select(keep, best_r, cur_r);
+            best_g = vec_select(keep, best_g, cur_g);
+            best_b = vec_select(keep, best_b, cur_b);
+            best_extremity = vec_max(best_extremity, cur_extremity);
+        }
+        vec_store(dst->channel[0] + i, best_r);
+        vec_store(dst->channel[1] + i, best_g);
+        vec_store(dst->channel[2] + i, best_b);
+    }
+#endif
+    for (; i < n; ++i) {
+        unsigned char best_extremity = 0, cur_extremity;
+        Pixel parent;
+        best = 0;
+        /* First strictly greater extremity wins, as in most_extreme. */
+        for (k = 0; k < 8; ++k) {
+            ptrdiff_t at = (ptrdiff_t)i + offsets[k];
+            parent.r = r[at];
+            parent.g = g[at];
+            parent.b = b[at];
+            cur_extremity = extremity(&parent, rgb);
+            if (k == 0 || cur_extremity > best_extremity) {
+                best = k;
+                best_extremity = cur_extremity;
+            }
+        }
+        dst->channel[0][i] = r[(ptrdiff_t)i + offsets[best]];
+        dst->channel[1][i] = g[(ptrdiff_t)i + offsets[best]];
+        dst->channel[2][i] = b[(ptrdiff_t)i + offsets[best]];
+    }
+}
+
+/**
+ * Index of the first of the 8 extremities of pixel i that is greatest.
+ */
+static __inline__ int most_extreme(const unsigned char *parents[8],
+                                   size_t i) {
+    unsigned char best = parents[0][i];
+    int k, best_k = 0;
+    for (k = 1; k < 8; ++k) {
+        if (parents[k][i] > best) {
+            best = parents[k][i];
+            best_k = k;
+        }
+    }
+    return best_k;
+}
+
+#ifdef __SSSE3__
+/*
+ * interleave_planes in reverse: channel c of pixel k (of 16) is byte 3 * k + c
+ * of 48, so each channel is three byte shuffles, [c][v] of input vector v,
+ * with 0x80 (zero) where the byte is in another vector.
+ */
+#define Z 0x80
+static const unsigned char deinterleave_shuffles[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, 1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z},
+     {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15}}
+};
+#undef Z
+#endif
+
+void evolve_plane_extremities(unsigned char *dst, const Pixel *src,
+                              size_t n) {
+    size_t i = 0;
+    unsigned char rgb[3];
+#if defined(__AVX2__)
+    /* Pixels 16 to 31 in the upper lane, shuffled by the same masks. */
+    __m256i shuffles[3][3], in[3], rgb_v[3], low, high, middle;
+    int v, channel;
+
+    for (channel = 0; channel < 3; ++channel) {
+        for (v = 0; v < 3; ++v) {
+            shuffles[channel][v] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i *)(const void *)
+                                    deinterleave_shuffles[channel][v]));
+        }
+    }
+    for (; i + 32 <= n; i += 32) {
+        const unsigned char *bytes = (const unsigned char *)(src + i);
+        for (v = 0; v < 3; ++v) {
+            in[v] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(
+                    (const __m128i *)(const void *)(bytes + 16 * v))),
+                _mm_loadu_si128(
+                    (const __m128i *)(const void *)(bytes + 48 + 16 * v)),
+                1);
+        }
+        for (channel = 0; channel < 3; ++channel) {
+            rgb_v[channel] = _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_shuffle_epi8(in[0], shuffles[channel][0]),
+                    _mm256_shuffle_epi8(in[1], shuffles[channel][1])),
+                _mm256_shuffle_epi8(in[2], shuffles[channel][2]));
+        }
+        low = _mm256_min_epu8(rgb_v[1], rgb_v[2]);
+        high = _mm256_max_epu8(rgb_v[1], rgb_v[2]);
+        middle = _mm256_max_epu8(rgb_v[0], low);
+        _mm256_storeu_si256((__m256i *)(void *)(dst + i),
+                            _mm256_sub_epi8(_mm256_max_epu8(middle, high),
+                                            _mm256_min_epu8(middle, high)));
+    }
+#elif defined(__SSSE3__)
+    __m128i shuffles[3][3], in[3], rgb_v[3], low, high, middle;
+    int v, channel;
+
+    for (channel = 0; channel < 3; ++channel) {
+        for (v = 0; v < 3; ++v) {
+            shuffles[channel][v] = _mm_loadu_si128(
+                (const __m128i *)(const void *)
+                    deinterleave_shuffles[channel][v]);
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        for (v = 0; v < 3; ++v) {
+            in[v] = _mm_loadu_si128((const __m128i *)(const void *)
+                                    ((const unsigned char *)(src + i) +
+                                     16 * v));
+        }
+        for (channel = 0; channel < 3; ++channel) {
+            rgb_v[channel] = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(in[0], shuffles[channel][0]),
+                             _mm_shuffle_epi8(in[1], shuffles[channel][1])),
+                _mm_shuffle_epi8(in[2], shuffles[channel][2]));
+        }
+        /* As vec_extremity, on 16 bytes whatever the vector width. */
+        low = _mm_min_epu8(rgb_v[1], rgb_v[2]);
+        high = _mm_max_epu8(rgb_v[1], rgb_v[2]);
+        middle = _mm_max_epu8(rgb_v[0], low);
+        _mm_storeu_si128((__m128i *)(void *)(dst + i),
+                         _mm_sub_epi8(_mm_max_epu8(middle, high),
+                                      _mm_min_epu8(middle, high)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = extremity(src + i, rgb);
+    }
+}
+
+void evolve_plane_extreme_choice(unsigned char *choice,
+                                 const unsigned char *above,
+                                 const unsigned char *row,
+                                 const unsigned char *below, size_t n) {
+    /* Extremities of parent k, in evolve_plane_8_parent_extreme order. */
+    const unsigned char *parents[8];
+    size_t i = 0;
+#ifdef SIMD
+    int k;
+#endif
+
+    parents[0] = above;
+    parents[1] = above - 1;
+    parents[2] = above + 1;
+    parents[3] = below;
+    parents[4] = below - 1;
+    parents[5] = below + 1;
+    parents[6] = row - 1;
+    parents[7] = row + 1;
+#ifdef SIMD
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        Vec best_extremity = vec_load(parents[0] + i);
+        Vec best_choice = vec_zero();
+        for (k = 1; k < 8; ++k) {
+            Vec cur_extremity = vec_load(parents[k] + i);
+            /* Keep the earlier parent unless strictly more extreme. */
+            Vec keep = vec_le(cur_extremity, best_extremity);
+            best_choice = vec_select(keep, best_choice, vec_set1(k << 5));
+            best_extremity = vec_max(best_extremity, cur_extremity);
+        }
+        vec_store(choice + i, best_choice);
+    }
+#endif
+    for (; i < n; ++i) {
+        choice[i] = (unsigned char)(most_extreme(parents, i) << 5);
+    }
+}
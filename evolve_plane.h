@@ -0,0 +1,100 @@
+#ifndef EVOLVE_PLANE_H
+#define EVOLVE_PLANE_H
+#include "image.h"
+
+/*
+ * Kernels for planar images. Each evolves n consecutive bytes dst[i] of one
+ * channel plane from the bytes parent1[i], parent2[i], ... of the same
+ * channel, so the parents of a run of pixels are just the source plane at a
+ * shifted offset (-1 and +1 for left and right, -stride and +stride for the
+ * rows above and below). choice and noise are the random bytes of the same
+ * channel (see rng_fill_plane), except for kernels that copy whole pixels:
+ * they are given the red choice plane for all three channels.
+ *
+ * Byte for byte they compute what the rule of the same name in rule.h
+ * computes for that channel, so planar and interleaved runs agree.
+ */
+
+void evolve_plane_single_parent(unsigned char *dst,
+                                const unsigned char *parent,
+                                const unsigned char *noise, size_t n);
+
+void evolve_plane_dad_mom_genes(unsigned char *dst, const unsigned char *dad,
+                                const unsigned char *mom,
+                                const unsigned char *choice,
+                                const unsigned char *noise, size_t n);
+
+void evolve_plane_dad_or_mom(unsigned char *dst, const unsigned char *dad,
+                             const unsigned char *mom,
+                             const unsigned char *choice, size_t n);
+
+void evolve_plane_3_parent_genes(unsigned char *dst,
+                                 const unsigned char *parent1,
+                                 const unsigned char *parent2,
+                                 const unsigned char *parent3,
+                                 const unsigned char *choice,
+                                 const unsigned char *noise, size_t n);
+
+void evolve_plane_dad_mom_average(unsigned char *dst,
+                                  const unsigned char *dad,
+                                  const unsigned char *mom,
+                                  const unsigned char *noise, size_t n);
+
+void evolve_plane_4_parent_genes(unsigned char *dst,
+                                 const unsigned char *parent1,
+                                 const unsigned char *parent2,
+                                 const unsigned char *parent3,
+                                 const unsigned char *parent4,
+                                 const unsigned char *choice,
+                                 const unsigned char *noise, size_t n);
+
+void evolve_plane_4_parent_average(unsigned char *dst,
+                                   const unsigned char *parent1,
+                                   const unsigned char *parent2,
+                                   const unsigned char *parent3,
+                                   const unsigned char *parent4,
+                                   const unsigned char *noise, size_t n);
+
+void evolve_plane_4_parent_pick_one(unsigned char *dst,
+                                    const unsigned char *parent1,
+                                    const unsigned char *parent2,
+                                    const unsigned char *parent3,
+                                    const unsigned char *parent4,
+                                    const unsigned char *choice, size_t n);
+
+/**
+ * parents[k] is the plane of parent k, in FRAME_PARENTS_8 order (see
+ * rule.h).
+ */
+void evolve_plane_8_parent_pick_one(unsigned char *dst,
+                                    const unsigned char *parents[8],
+                                    const unsigned char *choice, size_t n);
+
+/**
+ * Needs all three channels at once: dst and src point at the first pixel of
+ * the run in every plane, and parents are read at the same offsets from src
+ * as in evolve_image_8_parent_extreme, rows being stride bytes apart.
+ */
+void evolve_plane_8_parent_extreme(const Planes *dst, const Planes *src,
+                                   size_t stride, size_t n);
+
+/**
+ * Extremity of each of the n interleaved pixels of src, as in
+ * evolve_image_8_parent_extreme, into dst.
+ */
+void evolve_plane_extremities(unsigned char *dst, const Pixel *src,
+                              size_t n);
+
+/**
+ * For interleaved images, whose extremities are worked out a row at a time
+ * beforehand: which parent evolve_plane_8_parent_extreme would pick for each
+ * of n pixels, going by the extremities of the rows above, of and below the
+ * run, each readable one pixel before and after it. Parent k is written as
+ * k << 5, the random byte that picks it in evolve_plane_8_parent_pick_one.
+ */
+void evolve_plane_extreme_choice(unsigned char *choice,
+                                 const unsigned char *above,
+                                 const unsigned char *row,
+                                 const unsigned char *below, size_t n);
+
+#endif /* EVOLVE_PLANE_H */
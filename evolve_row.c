@@ -1,159 +1,430 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
-#include <time.h>
-#include "evolve_pixel.h"
+#include "ensemble.h"
+#include "evolve_plane.h"
 #include "evolve_row.h"
 #include "image.h"
+#include "rng.h"
+#include "rule.h"
+#include "simd.h"
+#include "wavefront.h"
 
-void evolve_row_single_parent(Pixel *dst_row, const Pixel *src_row,
-                              const size_t size) {
-    size_t i;
-    for (i = 0; i < size; ++i) {
-        evolve_pixel_single_parent(dst_row + i, src_row + i);
+#ifdef SIMD
+/*
+ * Vector versions of the middle-pixel loops below. Each evolves pixels
+ * [first, last) VEC_BYTES pixels (three vectors) at a time, and returns the
+ * first pixel left for the scalar loop. Byte k of a row is channel k % 3 of
+ * pixel k / 3, so the same channel of the left and right neighbours is 3
+ * bytes away, and channels never mix.
+ */
+
+static size_t vec_row_single_parent(Pixel *dst_row, const Pixel *src_row,
+                                    size_t first, size_t last,
+                                    const Pixel *choice_row,
+                                    const Pixel *noise_row) {
+    unsigned char *dst = (unsigned char *)dst_row;
+    const unsigned char *src = (const unsigned char *)src_row;
+    const unsigned char *noise = (const unsigned char *)noise_row;
+    size_t i, k;
+    (void)choice_row;
+
+    for (i = first; i + VEC_BYTES <= last; i += VEC_BYTES) {
+        for (k = 3 * i; k < 3 * (i + VEC_BYTES); k += VEC_BYTES) {
+            /* RNG_BELOW(noise, 16) is the top nibble. */
+            Vec amount = vec_and(vec_srli_u16(vec_load(noise + k), 4),
+                                 vec_set1(0x0F));
+            vec_store(dst + k, vec_add(vec_load(src + k), amount));
+        }
     }
+    return i;
 }
 
-void evolve_row_dad_mom_genes(Pixel *dst_row, const Pixel *src_row,
-                              const size_t size) {
-    size_t i;
-    const Pixel *dad_pixel, *mom_pixel;
+static size_t vec_row_dad_mom_genes(Pixel *dst_row, const Pixel *src_row,
+                                    size_t first, size_t last,
+                                    const Pixel *choice_row,
+                                    const Pixel *noise_row) {
+    unsigned char *dst = (unsigned char *)dst_row;
+    const unsigned char *src = (const unsigned char *)src_row;
+    const unsigned char *choice = (const unsigned char *)choice_row;
+    const unsigned char *noise = (const unsigned char *)noise_row;
+    size_t i, k;
 
-    /* Evolve first pixel. */
-    dad_pixel = src_row + size - 1;
-    mom_pixel = src_row + 1;
-    evolve_pixel_dad_mom_genes(dst_row, dad_pixel, mom_pixel);
+    for (i = first; i + VEC_BYTES <= last; i += VEC_BYTES) {
+        for (k = 3 * i; k < 3 * (i + VEC_BYTES); k += VEC_BYTES) {
+            /* RNG_BELOW(choice, 2) == 1 picks dad. */
+            Vec take_dad = vec_le(vec_set1(128), vec_load(choice + k));
+            Vec gene = vec_select(take_dad, vec_load(src + k - 3),
+                                  vec_load(src + k + 3));
+            vec_store(dst + k, vec_jitter(gene, vec_load(noise + k)));
+        }
+    }
+    return i;
+}
+
+static size_t vec_row_dad_or_mom(Pixel *dst_row, const Pixel *src_row,
+                                 size_t first, size_t last,
+                                 const Pixel *choice_row,
+                                 const Pixel *noise_row) {
+    unsigned char *dst = (unsigned char *)dst_row;
+    const unsigned char *src = (const unsigned char *)src_row;
+    const unsigned char *choice = (const unsigned char *)choice_row;
+    unsigned char channel_bytes[3][3][VEC_BYTES];
+    Vec is_r[3], is_g[3];
+    size_t i, k;
+    int v, b;
+    (void)noise_row;
 
-    /* Evolve middle pixels (all except first and last). */
-    for (i = 1; i < size - 1; ++i) {
-        dad_pixel = src_row + i - 1;
-        mom_pixel = src_row + i + 1;
-        evolve_pixel_dad_mom_genes(dst_row + i, dad_pixel, mom_pixel);
+    /*
+     * The whole pixel follows the choice of its red channel. Vector v of a
+     * group starts at channel (v * VEC_BYTES) % 3; the red choice for a green
+     * byte is 1 byte back, for a blue byte 2 bytes back.
+     */
+    for (v = 0; v < 3; ++v) {
+        for (b = 0; b < VEC_BYTES; ++b) {
+            int channel = (v * VEC_BYTES + b) % 3;
+            channel_bytes[v][0][b] = channel == 0 ? 0xFF : 0;
+            channel_bytes[v][1][b] = channel == 1 ? 0xFF : 0;
+        }
+        is_r[v] = vec_load(channel_bytes[v][0]);
+        is_g[v] = vec_load(channel_bytes[v][1]);
     }
 
-    /* Evolve last pixel. */
-    dad_pixel = src_row + size - 2;
-    mom_pixel = src_row;
-    evolve_pixel_dad_mom_genes(dst_row + size - 1, dad_pixel, mom_pixel);
+    for (i = first; i + VEC_BYTES <= last; i += VEC_BYTES) {
+        for (v = 0, k = 3 * i; v < 3; ++v, k += VEC_BYTES) {
+            Vec red_choice = vec_select(
+                is_r[v], vec_load(choice + k),
+                vec_select(is_g[v], vec_load(choice + k - 1),
+                           vec_load(choice + k - 2)));
+            Vec take_dad = vec_le(vec_set1(128), red_choice);
+            vec_store(dst + k, vec_select(take_dad, vec_load(src + k - 3),
+                                          vec_load(src + k + 3)));
+        }
+    }
+    return i;
 }
 
-void evolve_row_dad_or_mom(Pixel *dst_row, const Pixel *src_row,
-                           const size_t size) {
-    size_t i;
-    const Pixel *dad_pixel, *mom_pixel;
+static size_t vec_row_3_parent_genes(Pixel *dst_row, const Pixel *src_row,
+                                     size_t first, size_t last,
+                                     const Pixel *choice_row,
+                                     const Pixel *noise_row) {
+    unsigned char *dst = (unsigned char *)dst_row;
+    const unsigned char *src = (const unsigned char *)src_row;
+    const unsigned char *choice = (const unsigned char *)choice_row;
+    const unsigned char *noise = (const unsigned char *)noise_row;
+    size_t i, k;
+
+    for (i = first; i + VEC_BYTES <= last; i += VEC_BYTES) {
+        for (k = 3 * i; k < 3 * (i + VEC_BYTES); k += VEC_BYTES) {
+            /* RNG_BELOW(choice, 3) is 0 up to 85, 1 up to 170, else 2. */
+            Vec c = vec_load(choice + k);
+            Vec gene = vec_select(
+                vec_le(c, vec_set1(85)), vec_load(src + k - 3),
+                vec_select(vec_le(c, vec_set1(170)), vec_load(src + k),
+                           vec_load(src + k + 3)));
+            vec_store(dst + k, vec_jitter(gene, vec_load(noise + k)));
+        }
+    }
+    return i;
+}
 
-    /* Evolve first pixel. */
-    dad_pixel = src_row + size - 1;
-    mom_pixel = src_row + 1;
-    evolve_pixel_dad_or_mom(dst_row, dad_pixel, mom_pixel);
+/**
+ * dad_offset is 3 bytes back for dad above left, 0 for dad above.
+ */
+static size_t vec_row_average(Pixel *dst_row, const Pixel *src_row,
+                              size_t first, size_t last, size_t dad_offset,
+                              const Pixel *noise_row) {
+    unsigned char *dst = (unsigned char *)dst_row;
+    const unsigned char *src = (const unsigned char *)src_row;
+    const unsigned char *noise = (const unsigned char *)noise_row;
+    Vec low_bits = vec_set1(0x7F);
+    size_t i, k;
 
-    /* Evolve middle pixels (all except first and last). */
-    for (i = 1; i < size - 1; ++i) {
-        dad_pixel = src_row + i - 1;
-        mom_pixel = src_row + i + 1;
-        evolve_pixel_dad_or_mom(dst_row + i, dad_pixel, mom_pixel);
+    for (i = first; i + VEC_BYTES <= last; i += VEC_BYTES) {
+        for (k = 3 * i; k < 3 * (i + VEC_BYTES); k += VEC_BYTES) {
+            Vec dad_half = vec_and(vec_srli_u16(
+                vec_load(src + k - dad_offset), 1), low_bits);
+            Vec mom_half = vec_and(vec_srli_u16(
+                vec_load(src + k + 3), 1), low_bits);
+            Vec amount = vec_below(vec_load(noise + k), 17);
+            vec_store(dst + k, vec_sub(vec_add(vec_add(dad_half, mom_half),
+                                               amount),
+                                       vec_set1(8)));
+        }
     }
+    return i;
+}
 
-    /* Evolve last pixel. */
-    dad_pixel = src_row + size - 2;
-    mom_pixel = src_row;
-    evolve_pixel_dad_or_mom(dst_row + size - 1, dad_pixel, mom_pixel);
+static size_t vec_row_dad_mom_average(Pixel *dst_row, const Pixel *src_row,
+                                      size_t first, size_t last,
+                                      const Pixel *choice_row,
+                                      const Pixel *noise_row) {
+    (void)choice_row;
+    return vec_row_average(dst_row, src_row, first, last, 3, noise_row);
 }
 
-void evolve_row_3_parent_genes(Pixel *dst_row, const Pixel *src_row,
-                               const size_t size) {
-    size_t i;
-    const Pixel *parent_pixel1, *parent_pixel2, *parent_pixel3;
+static size_t vec_row_dad_mom_dad_above(Pixel *dst_row, const Pixel *src_row,
+                                        size_t first, size_t last,
+                                        const Pixel *choice_row,
+                                        const Pixel *noise_row) {
+    (void)choice_row;
+    return vec_row_average(dst_row, src_row, first, last, 0, noise_row);
+}
+#endif
 
-    /* Evolve first pixel. */
-    parent_pixel1 = src_row + size - 1;
-    parent_pixel2 = src_row;
-    parent_pixel3 = src_row + 1;
-    evolve_pixel_3_parent_genes(dst_row, parent_pixel1, parent_pixel2,
-                                parent_pixel3);
 
-    /* Evolve middle pixels (all except first and last). */
-    for (i = 1; i < size - 1; ++i) {
-        parent_pixel1 = src_row + i - 1;
-        parent_pixel2 = src_row + i;
-        parent_pixel3 = src_row + i + 1;
-        evolve_pixel_3_parent_genes(dst_row + i, parent_pixel1, parent_pixel2,
-                                    parent_pixel3);
+/*
+ * Planar row evolvers: the same strategies run plane by plane, the middle
+ * pixels of a row as one run of the evolve_plane_* kernel, and the first and
+ * last pixels, whose neighbours wrap around, as runs of one. Rows too narrow
+ * to have both go through the expanded rule loop below instead.
+ */
+
+#define DECLARE_ROW_RULE(name, parents, combine_op, noise_op, kernels) \
+static __inline__ void rule_row_##name(const Planes *dst_row, \
+                                       const Planes *src_row, size_t size, \
+                                       const Planes *choice_row, \
+                                       const Planes *noise_row, size_t step, \
+                                       size_t first);
+
+ROW_RULES(DECLARE_ROW_RULE)
+
+void evolve_row_planar_single_parent(const Planes *dst_row,
+                                     const Planes *src_row, const size_t size,
+                                     const Planes *choice_row,
+                                     const Planes *noise_row) {
+    int c;
+    (void)choice_row;
+    for (c = 0; c < 3; ++c) {
+        evolve_plane_single_parent(dst_row->channel[c], src_row->channel[c],
+                                   noise_row->channel[c], size);
+    }
+}
+
+void evolve_row_planar_dad_mom_genes(const Planes *dst_row,
+                                     const Planes *src_row, const size_t size,
+                                     const Planes *choice_row,
+                                     const Planes *noise_row) {
+    int c;
+    if (size < 2) {
+        rule_row_dad_mom_genes(dst_row, src_row, size, choice_row,
+                               noise_row, 1, 1);
+        return;
+    }
+    for (c = 0; c < 3; ++c) {
+        unsigned char *dst = dst_row->channel[c];
+        const unsigned char *src = src_row->channel[c];
+        const unsigned char *choice = choice_row->channel[c];
+        const unsigned char *noise = noise_row->channel[c];
+
+        evolve_plane_dad_mom_genes(dst, src + size - 1, src + 1, choice,
+                                   noise, 1);
+        evolve_plane_dad_mom_genes(dst + 1, src, src + 2, choice + 1,
+                                   noise + 1, size - 2);
+        evolve_plane_dad_mom_genes(dst + size - 1, src + size - 2, src,
+                                   choice + size - 1, noise + size - 1, 1);
     }
+}
+
+void evolve_row_planar_dad_or_mom(const Planes *dst_row,
+                                  const Planes *src_row, const size_t size,
+                                  const Planes *choice_row,
+                                  const Planes *noise_row) {
+    int c;
+    /* The whole pixel follows the choice of its red channel. */
+    const unsigned char *choice = choice_row->channel[0];
+    (void)noise_row;
+    if (size < 2) {
+        rule_row_dad_or_mom(dst_row, src_row, size, choice_row,
+                            noise_row, 1, 1);
+        return;
+    }
+    for (c = 0; c < 3; ++c) {
+        unsigned char *dst = dst_row->channel[c];
+        const unsigned char *src = src_row->channel[c];
 
-    /* Evolve last pixel. */
-    parent_pixel1 = src_row + size - 2;
-    parent_pixel2 = src_row + size - 1;
-    parent_pixel3 = src_row;
-    evolve_pixel_3_parent_genes(dst_row + size - 1, parent_pixel1,
-                                parent_pixel2, parent_pixel3);
+        evolve_plane_dad_or_mom(dst, src + size - 1, src + 1, choice, 1);
+        evolve_plane_dad_or_mom(dst + 1, src, src + 2, choice + 1, size - 2);
+        evolve_plane_dad_or_mom(dst + size - 1, src + size - 2, src,
+                                choice + size - 1, 1);
+    }
 }
 
-void evolve_row_dad_mom_average(Pixel *dst_row, const Pixel *src_row,
-                                const size_t size) {
-    size_t i;
-    const Pixel *dad_pixel, *mom_pixel;
+void evolve_row_planar_3_parent_genes(const Planes *dst_row,
+                                      const Planes *src_row,
+                                      const size_t size,
+                                      const Planes *choice_row,
+                                      const Planes *noise_row) {
+    int c;
+    if (size < 2) {
+        rule_row_3_parent_genes(dst_row, src_row, size, choice_row,
+                                noise_row, 1, 1);
+        return;
+    }
+    for (c = 0; c < 3; ++c) {
+        unsigned char *dst = dst_row->channel[c];
+        const unsigned char *src = src_row->channel[c];
+        const unsigned char *choice = choice_row->channel[c];
+        const unsigned char *noise = noise_row->channel[c];
 
-    /* Evolve first pixel. */
-    dad_pixel = src_row + size - 1;
-    mom_pixel = src_row + 1;
-    evolve_pixel_dad_mom_average(dst_row, dad_pixel, mom_pixel);
+        evolve_plane_3_parent_genes(dst, src + size - 1, src, src + 1, choice,
+                                    noise, 1);
+        evolve_plane_3_parent_genes(dst + 1, src, src + 1, src + 2,
+                                    choice + 1, noise + 1, size - 2);
+        evolve_plane_3_parent_genes(dst + size - 1, src + size - 2,
+                                    src + size - 1, src, choice + size - 1,
+                                    noise + size - 1, 1);
+    }
+}
 
-    /* Evolve middle pixels (all except first and last). */
-    for (i = 1; i < size - 1; ++i) {
-        dad_pixel = src_row + i - 1;
-        mom_pixel = src_row + i + 1;
-        evolve_pixel_dad_mom_average(dst_row + i, dad_pixel, mom_pixel);
+void evolve_row_planar_dad_mom_average(const Planes *dst_row,
+                                       const Planes *src_row,
+                                       const size_t size,
+                                       const Planes *choice_row,
+                                       const Planes *noise_row) {
+    int c;
+    if (size < 2) {
+        rule_row_dad_mom_average(dst_row, src_row, size, choice_row,
+                                 noise_row, 1, 1);
+        return;
     }
+    (void)choice_row;
+    for (c = 0; c < 3; ++c) {
+        unsigned char *dst = dst_row->channel[c];
+        const unsigned char *src = src_row->channel[c];
+        const unsigned char *noise = noise_row->channel[c];
 
-    /* Evolve last pixel. */
-    dad_pixel = src_row + size - 2;
-    mom_pixel = src_row;
-    evolve_pixel_dad_mom_average(dst_row + size - 1, dad_pixel, mom_pixel);
+        evolve_plane_dad_mom_average(dst, src + size - 1, src + 1, noise, 1);
+        evolve_plane_dad_mom_average(dst + 1, src, src + 2, noise + 1,
+                                     size - 2);
+        evolve_plane_dad_mom_average(dst + size - 1, src + size - 2, src,
+                                     noise + size - 1, 1);
+    }
 }
 
-void evolve_row_dad_mom_dad_above(Pixel *dst_row, const Pixel *src_row,
-                                  const size_t size) {
-    size_t i;
-    const Pixel *dad_pixel, *mom_pixel;
+void evolve_row_planar_dad_mom_dad_above(const Planes *dst_row,
+                                         const Planes *src_row,
+                                         const size_t size,
+                                         const Planes *choice_row,
+                                         const Planes *noise_row) {
+    int c;
+    (void)choice_row;
+    for (c = 0; c < 3; ++c) {
+        unsigned char *dst = dst_row->channel[c];
+        const unsigned char *src = src_row->channel[c];
+        const unsigned char *noise = noise_row->channel[c];
 
-    /* Evolve all except last). */
-    for (i = 0; i < size - 1; ++i) {
-        dad_pixel = src_row + i;
-        mom_pixel = src_row + i + 1;
-        evolve_pixel_dad_mom_average(dst_row + i, dad_pixel, mom_pixel);
+        evolve_plane_dad_mom_average(dst, src, src + 1, noise, size - 1);
+        evolve_plane_dad_mom_average(dst + size - 1, src + size - 1, src,
+                                     noise + size - 1, 1);
     }
+}
+
+/*
+ * Row evolvers expanded from ROW_RULES (see rule.h). The first and last
+ * pixels read wrapped neighbours. The middle ones go through the vec_row_*
+ * kernel of the rule, if it has one, then one pixel at a time. Rules without
+ * hand-written planar evolvers above get expanded ones. In a row of one
+ * pixel the first pixel is also the last, and its wrapped neighbours are
+ * itself, in the interleaved and the planar layout alike.
+ */
+
+static size_t no_vec_row(Pixel *dst_row, const Pixel *src_row, size_t first,
+                         size_t last, const Pixel *choice_row,
+                         const Pixel *noise_row) {
+    (void)dst_row;
+    (void)src_row;
+    (void)last;
+    (void)choice_row;
+    (void)noise_row;
+    return first;
+}
+
+#ifdef SIMD
+#define ROW_VECTOR_vector(name) vec_row_##name
+#else
+#define ROW_VECTOR_vector(name) no_vec_row
+#endif
+#define ROW_VECTOR_generic(name) no_vec_row
 
-    /* Evolve last pixel. */
-    dad_pixel = src_row + size - 1;
-    mom_pixel = src_row;
-    evolve_pixel_dad_mom_average(dst_row + size - 1, dad_pixel, mom_pixel);
+#define ROW_PLANAR_vector(name)
+#define ROW_PLANAR_generic(name) \
+void evolve_row_planar_##name(const Planes *dst_row, const Planes *src_row, \
+                              const size_t size, const Planes *choice_row, \
+                              const Planes *noise_row) { \
+    rule_row_##name(dst_row, src_row, size, choice_row, noise_row, 1, 1); \
 }
 
-Image *generate_image(size_t width, size_t height, Row_evolver row_evolver) {
+#define DEFINE_ROW_RULE(name, parents, combine_op, noise_op, kernels) \
+static __inline__ void rule_row_##name(const Planes *dst_row, \
+                                       const Planes *src_row, size_t size, \
+                                       const Planes *choice_row, \
+                                       const Planes *noise_row, size_t step, \
+                                       size_t first) { \
+    Planes dst = *dst_row, src = *src_row; \
+    Planes choice = *choice_row, noise = *noise_row; \
+    size_t i = 0, random_step = step; \
+    RULE_PIXEL(parents, combine_op, noise_op, RULE_LOAD_ROW_WRAPPED); \
+    for (i = first; i + 1 < size; ++i) { \
+        RULE_PIXEL(parents, combine_op, noise_op, RULE_LOAD_ROW); \
+    } \
+    i = size - 1; \
+    RULE_PIXEL(parents, combine_op, noise_op, RULE_LOAD_ROW_WRAPPED); \
+} \
+void evolve_row_##name(Pixel *dst_row, const Pixel *src_row, \
+                       const size_t size, const Pixel *choice_row, \
+                       const Pixel *noise_row) { \
+    Planes dst, src, choice, noise; \
+    size_t first = ROW_VECTOR_##kernels(name)(dst_row, src_row, 1, size - 1, \
+                                              choice_row, noise_row); \
+    rule_pixel_planes(&dst, dst_row); \
+    rule_pixel_planes(&src, src_row); \
+    rule_pixel_planes(&choice, choice_row); \
+    rule_pixel_planes(&noise, noise_row); \
+    rule_row_##name(&dst, &src, size, &choice, &noise, 3, first); \
+} \
+ROW_PLANAR_##kernels(name)
+
+ROW_RULES(DEFINE_ROW_RULE)
+
+Image *generate_image(size_t width, size_t height, Row_evolver row_evolver,
+                      const Rng *rng) {
     size_t j;
     Image *image;
+    Pixel *choice_row, *noise_row;
 
     image = malloc_image(width, height);
+    if (!image) {
+        return NULL;
+    }
+    choice_row = malloc(width * sizeof(*choice_row));
+    noise_row = malloc(width * sizeof(*noise_row));
 
     assert(image->width == width);
     assert(image->height == height);
 
-    if (image) {
+    if (choice_row && noise_row) {
         const Pixel *src_row;
         Pixel *dst_row;
 
         /* Set the first row to random RGB values. */
-        set_random_row(image->pixels, image->width);
+        set_random_row(image->pixels, image->width, rng, 0, 0);
 
         /*
          * Evolve all other rows iteratively, starting with second row based on
          * the first row.
          */
         for (j = 1; j < image->height; ++j) {
-            dst_row = image->pixels + j * image->width;
-            src_row = image->pixels + (j - 1) * image->width;
-            (*row_evolver)(dst_row, src_row, image->width);
+            dst_row = image->pixels + j * image->stride;
+            src_row = image->pixels + (j - 1) * image->stride;
+            rng_fill_row(rng, 0, j, RNG_CHOICE, choice_row, 0, width);
+            rng_fill_row(rng, 0, j, RNG_NOISE, noise_row, 0, width);
+            (*row_evolver)(dst_row, src_row, image->width, choice_row,
+                           noise_row);
         }
+        free(choice_row);
+        free(noise_row);
         return image;
     } else {
         fprintf(stderr, "Failed to allocate image.\n");
@@ -161,57 +432,457 @@ Image *generate_image(size_t width, size_t height, Row_evolver row_evolver) {
     }
 }
 
-void main_row_generation(int argc, char *argv[]) {
-    unsigned long width, height;
-    int strategy;
-    Row_evolver chosen_row_evolver;
+Image *generate_planar_image(size_t width, size_t height,
+                             Planar_row_evolver row_evolver, const Rng *rng) {
+    size_t j;
     Image *image;
-    FILE *file;
-    Row_evolver row_evolvers[6] = {
-        &evolve_row_single_parent,   &evolve_row_dad_mom_genes,
-        &evolve_row_dad_or_mom,      &evolve_row_3_parent_genes,
-        &evolve_row_dad_mom_average, &evolve_row_dad_mom_dad_above};
-
-    if (argc != 5) {
-        fprintf(stderr,
-                "Got %d arguments, need 4: width, height, strategy index, file"
-                " name.\n",
-                argc - 1);
-        exit(1);
+    unsigned char *choice_bytes, *noise_bytes;
+
+    image = malloc_image_layout(width, height, 0, 1);
+    if (!image) {
+        return NULL;
     }
-    if (1 != sscanf(argv[1], "%lu", &width)) {
-        fprintf(stderr, "Enter width as a positive integer.\n");
+    choice_bytes = malloc(3 * width);
+    noise_bytes = malloc(3 * width);
+
+    if (choice_bytes && noise_bytes) {
+        Planes src_row, dst_row, choice_row, noise_row;
+
+        split_planes(&choice_row, choice_bytes, width);
+        split_planes(&noise_row, noise_bytes, width);
+
+        /* Set the first row to random RGB values. */
+        dst_row = planes_row(image, 0);
+        rng_fill_planes(rng, 0, 0, RNG_INIT, &dst_row, 0, width);
+
+        /* Evolve all other rows iteratively, as in generate_image. */
+        for (j = 1; j < image->height; ++j) {
+            src_row = dst_row;
+            dst_row = planes_row(image, j);
+            rng_fill_planes(rng, 0, j, RNG_CHOICE, &choice_row, 0, width);
+            rng_fill_planes(rng, 0, j, RNG_NOISE, &noise_row, 0, width);
+            (*row_evolver)(&dst_row, &src_row, image->width, &choice_row,
+                           &noise_row);
+        }
+        free(choice_bytes);
+        free(noise_bytes);
+        return image;
+    } else {
+        fprintf(stderr, "Failed to allocate image.\n");
         exit(1);
     }
-    if (1 != sscanf(argv[2], "%lu", &height)) {
-        fprintf(stderr, "Enter height as a positive integer.\n");
+}
+
+int stream_image(FILE *file, size_t width, size_t height,
+                 Row_evolver row_evolver, const Rng *rng, Pyramid *pyramid) {
+    size_t j;
+    /* Row j lives in rows[j % 2] until row j + 2 overwrites it. */
+    Pixel *rows[2], *choice_row, *noise_row;
+
+    rows[0] = malloc(width * sizeof(*rows[0]));
+    rows[1] = malloc(width * sizeof(*rows[1]));
+    choice_row = malloc(width * sizeof(*choice_row));
+    noise_row = malloc(width * sizeof(*noise_row));
+
+    if (rows[0] && rows[1] && choice_row && noise_row) {
+        write_header_P6(file, width, height);
+        set_random_row(rows[0], width, rng, 0, 0);
+        fwrite(rows[0], sizeof(*rows[0]), width, file);
+        if (pyramid) {
+            pyramid_add_row(pyramid, rows[0]);
+        }
+        for (j = 1; j < height; ++j) {
+            rng_fill_row(rng, 0, j, RNG_CHOICE, choice_row, 0, width);
+            rng_fill_row(rng, 0, j, RNG_NOISE, noise_row, 0, width);
+            (*row_evolver)(rows[j % 2], rows[(j - 1) % 2], width, choice_row,
+                           noise_row);
+            fwrite(rows[j % 2], sizeof(*rows[0]), width, file);
+            if (pyramid) {
+                pyramid_add_row(pyramid, rows[j % 2]);
+            }
+        }
+        free(rows[0]);
+        free(rows[1]);
+        free(choice_row);
+        free(noise_row);
+        return !ferror(file);
+    } else {
+        fprintf(stderr, "Failed to allocate rows.\n");
         exit(1);
     }
-    strategy = atoi(argv[3]);
+}
+
+int stream_planar_image(FILE *file, size_t width, size_t height,
+                        Planar_row_evolver row_evolver, const Rng *rng,
+                        Pyramid *pyramid) {
+    size_t j;
+    /* Two rows and the random bytes, three planes each. */
+    unsigned char *bytes = malloc(4 * 3 * width);
+    Pixel *interleaved = malloc(width * sizeof(*interleaved));
 
-    if (1 <= strategy && strategy <= 6) {
-        chosen_row_evolver = row_evolvers[strategy - 1];
+    if (bytes && interleaved) {
+        Planes rows[2], choice_row, noise_row;
+        Planes *dst_row;
+
+        split_planes(&rows[0], bytes, width);
+        split_planes(&rows[1], bytes + 3 * width, width);
+        split_planes(&choice_row, bytes + 6 * width, width);
+        split_planes(&noise_row, bytes + 9 * width, width);
+
+        write_header_P6(file, width, height);
+        for (j = 0; j < height; ++j) {
+            dst_row = &rows[j % 2];
+            if (j == 0) {
+                rng_fill_planes(rng, 0, 0, RNG_INIT, dst_row, 0, width);
+            } else {
+                rng_fill_planes(rng, 0, j, RNG_CHOICE, &choice_row, 0, width);
+                rng_fill_planes(rng, 0, j, RNG_NOISE, &noise_row, 0, width);
+                (*row_evolver)(dst_row, &rows[(j - 1) % 2], width,
+                               &choice_row, &noise_row);
+            }
+            interleave_planes(interleaved, dst_row->channel[0],
+                              dst_row->channel[1], dst_row->channel[2],
+                              width);
+            fwrite(interleaved, sizeof(*interleaved), width, file);
+            if (pyramid) {
+                pyramid_add_row(pyramid, interleaved);
+            }
+        }
+        free(bytes);
+        free(interleaved);
+        return !ferror(file);
     } else {
-        fprintf(stderr, "You entered %d, which is invalid.\n", strategy);
-        fprintf(stderr, "Available strategies include:\n");
-        fprintf(stderr, "\t1. evolve_row_single_parent\n");
-        fprintf(stderr, "\t2. evolve_row_dad_mom_genes\n");
-        fprintf(stderr, "\t3. evolve_row_dad_or_mom\n");
-        fprintf(stderr, "\t4. evolve_row_3_parent_genes\n");
-        fprintf(stderr, "\t5. evolve_row_dad_mom_average\n");
-        fprintf(stderr, "\t6. evolve_row_dad_mom_dad_above\n");
+        fprintf(stderr, "Failed to allocate rows.\n");
         exit(1);
     }
+}
 
-    srand((unsigned int)time(NULL));
-    image = generate_image((size_t)width, (size_t)height, chosen_row_evolver);
-    file = fopen(argv[4], "w");
-    if (file) {
-        write_image_P6(file, image);
-        fclose(file);
+static int has_png_extension(const char *filename) {
+    size_t length = strlen(filename);
+    return length >= 4 && strcmp(filename + length - 4, ".png") == 0;
+}
+
+static const Row_evolver row_evolvers[7] = {
+    &evolve_row_single_parent,   &evolve_row_dad_mom_genes,
+    &evolve_row_dad_or_mom,      &evolve_row_3_parent_genes,
+    &evolve_row_dad_mom_average, &evolve_row_dad_mom_dad_above,
+    &evolve_row_3_parent_bright};
+
+static const Planar_row_evolver planar_row_evolvers[7] = {
+    &evolve_row_planar_single_parent,
+    &evolve_row_planar_dad_mom_genes,
+    &evolve_row_planar_dad_or_mom,
+    &evolve_row_planar_3_parent_genes,
+    &evolve_row_planar_dad_mom_average,
+    &evolve_row_planar_dad_mom_dad_above,
+    &evolve_row_planar_3_parent_bright};
+
+/* Rules without vector kernels have no ensemble evolver. */
+static const Ensemble_row_evolver ensemble_row_evolvers[7] = {
+    &evolve_ensemble_single_parent,
+    &evolve_ensemble_dad_mom_genes,
+    &evolve_ensemble_dad_or_mom,
+    &evolve_ensemble_3_parent_genes,
+    &evolve_ensemble_dad_mom_average,
+    &evolve_ensemble_dad_mom_dad_above,
+    NULL};
+
+void print_row_job_usage(FILE *file) {
+    fprintf(file, "Arguments: width, height, strategy index, file name.\n");
+    fprintf(file, "Options: --seed N, --planar, --stream, --ascii,"
+                  " --pyramid N, --ensemble N.\n");
+    fprintf(file, "Available strategies include:\n");
+    fprintf(file, "\t1. evolve_row_single_parent\n");
+    fprintf(file, "\t2. evolve_row_dad_mom_genes\n");
+    fprintf(file, "\t3. evolve_row_dad_or_mom\n");
+    fprintf(file, "\t4. evolve_row_3_parent_genes\n");
+    fprintf(file, "\t5. evolve_row_dad_mom_average\n");
+    fprintf(file, "\t6. evolve_row_dad_mom_dad_above\n");
+    fprintf(file, "\t7. evolve_row_3_parent_bright\n");
+}
+
+int parse_row_job(Row_job *job, int argc, char *argv[], char *error) {
+    unsigned long width, height, n_members;
+    int i, n_positional = 0;
+    char *positional[4];
+
+    /* Options may appear anywhere; everything else is positional. */
+    job->seed = rng_default_seed();
+    job->planar = 0;
+    job->stream = 0;
+    job->ascii = 0;
+    job->n_levels = 0;
+    job->n_members = 0;
+    for (i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--seed") == 0) {
+            if (i + 1 == argc ||
+                1 != sscanf(argv[i + 1], "%lu", &job->seed)) {
+                sprintf(error, "Enter seed as a non-negative integer.");
+                return 0;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "--pyramid") == 0) {
+            if (i + 1 == argc ||
+                1 != sscanf(argv[i + 1], "%d", &job->n_levels) ||
+                job->n_levels < 1) {
+                sprintf(error, "Enter pyramid levels as a positive"
+                               " integer.");
+                return 0;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "--ensemble") == 0) {
+            if (i + 1 == argc ||
+                1 != sscanf(argv[i + 1], "%lu", &n_members) ||
+                n_members == 0) {
+                sprintf(error, "Enter ensemble members as a positive"
+                               " integer.");
+                return 0;
+            }
+            job->n_members = (size_t)n_members;
+            ++i;
+        } else if (strcmp(argv[i], "--planar") == 0) {
+            job->planar = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            job->stream = 1;
+        } else if (strcmp(argv[i], "--ascii") == 0) {
+            job->ascii = 1;
+        } else if (n_positional < 4) {
+            positional[n_positional++] = argv[i];
+        } else {
+            ++n_positional;
+        }
+    }
+
+    if (n_positional != 4) {
+        sprintf(error, "Got %d arguments, need 4: width, height, strategy"
+                       " index, file name.", n_positional);
+        return 0;
+    }
+    if (1 != sscanf(positional[0], "%lu", &width) || width == 0) {
+        sprintf(error, "Enter width as a positive integer.");
+        return 0;
+    }
+    if (1 != sscanf(positional[1], "%lu", &height) || height == 0) {
+        sprintf(error, "Enter height as a positive integer.");
+        return 0;
+    }
+    job->width = (size_t)width;
+    job->height = (size_t)height;
+    if (job->n_levels > pyramid_max_levels(job->width, job->height)) {
+        sprintf(error, "A %lux%lu image has at most %d pyramid levels.",
+                width, height, pyramid_max_levels(job->width, job->height));
+        return 0;
+    }
+    job->strategy = atoi(positional[2]);
+    if (job->strategy < 1 || job->strategy > 7) {
+        sprintf(error, "You entered %d, which is invalid.", job->strategy);
+        return 0;
+    }
+    job->path = positional[3];
+    job->png = has_png_extension(job->path);
+    if (job->ascii + job->stream + job->png > 1) {
+        sprintf(error, "Only one of --ascii, --stream and a .png file name"
+                       " can be used.");
+        return 0;
+    }
+    if (job->n_members > 0 && !ensemble_row_evolvers[job->strategy - 1]) {
+        sprintf(error, "Strategy %d has no ensemble evolver.", job->strategy);
+        return 0;
+    }
+    if (job->n_members > 0 && job->stream) {
+        sprintf(error, "Ensembles cannot be streamed.");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Generate the image of job on the threads of pool, or serially if pool is
+ * NULL.
+ */
+static Image *generate_row_job(const Row_job *job, const Rng *rng,
+                               Thread_pool *pool) {
+    if (job->planar) {
+        return pool ? generate_planar_image_wavefront(
+                          job->width, job->height,
+                          planar_row_evolvers[job->strategy - 1], rng, pool)
+                    : generate_planar_image(
+                          job->width, job->height,
+                          planar_row_evolvers[job->strategy - 1], rng);
+    }
+    return pool ? generate_image_wavefront(job->width, job->height,
+                                           row_evolvers[job->strategy - 1],
+                                           rng, pool)
+                : generate_image(job->width, job->height,
+                                 row_evolvers[job->strategy - 1], rng);
+}
+
+/**
+ * Add image to pyramid, if not NULL, and finish it, then write image to path
+ * in the format of job. On error, returns 0 and describes it in error.
+ */
+static int write_row_job_image(const Row_job *job, const char *path,
+                               const Image *image, Pyramid *pyramid,
+                               Thread_pool *pool, char *error) {
+    FILE *file;
+    int written;
+
+    if (pyramid) {
+        pyramid_add_image(pyramid, image);
+        if (!pyramid_finish(pyramid)) {
+            sprintf(error, "Failed to write pyramid files.");
+            return 0;
+        }
+    }
+    file = fopen(path, "w");
+    if (!file) {
+        sprintf(error, "Failed to open file.");
+        return 0;
+    }
+    if (job->png) {
+        write_image_PNG(file, image, pool);
+    } else if (job->ascii) {
+        write_image_P3_parallel(file, image, pool);
     } else {
-        fprintf(stderr, "Failed to open file.\n");
+        write_image_P6(file, image);
+    }
+    written = !ferror(file);
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        sprintf(error, "Failed to write file.");
+    }
+    return written;
+}
+
+/**
+ * Name of the file of member m of an ensemble written to path, for the
+ * caller to free.
+ */
+static char *ensemble_member_path(const char *path, size_t m) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(path, '.');
+    size_t stem = dot && (!slash || dot > slash) ? (size_t)(dot - path)
+                                                 : strlen(path);
+    /* A dash, the index in decimal and a terminator. */
+    char *name = malloc(strlen(path) + 3 * sizeof(m) + 2);
+
+    if (!name) {
+        fprintf(stderr, "Failed to allocate file name.\n");
         exit(1);
     }
+    memcpy(name, path, stem);
+    sprintf(name + stem, "-%lu%s", (unsigned long)m, path + stem);
+    return name;
+}
+
+/**
+ * Generate the images of an ensemble job and write each to its own file.
+ */
+static int run_ensemble_job(const Row_job *job, Thread_pool *pool,
+                            char *error) {
+    Rng *rngs = malloc(job->n_members * sizeof(*rngs));
+    Pyramid *pyramid = NULL;
+    Image **images;
+    char *path;
+    size_t m;
+    int written = 1;
+
+    if (!rngs) {
+        fprintf(stderr, "Failed to allocate ensemble.\n");
+        exit(1);
+    }
+    for (m = 0; m < job->n_members; ++m) {
+        rng_init(rngs + m, job->seed + m);
+    }
+    images = generate_ensemble(job->width, job->height,
+                               ensemble_row_evolvers[job->strategy - 1], rngs,
+                               job->n_members);
+    if (!images) {
+        free(rngs);
+        sprintf(error, "Failed to allocate image.");
+        return 0;
+    }
+    for (m = 0; m < job->n_members && written; ++m) {
+        path = ensemble_member_path(job->path, m);
+        if (job->n_levels > 0) {
+            pyramid = pyramid_create(path, job->width, job->height,
+                                     job->n_levels);
+            if (!pyramid) {
+                sprintf(error, "Failed to open pyramid files.");
+                written = 0;
+            }
+        }
+        if (written) {
+            written = write_row_job_image(job, path, images[m], pyramid, pool,
+                                          error);
+        }
+        free(path);
+    }
+    for (m = 0; m < job->n_members; ++m) {
+        free_image(images[m]);
+    }
+    free(images);
+    free(rngs);
+    return written;
+}
+
+int run_row_job(const Row_job *job, Thread_pool *pool, char *error) {
+    Pyramid *pyramid = NULL;
+    Image *image;
+    Rng rng;
+    FILE *file;
+    int written;
+
+    if (job->n_members > 0) {
+        return run_ensemble_job(job, pool, error);
+    }
+    rng_init(&rng, job->seed);
+    if (job->n_levels > 0) {
+        pyramid = pyramid_create(job->path, job->width, job->height,
+                                 job->n_levels);
+        if (!pyramid) {
+            sprintf(error, "Failed to open pyramid files.");
+            return 0;
+        }
+    }
+    if (job->stream) {
+        /* Rows go to the file as they are generated: no image in memory. */
+        file = fopen(job->path, "w");
+        if (!file) {
+            if (pyramid) {
+                pyramid_finish(pyramid);
+            }
+            sprintf(error, "Failed to open file.");
+            return 0;
+        }
+        if (job->planar) {
+            written = stream_planar_image(
+                file, job->width, job->height,
+                planar_row_evolvers[job->strategy - 1], &rng, pyramid);
+        } else {
+            written = stream_image(file, job->width, job->height,
+                                   row_evolvers[job->strategy - 1], &rng,
+                                   pyramid);
+        }
+        written = fclose(file) == 0 && written;
+        if (pyramid) {
+            written = pyramid_finish(pyramid) && written;
+        }
+        if (!written) {
+            sprintf(error, "Failed to write file.");
+        }
+        return written;
+    }
+    /* Rows are generated, and encoded, on all threads of pool. */
+    image = generate_row_job(job, &rng, pool);
+    if (!image) {
+        if (pyramid) {
+            pyramid_finish(pyramid);
+        }
+        sprintf(error, "Failed to allocate image.");
+        return 0;
+    }
+    written = write_row_job_image(job, job->path, image, pyramid, pool, error);
     free_image(image);
+    return written;
 }
@@ -1,60 +1,204 @@
 #ifndef EVOLVE_ROW_H
 #define EVOLVE_ROW_H
+#include <stdio.h>
 #include "image.h"
+#include "pyramid.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+/*
+ * Row evolvers are expanded from the rule descriptions in rule.h.
+ *
+ * Row evolvers take the random bytes for the destination row as two rows of
+ * pixels, choice_row and noise_row, filled by the caller from the RNG_CHOICE
+ * and RNG_NOISE streams (see rng.h and rule.h).
+ */
 
 /**
  * Evolve row dst_row based on src_row.
  */
 void evolve_row_single_parent(Pixel *dst_row, const Pixel *src_row,
-                              const size_t size);
+                              const size_t size, const Pixel *choice_row,
+                              const Pixel *noise_row);
 
 /**
  * Evolve row dst_row based on src_row using the mom + dad genetic approach.
  */
 void evolve_row_dad_mom_genes(Pixel *dst_row, const Pixel *src_row,
-                              const size_t size);
+                              const size_t size, const Pixel *choice_row,
+                              const Pixel *noise_row);
 
 /**
  * Evolve row dst_row based on src_row using the mom + dad random choice
  * approach.
  */
 void evolve_row_dad_or_mom(Pixel *dst_row, const Pixel *src_row,
-                           const size_t size);
+                           const size_t size, const Pixel *choice_row,
+                           const Pixel *noise_row);
 
 /**
  * Evolve row dst_row based on src_row using the three parent approach.
  */
 void evolve_row_3_parent_genes(Pixel *dst_row, const Pixel *src_row,
-                               const size_t size);
+                               const size_t size, const Pixel *choice_row,
+                               const Pixel *noise_row);
 
 /**
  * Evolve row dst_row based on src_row using the mom + dad averaged approach.
  */
 void evolve_row_dad_mom_average(Pixel *dst_row, const Pixel *src_row,
-                                const size_t size);
+                                const size_t size, const Pixel *choice_row,
+                                const Pixel *noise_row);
 
 /**
  * Evolve row dst_row based on src_row using the mom + dad averaged approach,
  * with dad now above.
  */
 void evolve_row_dad_mom_dad_above(Pixel *dst_row, const Pixel *src_row,
-                                  const size_t size);
+                                  const size_t size, const Pixel *choice_row,
+                                  const Pixel *noise_row);
+
+/**
+ * Evolve row dst_row based on src_row by copying the brightest of the three
+ * parents above, jittered.
+ */
+void evolve_row_3_parent_bright(Pixel *dst_row, const Pixel *src_row,
+                                const size_t size, const Pixel *choice_row,
+                                const Pixel *noise_row);
 
 /**
  * Function pointer for a row evolver.
  */
-typedef void (*Row_evolver)(Pixel *, const Pixel *, size_t);
+typedef void (*Row_evolver)(Pixel *, const Pixel *, size_t, const Pixel *,
+                            const Pixel *);
+
+/*
+ * Planar versions of the row evolvers above: same strategies and output, on
+ * rows of a planar image (see evolve_plane.h).
+ */
+
+void evolve_row_planar_single_parent(const Planes *dst_row,
+                                     const Planes *src_row, const size_t size,
+                                     const Planes *choice_row,
+                                     const Planes *noise_row);
+
+void evolve_row_planar_dad_mom_genes(const Planes *dst_row,
+                                     const Planes *src_row, const size_t size,
+                                     const Planes *choice_row,
+                                     const Planes *noise_row);
+
+void evolve_row_planar_dad_or_mom(const Planes *dst_row,
+                                  const Planes *src_row, const size_t size,
+                                  const Planes *choice_row,
+                                  const Planes *noise_row);
+
+void evolve_row_planar_3_parent_genes(const Planes *dst_row,
+                                      const Planes *src_row,
+                                      const size_t size,
+                                      const Planes *choice_row,
+                                      const Planes *noise_row);
+
+void evolve_row_planar_dad_mom_average(const Planes *dst_row,
+                                       const Planes *src_row,
+                                       const size_t size,
+                                       const Planes *choice_row,
+                                       const Planes *noise_row);
+
+void evolve_row_planar_dad_mom_dad_above(const Planes *dst_row,
+                                         const Planes *src_row,
+                                         const size_t size,
+                                         const Planes *choice_row,
+                                         const Planes *noise_row);
+
+void evolve_row_planar_3_parent_bright(const Planes *dst_row,
+                                       const Planes *src_row,
+                                       const size_t size,
+                                       const Planes *choice_row,
+                                       const Planes *noise_row);
+
+/**
+ * Function pointer for a planar row evolver.
+ */
+typedef void (*Planar_row_evolver)(const Planes *, const Planes *, size_t,
+                                   const Planes *, const Planes *);
 
 /**
  * Generate image of required width and height in pixels using the supplied
- * row_evolver (function pointer).
- * Caller responsible for freeing image memory.
+ * row_evolver (function pointer), drawing random bytes from rng.
+ * Caller responsible for freeing image memory. Returns NULL if the image
+ * cannot be allocated.
+ */
+Image *generate_image(size_t width, size_t height, Row_evolver row_evolver,
+                      const Rng *rng);
+
+/**
+ * Same as generate_image, for a planar image and row evolver.
+ */
+Image *generate_planar_image(size_t width, size_t height,
+                             Planar_row_evolver row_evolver, const Rng *rng);
+
+/**
+ * Generate an image as generate_image does, but write it to file as a binary
+ * PPM row by row as it goes, keeping only two rows in memory, and add every
+ * row to pyramid if not NULL. Returns nonzero on success, zero if writing to
+ * file failed.
+ */
+int stream_image(FILE *file, size_t width, size_t height,
+                 Row_evolver row_evolver, const Rng *rng, Pyramid *pyramid);
+
+/**
+ * Same as stream_image, with planar rows.
+ */
+int stream_planar_image(FILE *file, size_t width, size_t height,
+                        Planar_row_evolver row_evolver, const Rng *rng,
+                        Pyramid *pyramid);
+
+/**
+ * One image for main_row to make, as described by its arguments.
+ */
+typedef struct Row_job {
+    size_t width;
+    size_t height;
+    /* Index of the row evolver, 1 to 7 (see print_row_job_usage). */
+    int strategy;
+    /* File to write; PNG if its name ends in .png, else PPM. */
+    const char *path;
+    unsigned long seed;
+    int planar;
+    /* Nonzero to write rows as they are generated (see stream_image). */
+    int stream;
+    /* Nonzero to write a plain-text (P3) PPM. */
+    int ascii;
+    int png;
+    /* Levels of the pyramid to write along with the image (see pyramid.h). */
+    int n_levels;
+    /*
+     * Images of an ensemble (see ensemble.h), seeded seed, seed + 1, ... and
+     * written to path with the member's index before the extension:
+     * image-0.png, image-1.png, ... for image.png. 0 for a single image.
+     */
+    size_t n_members;
+} Row_job;
+
+/* Bytes for the error messages of parse_row_job and run_row_job. */
+#define ROW_JOB_ERROR_LENGTH 128
+
+/**
+ * Print what parse_row_job accepts: arguments, options and strategies.
+ */
+void print_row_job_usage(FILE *file);
+
+/**
+ * Parse the argc words of argv (width, height, strategy index and file name,
+ * with options anywhere among them) into job, which points into argv. On
+ * error, returns 0 and describes it in error, on one line.
  */
-Image *generate_image(size_t width, size_t height, Row_evolver row_evolver);
+int parse_row_job(Row_job *job, int argc, char *argv[], char *error);
 
 /**
- * Command line interface to image generation.
+ * Generate and write the image of job, on the threads of pool, or serially
+ * if pool is NULL. On error, returns 0 and describes it in error.
  */
-void main_row_generation(int argc, char *argv[]);
+int run_row_job(const Row_job *job, Thread_pool *pool, char *error);
 
 #endif /* EVOLVE_ROW_H */
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "frame_alloc.h"
+
+/* Buffers at least this big are mapped by themselves, in whole huge pages. */
+#define HUGE_PAGE_BYTES (2UL << 20)
+/* Released buffers kept for reuse. */
+#define POOL_BUFFERS 16
+
+/*
+ * Every buffer is preceded by its header, padded to FRAME_ALIGN bytes so that
+ * the buffer stays aligned.
+ */
+typedef struct Buffer_header {
+    size_t bytes;
+    /* Bytes mapped, header included, or 0 if from posix_memalign. */
+    size_t mapped;
+    int hugetlb;
+} Buffer_header;
+#define HEADER_BYTES FRAME_ALIGN
+
+typedef struct Frame_alloc_state {
+    void *pool[POOL_BUFFERS];
+    size_t n_pooled;
+    Frame_alloc_stats stats;
+} Frame_alloc_state;
+
+/* Guards current_pages and state. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Frame_pages current_pages = FRAME_PAGES_TRANSPARENT;
+static Frame_alloc_state state;
+
+static Buffer_header *header_of(void *buffer) {
+    return (Buffer_header *)((unsigned char *)buffer - HEADER_BYTES);
+}
+
+/**
+ * Map total bytes for a buffer with pages. NULL if mapping is not possible
+ * here, or failed.
+ */
+static Buffer_header *map_buffer(size_t total, Frame_pages pages) {
+#ifdef __linux__
+    size_t mapped = (total + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES *
+                    HUGE_PAGE_BYTES;
+    Buffer_header *header;
+    void *map = MAP_FAILED;
+    int hugetlb = 0;
+
+#ifdef MAP_HUGETLB
+    if (pages == FRAME_PAGES_HUGETLB) {
+        map = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugetlb = map != MAP_FAILED;
+    }
+#endif
+    if (map == MAP_FAILED) {
+        map = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        /* A hint: fails harmlessly where transparent huge pages are off. */
+        if (pages != FRAME_PAGES_SMALL) {
+            madvise(map, mapped, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    header = map;
+    header->mapped = mapped;
+    header->hugetlb = hugetlb;
+    return header;
+#else
+    (void)total;
+    (void)pages;
+    return NULL;
+#endif
+}
+
+/**
+ * New buffer of bytes bytes from the system. Called without lock held.
+ */
+static void *allocate(size_t bytes, Frame_pages pages) {
+    size_t total = bytes + HEADER_BYTES;
+    Buffer_header *header = NULL;
+    void *memory;
+
+    if (total >= HUGE_PAGE_BYTES && pages != FRAME_PAGES_SMALL) {
+        header = map_buffer(total, pages);
+    }
+    if (!header) {
+        if (posix_memalign(&memory, FRAME_ALIGN, total)) {
+            return NULL;
+        }
+        header = memory;
+        header->mapped = 0;
+        header->hugetlb = 0;
+    }
+    header->bytes = bytes;
+    return (unsigned char *)header + HEADER_BYTES;
+}
+
+static void release(void *buffer) {
+    Buffer_header *header = header_of(buffer);
+#ifdef __linux__
+    if (header->mapped) {
+        munmap(header, header->mapped);
+        return;
+    }
+#endif
+    free(header);
+}
+
+void frame_alloc_set_pages(Frame_pages pages) {
+    pthread_mutex_lock(&lock);
+    current_pages = pages;
+    pthread_mutex_unlock(&lock);
+}
+
+void *frame_buffer_get(size_t bytes) {
+    void *buffer = NULL;
+    Frame_pages buffer_pages;
+    size_t i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < state.n_pooled; ++i) {
+        if (header_of(state.pool[i])->bytes == bytes) {
+            buffer = state.pool[i];
+            state.pool[i] = state.pool[--state.n_pooled];
+            ++state.stats.n_reused;
+            break;
+        }
+    }
+    buffer_pages = current_pages;
+    pthread_mutex_unlock(&lock);
+    if (buffer) {
+        return buffer;
+    }
+
+    buffer = allocate(bytes, buffer_pages);
+    if (buffer) {
+        pthread_mutex_lock(&lock);
+        ++state.stats.n_allocated;
+        state.stats.bytes_allocated += bytes;
+        state.stats.n_hugetlb += (size_t)header_of(buffer)->hugetlb;
+        pthread_mutex_unlock(&lock);
+    }
+    return buffer;
+}
+
+void frame_buffer_put(void *buffer) {
+    if (!buffer) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (state.n_pooled < POOL_BUFFERS) {
+        state.pool[state.n_pooled++] = buffer;
+        buffer = NULL;
+    } else {
+        ++state.stats.n_released;
+    }
+    pthread_mutex_unlock(&lock);
+    if (buffer) {
+        release(buffer);
+    }
+}
+
+void frame_pool_trim(void) {
+    void *pooled[POOL_BUFFERS];
+    size_t n, i;
+
+    pthread_mutex_lock(&lock);
+    n = state.n_pooled;
+    for (i = 0; i < n; ++i) {
+        pooled[i] = state.pool[i];
+    }
+    state.n_pooled = 0;
+    state.stats.n_released += n;
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < n; ++i) {
+        release(pooled[i]);
+    }
+}
+
+void frame_alloc_stats(Frame_alloc_stats *stats) {
+    struct rusage usage;
+
+    pthread_mutex_lock(&lock);
+    *stats = state.stats;
+    pthread_mutex_unlock(&lock);
+    stats->minor_faults = stats->major_faults = 0;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stats->minor_faults = usage.ru_minflt;
+        stats->major_faults = usage.ru_majflt;
+    }
+}
+
+void frame_alloc_report(FILE *file) {
+    Frame_alloc_stats stats;
+
+    frame_alloc_stats(&stats);
+    fprintf(file,
+            "Frame buffers: %lu allocated (%.1f MB, %lu on reserved huge"
+            " pages), %lu reused, %lu released; page faults: %ld minor,"
+            " %ld major.\n",
+            (unsigned long)stats.n_allocated,
+            (double)stats.bytes_allocated / (1 << 20),
+            (unsigned long)stats.n_hugetlb, (unsigned long)stats.n_reused,
+            (unsigned long)stats.n_released, stats.minor_faults,
+            stats.major_faults);
+}
@@ -0,0 +1,75 @@
+#ifndef FRAME_ALLOC_H
+#define FRAME_ALLOC_H
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Memory for frame pixels. Buffers are aligned to FRAME_ALIGN bytes, big ones
+ * are mapped directly so that they can be backed by huge pages, and released
+ * buffers are pooled and handed out again for requests of the same size, so
+ * that code allocating a frame per frame (or per run) does not pay for fresh
+ * pages, and their page faults, every time.
+ *
+ * All functions may be called from any thread.
+ */
+
+/* Alignment of buffers, and of the rows of halo images (see image.h). */
+#define FRAME_ALIGN 64
+
+typedef enum Frame_pages {
+    /* Ordinary pages. */
+    FRAME_PAGES_SMALL,
+    /* Transparent huge pages where the kernel has them (the default). */
+    FRAME_PAGES_TRANSPARENT,
+    /*
+     * Reserved huge pages (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages),
+     * falling back to transparent ones when none are free.
+     */
+    FRAME_PAGES_HUGETLB
+} Frame_pages;
+
+/**
+ * Back buffers allocated from now on with pages.
+ */
+void frame_alloc_set_pages(Frame_pages pages);
+
+/**
+ * Buffer of bytes bytes aligned to FRAME_ALIGN, reused from the pool if one of
+ * that size was released. Contents are undefined. NULL if out of memory.
+ */
+void *frame_buffer_get(size_t bytes);
+
+/**
+ * Release buffer (from frame_buffer_get, may be NULL) to the pool, or to the
+ * system if the pool is full.
+ */
+void frame_buffer_put(void *buffer);
+
+/**
+ * Release every pooled buffer to the system.
+ */
+void frame_pool_trim(void);
+
+typedef struct Frame_alloc_stats {
+    /* Buffers obtained from the system, and their bytes. */
+    size_t n_allocated;
+    size_t bytes_allocated;
+    /* Of those, buffers on reserved huge pages. */
+    size_t n_hugetlb;
+    /* Requests served from the pool. */
+    size_t n_reused;
+    /* Buffers given back to the system. */
+    size_t n_released;
+    /* Page faults of the whole process so far. */
+    long minor_faults;
+    long major_faults;
+} Frame_alloc_stats;
+
+void frame_alloc_stats(Frame_alloc_stats *stats);
+
+/**
+ * Print frame_alloc_stats on one line.
+ */
+void frame_alloc_report(FILE *file);
+
+#endif /* FRAME_ALLOC_H */
@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "frame_queue.h"
+
+struct Frame_queue {
+    Image **buffers;
+    size_t n_buffers;
+    /* Holds on each buffer: producer and/or writer. 0 means free. */
+    int *holds;
+
+    /* Pushed frames not yet taken by a writer, oldest first. */
+    Image **pending;
+    size_t *pending_frame;
+    /* Position of each in push order, which ordered writes follow. */
+    size_t *pending_turn;
+    size_t first_pending;
+    size_t n_pending;
+
+    pthread_t *writers;
+    size_t n_writers;
+    Frame_writer writer;
+    void *arg;
+    int ordered;
+    /* Turn of the next frame to be written, if ordered. */
+    size_t next_written;
+    int closing;
+
+    pthread_mutex_t lock;
+    /* Signalled when a buffer becomes free. */
+    pthread_cond_t buffer_freed;
+    /* Signalled when a frame is pushed or the queue closes. */
+    pthread_cond_t frame_pushed;
+    /* Signalled when a frame has been written, if ordered. */
+    pthread_cond_t frame_written;
+
+    /* Statistics, protected by lock. */
+    size_t n_frames;
+    size_t max_depth;
+    size_t depth_sum;
+    double producer_wait;
+    double writer_wait;
+};
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + 1e-9 * (double)time.tv_nsec;
+}
+
+static size_t buffer_index(const Frame_queue *queue, const Image *image) {
+    size_t i;
+    for (i = 0; i < queue->n_buffers; ++i) {
+        if (queue->buffers[i] == image) {
+            return i;
+        }
+    }
+    fprintf(stderr, "Image is not a buffer of this frame queue.\n");
+    exit(1);
+}
+
+/**
+ * Drop one hold on buffer i. Called with lock held.
+ */
+static void drop_hold(Frame_queue *queue, size_t i) {
+    if (--queue->holds[i] == 0) {
+        pthread_cond_signal(&queue->buffer_freed);
+    }
+}
+
+static void *writer_main(void *arg) {
+    Frame_queue *queue = arg;
+    Image *image;
+    size_t frame, turn;
+    double wait_start;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        wait_start = now();
+        while (queue->n_pending == 0 && !queue->closing) {
+            pthread_cond_wait(&queue->frame_pushed, &queue->lock);
+        }
+        queue->writer_wait += now() - wait_start;
+        if (queue->n_pending == 0) {
+            break;
+        }
+        image = queue->pending[queue->first_pending];
+        frame = queue->pending_frame[queue->first_pending];
+        turn = queue->pending_turn[queue->first_pending];
+        queue->first_pending = (queue->first_pending + 1) % queue->n_buffers;
+        --queue->n_pending;
+
+        /* Frames are taken in order, so the earliest one is always held. */
+        while (queue->ordered && queue->next_written != turn) {
+            pthread_cond_wait(&queue->frame_written, &queue->lock);
+        }
+        pthread_mutex_unlock(&queue->lock);
+        (*queue->writer)(queue->arg, image, frame);
+        pthread_mutex_lock(&queue->lock);
+        if (queue->ordered) {
+            ++queue->next_written;
+            pthread_cond_broadcast(&queue->frame_written);
+        }
+        drop_hold(queue, buffer_index(queue, image));
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+Frame_queue *frame_queue_create(Image **buffers, size_t n_buffers,
+                                size_t n_writers, Frame_writer writer,
+                                void *arg, int ordered) {
+    Frame_queue *queue;
+    size_t i;
+
+    if (n_buffers < 2 || n_writers == 0) {
+        return NULL;
+    }
+    queue = malloc(sizeof(*queue));
+    if (!queue) {
+        return NULL;
+    }
+    queue->buffers = buffers;
+    queue->n_buffers = n_buffers;
+    queue->holds = calloc(n_buffers, sizeof(*queue->holds));
+    queue->pending = malloc(n_buffers * sizeof(*queue->pending));
+    queue->pending_frame = malloc(n_buffers * sizeof(*queue->pending_frame));
+    queue->pending_turn = malloc(n_buffers * sizeof(*queue->pending_turn));
+    queue->writers = malloc(n_writers * sizeof(*queue->writers));
+    if (!queue->holds || !queue->pending || !queue->pending_frame ||
+        !queue->pending_turn || !queue->writers) {
+        fprintf(stderr, "Failed to allocate frame queue.\n");
+        exit(1);
+    }
+    queue->first_pending = queue->n_pending = 0;
+    queue->n_writers = n_writers;
+    queue->writer = writer;
+    queue->arg = arg;
+    queue->ordered = ordered;
+    queue->next_written = 0;
+    queue->closing = 0;
+    queue->n_frames = queue->max_depth = queue->depth_sum = 0;
+    queue->producer_wait = queue->writer_wait = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->buffer_freed, NULL);
+    pthread_cond_init(&queue->frame_pushed, NULL);
+    pthread_cond_init(&queue->frame_written, NULL);
+
+    for (i = 0; i < n_writers; ++i) {
+        if (pthread_create(queue->writers + i, NULL, &writer_main, queue)) {
+            fprintf(stderr, "Failed to start writer thread.\n");
+            exit(1);
+        }
+    }
+    return queue;
+}
+
+Image *frame_queue_acquire(Frame_queue *queue) {
+    size_t i;
+    double wait_start;
+
+    pthread_mutex_lock(&queue->lock);
+    wait_start = now();
+    for (;;) {
+        for (i = 0; i < queue->n_buffers; ++i) {
+            if (queue->holds[i] == 0) {
+                break;
+            }
+        }
+        if (i < queue->n_buffers) {
+            break;
+        }
+        pthread_cond_wait(&queue->buffer_freed, &queue->lock);
+    }
+    queue->producer_wait += now() - wait_start;
+    queue->holds[i] = 1;
+    pthread_mutex_unlock(&queue->lock);
+    return queue->buffers[i];
+}
+
+void frame_queue_push(Frame_queue *queue, Image *image, size_t frame) {
+    size_t last;
+
+    pthread_mutex_lock(&queue->lock);
+    ++queue->holds[buffer_index(queue, image)];
+    /* At most n_buffers frames can be pending, one per buffer. */
+    last = (queue->first_pending + queue->n_pending) % queue->n_buffers;
+    queue->pending[last] = image;
+    queue->pending_frame[last] = frame;
+    queue->pending_turn[last] = queue->n_frames;
+    ++queue->n_pending;
+    ++queue->n_frames;
+    queue->depth_sum += queue->n_pending;
+    if (queue->n_pending > queue->max_depth) {
+        queue->max_depth = queue->n_pending;
+    }
+    pthread_cond_signal(&queue->frame_pushed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void frame_queue_release(Frame_queue *queue, Image *image) {
+    pthread_mutex_lock(&queue->lock);
+    drop_hold(queue, buffer_index(queue, image));
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void frame_queue_finish(Frame_queue *queue, Frame_queue_stats *stats) {
+    size_t i;
+
+    pthread_mutex_lock(&queue->lock);
+    queue->closing = 1;
+    pthread_cond_broadcast(&queue->frame_pushed);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (i = 0; i < queue->n_writers; ++i) {
+        pthread_join(queue->writers[i], NULL);
+    }
+    if (stats) {
+        stats->n_frames = queue->n_frames;
+        stats->n_buffers = queue->n_buffers;
+        stats->max_depth = queue->max_depth;
+        stats->mean_depth = queue->n_frames
+            ? (double)queue->depth_sum / (double)queue->n_frames : 0;
+        stats->producer_wait = queue->producer_wait;
+        stats->writer_wait = queue->writer_wait;
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->buffer_freed);
+    pthread_cond_destroy(&queue->frame_pushed);
+    pthread_cond_destroy(&queue->frame_written);
+    free(queue->holds);
+    free(queue->pending);
+    free(queue->pending_frame);
+    free(queue->pending_turn);
+    free(queue->writers);
+    free(queue);
+}
@@ -0,0 +1,70 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+#include <stddef.h>
+#include "image.h"
+
+/**
+ * Bounded queue handing finished frames from a producer to writer threads.
+ *
+ * Frames live in a fixed set of caller-allocated buffers that are recycled:
+ * the producer acquires a free buffer, fills it and pushes it, and it becomes
+ * free again once the writer is done with it and the producer has released
+ * it (the producer usually still needs it as the source of the next frame).
+ * When every buffer is in use, acquiring blocks, which throttles the
+ * producer to the speed of the writers.
+ */
+typedef struct Frame_queue Frame_queue;
+
+/**
+ * Writer function: called on a writer thread once for every pushed frame.
+ */
+typedef void (*Frame_writer)(void *arg, const Image *image, size_t frame);
+
+/**
+ * How full the queue ran and who waited for whom.
+ */
+typedef struct Frame_queue_stats {
+    size_t n_frames;
+    size_t n_buffers;
+    /* Frames pushed but not yet taken by a writer, right after each push. */
+    size_t max_depth;
+    double mean_depth;
+    /* Seconds the producer spent blocked waiting for a free buffer. */
+    double producer_wait;
+    /* Seconds writers spent idle waiting for frames, summed over writers. */
+    double writer_wait;
+} Frame_queue_stats;
+
+/**
+ * Create queue over n_buffers (at least 2) frame buffers and start n_writers
+ * threads calling writer. If ordered, frames are written strictly in the
+ * order they were pushed even with several writers; otherwise writers may
+ * overlap.
+ */
+Frame_queue *frame_queue_create(Image **buffers, size_t n_buffers,
+                                size_t n_writers, Frame_writer writer,
+                                void *arg, int ordered);
+
+/**
+ * Take a free buffer, waiting while none is free.
+ */
+Image *frame_queue_acquire(Frame_queue *queue);
+
+/**
+ * Hand acquired buffer image, holding frame number frame, to the writers.
+ * The producer keeps its hold on it until frame_queue_release.
+ */
+void frame_queue_push(Frame_queue *queue, Image *image, size_t frame);
+
+/**
+ * Drop the producer's hold on an acquired buffer.
+ */
+void frame_queue_release(Frame_queue *queue, Image *image);
+
+/**
+ * Wait for all pushed frames to be written, stop the writers, fill stats
+ * (if not NULL) and free queue. Buffers stay owned by the caller.
+ */
+void frame_queue_finish(Frame_queue *queue, Frame_queue_stats *stats);
+
+#endif /* FRAME_QUEUE_H */
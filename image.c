@@ -1,14 +1,19 @@
 #include "image.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "deflate.h"
+#include "frame_alloc.h"
+#include "rng.h"
+#include "simd.h"
+#include "trace.h"
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 #define COLOR_RANGE 255
-
-void set_random_pixel(Pixel *pixel) {
-    pixel->r = (unsigned char)rand() % (COLOR_RANGE + 1);
-    pixel->g = (unsigned char)rand() % (COLOR_RANGE + 1);
-    pixel->b = (unsigned char)rand() % (COLOR_RANGE + 1);
-}
+/* n rounded up to a multiple of m. */
+#define ROUND_UP(n, m) (((n) + (m) - 1) / (m) * (m))
 
 void print_pixel(const Pixel *pixel) {
     printf("%-3d %-3d %-3d\t", pixel->r, pixel->g, pixel->b);
@@ -24,91 +29,895 @@ void write_pixel(FILE *file, const Pixel *pixel) {
  */
 Pixel *pixel_at(const Image *image, size_t x, size_t y) {
     /* Need to check bounds */
-    if (x < image->width && y < image->height) {
-        return image->pixels + (image->width) * y + x;
+    if (x < image->width && y < image->height && !image->planar) {
+        return image->pixels + (image->stride) * y + x;
     } else {
         fprintf(stderr,
-                "Can't access pixel at (%lu, %lu) in %lu x %lu image.\n",
-                x, y, image->width, image->height);
+                "Can't access pixel at (%lu, %lu) in %lu x %lu image%s.\n",
+                x, y, image->width, image->height,
+                image->planar ? " (planar)" : "");
         exit(1);
     }
 }
 
-void set_random_row(Pixel *row, size_t width) {
-    size_t i;
-    for (i = 0; i < width; ++i) {
-        set_random_pixel(row + i);
+void set_random_row(Pixel *row, size_t width, const Rng *rng,
+                    size_t frame, size_t y) {
+    rng_fill_row(rng, frame, y, RNG_INIT, row, 0, width);
+}
+
+void interleave_planes(Pixel *dst, const unsigned char *r,
+                       const unsigned char *g, const unsigned char *b,
+                       size_t n) {
+    size_t i = 0;
+#ifdef __SSSE3__
+    /*
+     * 16 pixels at a time: output byte k of the 48 is channel k % 3 of pixel
+     * k / 3, so each 16-byte output vector is three byte shuffles of the
+     * planes, with 0x80 (zero) where the byte comes from another channel.
+     */
+    __m128i shuffles[3][3];
+    unsigned char indices[16];
+    int v, channel, k;
+
+    for (v = 0; v < 3; ++v) {
+        for (channel = 0; channel < 3; ++channel) {
+            for (k = 0; k < 16; ++k) {
+                int byte = 16 * v + k;
+                indices[k] = (unsigned char)
+                    (byte % 3 == channel ? byte / 3 : 0x80);
+            }
+            shuffles[v][channel] =
+                _mm_loadu_si128((const __m128i *)(const void *)indices);
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m128i rv = _mm_loadu_si128((const __m128i *)(const void *)(r + i));
+        __m128i gv = _mm_loadu_si128((const __m128i *)(const void *)(g + i));
+        __m128i bv = _mm_loadu_si128((const __m128i *)(const void *)(b + i));
+        for (v = 0; v < 3; ++v) {
+            __m128i out = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(rv, shuffles[v][0]),
+                             _mm_shuffle_epi8(gv, shuffles[v][1])),
+                _mm_shuffle_epi8(bv, shuffles[v][2]));
+            _mm_storeu_si128((__m128i *)(void *)((unsigned char *)(dst + i) +
+                                                 16 * v), out);
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i].r = r[i];
+        dst[i].g = g[i];
+        dst[i].b = b[i];
+    }
+}
+
+size_t image_frame_row(const Image *image, size_t y) {
+    return (image->band_top + y) % image->frame_height;
+}
+
+Planes planes_row(const Image *image, size_t y) {
+    Planes row;
+    int channel;
+    for (channel = 0; channel < 3; ++channel) {
+        row.channel[channel] = image->planes.channel[channel] +
+                               y * image->stride;
+    }
+    return row;
+}
+
+void split_planes(Planes *row, unsigned char *bytes, size_t width) {
+    int channel;
+    for (channel = 0; channel < 3; ++channel) {
+        row->channel[channel] = bytes + channel * width;
     }
 }
 
+/**
+ * Row y of image as interleaved pixels: the row itself, or for planar images
+ * buffer (width pixels) with the row interleaved into it.
+ */
+static const Pixel *interleaved_row(const Image *image, size_t y,
+                                    Pixel *buffer) {
+    Planes row;
+    if (!image->planar) {
+        return image->pixels + y * image->stride;
+    }
+    row = planes_row(image, y);
+    interleave_planes(buffer, row.channel[0], row.channel[1], row.channel[2],
+                      image->width);
+    return buffer;
+}
+
 /**
  * Print image.
  */
 void print_image(const Image *image) {
-    size_t i, j;
+    write_image_P3(stdout, image);
+}
 
-    /* Print PPM header. */
-    printf("P3\n%lu %lu\n%d\n", image->width, image->height, COLOR_RANGE);
+void write_image_P3(FILE *file, const Image *image) {
+    write_image_P3_parallel(file, image, NULL);
+}
 
-    for (j = 0; j < image->height; ++j) {
-        for (i = 0; i < image->width; ++i) {
-            print_pixel(image->pixels + j * image->width + i);
+/*
+ * P3 output is formatted a batch of rows at a time into one buffer, which is
+ * written with a single fwrite. Every pixel is "%-3d %-3d %-3d\t", which is
+ * always P3_PIXEL_BYTES bytes, so row y of a batch starts at a known offset
+ * and rows can be formatted independently.
+ */
+#define P3_PIXEL_BYTES 12
+/* Rows per batch are chosen to fill about this many bytes. */
+#define P3_BATCH_BYTES (1 << 22)
+/* Tasks per thread when formatting a batch in parallel. */
+#define P3_TASKS_PER_THREAD 4
+
+typedef struct P3_batch {
+    const Image *image;
+    /* Decimal digits of every byte value, left-justified, space padded. */
+    char digits[256][3];
+    char *buffer;
+    size_t first_row;
+    size_t n_rows;
+    size_t rows_per_task;
+} P3_batch;
+
+/**
+ * First byte of each channel of row y, and the distance between pixels.
+ */
+static size_t row_channels(const Image *image, size_t y,
+                           const unsigned char *channel[3]) {
+    int c;
+    if (image->planar) {
+        for (c = 0; c < 3; ++c) {
+            channel[c] = image->planes.channel[c] + y * image->stride;
         }
-        printf("\n");
+        return 1;
+    }
+    for (c = 0; c < 3; ++c) {
+        channel[c] = (const unsigned char *)(image->pixels +
+                                             y * image->stride) + c;
     }
+    return 3;
 }
 
-void write_image_P3(FILE *file, const Image *image) {
-    size_t i, j;
+static void format_rows_P3(void *arg, size_t task) {
+    const P3_batch *batch = arg;
+    size_t row_bytes = P3_PIXEL_BYTES * batch->image->width + 1;
+    size_t first = task * batch->rows_per_task;
+    size_t last = first + batch->rows_per_task;
+    size_t i, j, k, step;
+    const unsigned char *channel[3];
+    char *out;
+
+    if (last > batch->n_rows) {
+        last = batch->n_rows;
+    }
+    out = batch->buffer + first * row_bytes;
+    for (j = first; j < last; ++j) {
+        step = row_channels(batch->image, batch->first_row + j, channel);
+        for (i = 0, k = 0; i < batch->image->width; ++i, k += step) {
+            memcpy(out, batch->digits[channel[0][k]], 3);
+            out[3] = ' ';
+            memcpy(out + 4, batch->digits[channel[1][k]], 3);
+            out[7] = ' ';
+            memcpy(out + 8, batch->digits[channel[2][k]], 3);
+            out[11] = '\t';
+            out += P3_PIXEL_BYTES;
+        }
+        *out++ = '\n';
+    }
+}
+
+void write_image_P3_parallel(FILE *file, const Image *image,
+                             Thread_pool *pool) {
+    P3_batch batch;
+    size_t row_bytes = P3_PIXEL_BYTES * image->width + 1;
+    size_t rows_per_batch = P3_BATCH_BYTES / row_bytes;
+    size_t n_tasks;
+    int value;
 
     /* Print PPM header. */
-    fprintf(file, "P3\n%lu %lu\n%d\n", image->width, image->height, COLOR_RANGE);
+    fprintf(file, "P3\n%lu %lu\n%d\n", image->width, image->height,
+            COLOR_RANGE);
 
-    for (j = 0; j < image->height; ++j) {
-        for (i = 0; i < image->width; ++i) {
-            write_pixel(file, image->pixels + j * image->width + i);
+    for (value = 0; value < 256; ++value) {
+        char text[4];
+        sprintf(text, "%-3d", value);
+        memcpy(batch.digits[value], text, 3);
+    }
+    if (rows_per_batch > image->height) {
+        rows_per_batch = image->height;
+    }
+    if (rows_per_batch == 0) {
+        rows_per_batch = 1;
+    }
+    batch.image = image;
+    batch.buffer = malloc(rows_per_batch * row_bytes);
+    if (!batch.buffer) {
+        fprintf(stderr, "Failed to allocate P3 buffer.\n");
+        exit(1);
+    }
+    for (batch.first_row = 0; batch.first_row < image->height;
+         batch.first_row += batch.n_rows) {
+        double start = trace_begin();
+        batch.n_rows = image->height - batch.first_row;
+        if (batch.n_rows > rows_per_batch) {
+            batch.n_rows = rows_per_batch;
+        }
+        if (pool) {
+            n_tasks = P3_TASKS_PER_THREAD * thread_pool_size(pool);
+            batch.rows_per_task = (batch.n_rows + n_tasks - 1) / n_tasks;
+            n_tasks = (batch.n_rows + batch.rows_per_task - 1) /
+                      batch.rows_per_task;
+            thread_pool_run(pool, &format_rows_P3, &batch, n_tasks);
+        } else {
+            batch.rows_per_task = batch.n_rows;
+            format_rows_P3(&batch, 0);
         }
-        fprintf(file, "\n");
+        trace_end(TRACE_ENCODE, start, TRACE_NO_FRAME);
+        start = trace_begin();
+        fwrite(batch.buffer, 1, batch.n_rows * row_bytes, file);
+        trace_end(TRACE_WRITE, start, TRACE_NO_FRAME);
     }
+    free(batch.buffer);
+}
+
+void write_header_P6(FILE *file, size_t width, size_t height) {
+    fprintf(file, "P6\n%lu %lu\n%d\n", width, height, COLOR_RANGE);
 }
 
 void write_image_P6(FILE *file, const Image *image) {
-    /* Print PPM header. */
-    fprintf(file, "P6\n%lu %lu\n%d\n", image->width, image->height, COLOR_RANGE);
-    fwrite(image->pixels,
-           sizeof(*(image->pixels)),
-           (image->width)*(image->height),
-           file);
+    double start = trace_begin();
+    write_header_P6(file, image->width, image->height);
+    if (image->stride == image->width && !image->planar) {
+        fwrite(image->pixels,
+               sizeof(*(image->pixels)),
+               (image->width)*(image->height),
+               file);
+    } else {
+        size_t j;
+        Pixel *buffer = malloc(image->width * sizeof(*buffer));
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate P6 row.\n");
+            exit(1);
+        }
+        for (j = 0; j < image->height; ++j) {
+            fwrite(interleaved_row(image, j, buffer),
+                   sizeof(*(image->pixels)),
+                   image->width,
+                   file);
+        }
+        free(buffer);
+    }
+    trace_end(TRACE_WRITE, start, TRACE_NO_FRAME);
 }
 
-void set_random_image(Image *image) {
-    size_t length;
+/*
+ * PNG output: every row is filtered with whichever of the five PNG filters
+ * gives the smallest sum of absolute (signed) bytes, and the filtered rows
+ * are compressed in segments of about PNG_SEGMENT_BYTES, each on its own
+ * task and written as its own IDAT chunk (see deflate_segment). Segments do
+ * not depend on the number of threads, so neither does the output.
+ */
+#define PNG_SEGMENT_BYTES (1 << 18)
+#define PNG_BYTES_PER_PIXEL 3
+
+typedef struct Png_job {
+    const Image *image;
+    size_t row_bytes;
+    size_t rows_per_segment;
+    size_t n_segments;
+    /* Filtered rows, each starting with its filter type byte. */
+    unsigned char *filtered;
+    Byte_buffer *segments;
+    uint32_t *segment_crcs;
+} Png_job;
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+/**
+ * Apply PNG filter type to n bytes of row (prev is the row above, NULL for
+ * the first row) into dst, and return the sum of absolute (signed) output
+ * bytes, which is how well the filtered row will likely compress.
+ */
+static unsigned long filter_png(int type, unsigned char *dst,
+                                const unsigned char *row,
+                                const unsigned char *prev, size_t n) {
+    const size_t bpp = PNG_BYTES_PER_PIXEL;
+    unsigned long cost = 0;
     size_t i;
 
-    length = image->width * image->height;
+    for (i = 0; i < n; ++i) {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = prev && i >= bpp ? prev[i - bpp] : 0;
+        int predicted = 0;
+        if (type == 1) {
+            predicted = a;
+        } else if (type == 2) {
+            predicted = b;
+        } else if (type == 3) {
+            predicted = (a + b) / 2;
+        } else if (type == 4) {
+            predicted = paeth(a, b, c);
+        }
+        dst[i] = (unsigned char)(row[i] - predicted);
+        cost += dst[i] < 128 ? dst[i] : 256 - dst[i];
+    }
+    return cost;
+}
+
+/**
+ * Filter row into out[0] (filter type) and out[1..n] with whichever filter
+ * has the lowest cost, using scratch (n bytes).
+ */
+static void filter_row_png(unsigned char *out, const unsigned char *row,
+                           const unsigned char *prev, size_t n,
+                           unsigned char *scratch) {
+    unsigned long best_cost, cost;
+    int type;
 
-    for (i = 0; i < length; ++i) {
-        set_random_pixel(image->pixels + i);
+    out[0] = 0;
+    best_cost = filter_png(0, out + 1, row, prev, n);
+    for (type = 1; type < 5; ++type) {
+        /* Without a row above, Up is None and Paeth is Sub. */
+        if (!prev && (type == 2 || type == 4)) {
+            continue;
+        }
+        cost = filter_png(type, scratch, row, prev, n);
+        if (cost < best_cost) {
+            best_cost = cost;
+            out[0] = (unsigned char)type;
+            memcpy(out + 1, scratch, n);
+        }
     }
 }
 
+static uint32_t png_chunk_crc(const char type[4], const unsigned char *data,
+                              size_t n) {
+    return crc32_update(crc32_update(0, (const unsigned char *)type, 4),
+                        data, n);
+}
+
+static void put_uint32_be(unsigned char *bytes, uint32_t value) {
+    bytes[0] = (unsigned char)(value >> 24);
+    bytes[1] = (unsigned char)(value >> 16);
+    bytes[2] = (unsigned char)(value >> 8);
+    bytes[3] = (unsigned char)value;
+}
+
+static void write_png_chunk(FILE *file, const char type[4],
+                            const unsigned char *data, size_t n,
+                            uint32_t crc) {
+    unsigned char word[4];
+    put_uint32_be(word, (uint32_t)n);
+    fwrite(word, 1, 4, file);
+    fwrite(type, 1, 4, file);
+    if (n > 0) {
+        fwrite(data, 1, n, file);
+    }
+    put_uint32_be(word, crc);
+    fwrite(word, 1, 4, file);
+}
+
+static void compress_png_segment(void *arg, size_t segment) {
+    const Png_job *job = arg;
+    const Image *image = job->image;
+    size_t n = job->row_bytes - 1;
+    size_t first = segment * job->rows_per_segment;
+    size_t last = first + job->rows_per_segment;
+    Pixel *buffers[2];
+    unsigned char *scratch = malloc(n);
+    const Pixel *row, *prev;
+    Byte_buffer *out = job->segments + segment;
+    size_t j;
+
+    if (last > image->height) {
+        last = image->height;
+    }
+    buffers[0] = malloc(image->width * sizeof(*buffers[0]));
+    buffers[1] = malloc(image->width * sizeof(*buffers[1]));
+    if (!scratch || !buffers[0] || !buffers[1]) {
+        fprintf(stderr, "Failed to allocate PNG rows.\n");
+        exit(1);
+    }
+    prev = first > 0
+        ? interleaved_row(image, first - 1, buffers[(first - 1) % 2]) : NULL;
+    for (j = first; j < last; ++j) {
+        row = interleaved_row(image, j, buffers[j % 2]);
+        filter_row_png(job->filtered + j * job->row_bytes,
+                       (const unsigned char *)row,
+                       (const unsigned char *)prev, n, scratch);
+        prev = row;
+    }
+
+    if (segment == 0) {
+        /* zlib header: deflate, 32 KB window, no dictionary. */
+        static const unsigned char zlib_header[2] = {0x78, 0x01};
+        byte_buffer_append(out, zlib_header, 2);
+    }
+    deflate_segment(out, job->filtered + first * job->row_bytes,
+                    (last - first) * job->row_bytes,
+                    segment == job->n_segments - 1);
+    job->segment_crcs[segment] = png_chunk_crc("IDAT", out->data, out->size);
+    free(scratch);
+    free(buffers[0]);
+    free(buffers[1]);
+}
+
+void write_image_PNG(FILE *file, const Image *image, Thread_pool *pool) {
+    static const unsigned char signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    unsigned char header[13], adler[4];
+    Png_job job;
+    size_t segment;
+    double start = trace_begin();
+
+    job.image = image;
+    job.row_bytes = 1 + PNG_BYTES_PER_PIXEL * image->width;
+    job.rows_per_segment = PNG_SEGMENT_BYTES / job.row_bytes;
+    if (job.rows_per_segment == 0) {
+        job.rows_per_segment = 1;
+    }
+    job.n_segments = (image->height + job.rows_per_segment - 1) /
+                     job.rows_per_segment;
+    job.filtered = malloc(image->height * job.row_bytes);
+    job.segments = calloc(job.n_segments, sizeof(*job.segments));
+    job.segment_crcs = malloc(job.n_segments * sizeof(*job.segment_crcs));
+    if (!job.filtered || !job.segments || !job.segment_crcs) {
+        fprintf(stderr, "Failed to allocate PNG buffers.\n");
+        exit(1);
+    }
+
+    if (pool) {
+        thread_pool_run(pool, &compress_png_segment, &job, job.n_segments);
+    } else {
+        for (segment = 0; segment < job.n_segments; ++segment) {
+            compress_png_segment(&job, segment);
+        }
+    }
+    put_uint32_be(adler, adler32_update(1, job.filtered,
+                                        image->height * job.row_bytes));
+    trace_end(TRACE_ENCODE, start, TRACE_NO_FRAME);
+
+    start = trace_begin();
+    fwrite(signature, 1, sizeof(signature), file);
+    put_uint32_be(header, (uint32_t)image->width);
+    put_uint32_be(header + 4, (uint32_t)image->height);
+    header[8] = 8;   /* bits per channel */
+    header[9] = 2;   /* color type: RGB */
+    header[10] = 0;  /* compression: deflate */
+    header[11] = 0;  /* filtering: adaptive */
+    header[12] = 0;  /* no interlacing */
+    write_png_chunk(file, "IHDR", header, sizeof(header),
+                    png_chunk_crc("IHDR", header, sizeof(header)));
+    for (segment = 0; segment < job.n_segments; ++segment) {
+        write_png_chunk(file, "IDAT", job.segments[segment].data,
+                        job.segments[segment].size,
+                        job.segment_crcs[segment]);
+        byte_buffer_free(job.segments + segment);
+    }
+    /* zlib trailer, in an IDAT of its own. */
+    write_png_chunk(file, "IDAT", adler, 4, png_chunk_crc("IDAT", adler, 4));
+    write_png_chunk(file, "IEND", NULL, 0, png_chunk_crc("IEND", NULL, 0));
+    trace_end(TRACE_WRITE, start, TRACE_NO_FRAME);
+
+    free(job.filtered);
+    free(job.segments);
+    free(job.segment_crcs);
+}
+
+void write_header_Y4M(FILE *file, size_t width, size_t height) {
+    fprintf(file, "YUV4MPEG2 W%lu H%lu F60:1 Ip A1:1 C420jpeg\n", width,
+            height);
+}
+
+/*
+ * Y4M frames are YCbCr 4:2:0 with BT.601 limited-range coefficients scaled
+ * by 256. Each chroma sample is taken from the rounded mean of a 2x2 block,
+ * repeating the last column and row when the size is odd. The offsets keep
+ * every sum in [0, 65535], so 16-bit SIMD lanes wrapping on the way give the
+ * same result as int arithmetic.
+ */
+#define Y4M_LUMA 66, 129, 25, 4224
+#define Y4M_BLUE -38, -74, 112, 32896
+#define Y4M_RED 112, -94, -18, 32896
+/* Tasks per thread when converting a frame in parallel. */
+#define Y4M_TASKS_PER_THREAD 4
+
+typedef struct Y4m_job {
+    const Image *image;
+    /* Y plane, then Cb, then Cr. */
+    unsigned char *frame;
+    size_t chroma_width;
+    size_t chroma_height;
+    /* Chroma rows (two luma rows each) per task. */
+    size_t rows_per_task;
+} Y4m_job;
+
+static __inline__ int mix_y4m(int r, int g, int b, int kr, int kg, int kb,
+                              int offset) {
+    return (kr * r + kg * g + kb * b + offset) >> 8;
+}
+
+#ifdef SIMD
+static __inline__ Vec vec_mix_y4m(Vec r, Vec g, Vec b, int kr, int kg, int kb,
+                                  int offset) {
+    Vec sum = vec_add_u16(vec_mullo_u16(r, vec_set1_u16(kr)),
+                          vec_mullo_u16(g, vec_set1_u16(kg)));
+    sum = vec_add_u16(sum, vec_mullo_u16(b, vec_set1_u16(kb)));
+    return vec_srli_u16(vec_add_u16(sum, vec_set1_u16(offset)), 8);
+}
+
+/**
+ * Sums of adjacent pairs of bytes, in u16 lanes.
+ */
+#define vec_pair_sum(v) \
+    vec_add_u16(vec_and((v), vec_set1_u16(0xFF)), vec_srli_u16((v), 8))
+#endif
+
+/**
+ * Channels of row y of image as planes, deinterleaving into scratch (3 *
+ * width bytes) if image is interleaved.
+ */
+static void row_planes_Y4M(const Image *image, size_t y,
+                           unsigned char *scratch,
+                           const unsigned char *channel[3]) {
+    const unsigned char *pixel;
+    size_t i, step;
+    int c;
+
+    step = row_channels(image, y, channel);
+    if (step == 1) {
+        return;
+    }
+    for (c = 0; c < 3; ++c) {
+        pixel = channel[c];
+        channel[c] = scratch + c * image->width;
+        for (i = 0; i < image->width; ++i) {
+            scratch[c * image->width + i] = pixel[i * step];
+        }
+    }
+}
+
+static void luma_row_Y4M(unsigned char *luma,
+                         const unsigned char *const channel[3], size_t n) {
+    size_t i = 0;
+#ifdef SIMD
+    Vec zero = vec_zero();
+    Vec r, g, b, lo, hi;
+    for (; i + VEC_BYTES <= n; i += VEC_BYTES) {
+        r = vec_load(channel[0] + i);
+        g = vec_load(channel[1] + i);
+        b = vec_load(channel[2] + i);
+        lo = vec_mix_y4m(vec_unpacklo(r, zero), vec_unpacklo(g, zero),
+                         vec_unpacklo(b, zero), Y4M_LUMA);
+        hi = vec_mix_y4m(vec_unpackhi(r, zero), vec_unpackhi(g, zero),
+                         vec_unpackhi(b, zero), Y4M_LUMA);
+        vec_store(luma + i, vec_packus_u16(lo, hi));
+    }
+#endif
+    for (; i < n; ++i) {
+        luma[i] = (unsigned char)mix_y4m(channel[0][i], channel[1][i],
+                                         channel[2][i], Y4M_LUMA);
+    }
+}
+
+/**
+ * Chroma samples of the row pair top, bottom, width pixels wide.
+ */
+static void chroma_row_Y4M(unsigned char *blue, unsigned char *red,
+                           const unsigned char *const top[3],
+                           const unsigned char *const bottom[3],
+                           size_t width) {
+    size_t i = 0, n = (width + 1) / 2, x0, x1;
+    int c, mean[3];
+#ifdef SIMD
+    Vec two = vec_set1_u16(2);
+    Vec sums[3][2];
+    int half;
+    /* Every pixel pair read here is whole. */
+    for (; i + VEC_BYTES <= width / 2; i += VEC_BYTES) {
+        for (c = 0; c < 3; ++c) {
+            for (half = 0; half < 2; ++half) {
+                x0 = 2 * i + half * VEC_BYTES;
+                sums[c][half] = vec_add_u16(
+                    vec_pair_sum(vec_load(top[c] + x0)),
+                    vec_pair_sum(vec_load(bottom[c] + x0)));
+                sums[c][half] = vec_srli_u16(
+                    vec_add_u16(sums[c][half], two), 2);
+            }
+        }
+        vec_store(blue + i, vec_packus_u16_across(
+            vec_mix_y4m(sums[0][0], sums[1][0], sums[2][0], Y4M_BLUE),
+            vec_mix_y4m(sums[0][1], sums[1][1], sums[2][1], Y4M_BLUE)));
+        vec_store(red + i, vec_packus_u16_across(
+            vec_mix_y4m(sums[0][0], sums[1][0], sums[2][0], Y4M_RED),
+            vec_mix_y4m(sums[0][1], sums[1][1], sums[2][1], Y4M_RED)));
+    }
+#endif
+    for (; i < n; ++i) {
+        x0 = 2 * i;
+        x1 = x0 + 1 < width ? x0 + 1 : x0;
+        for (c = 0; c < 3; ++c) {
+            mean[c] = (top[c][x0] + top[c][x1] + bottom[c][x0] +
+                       bottom[c][x1] + 2) >> 2;
+        }
+        blue[i] = (unsigned char)mix_y4m(mean[0], mean[1], mean[2],
+                                         Y4M_BLUE);
+        red[i] = (unsigned char)mix_y4m(mean[0], mean[1], mean[2], Y4M_RED);
+    }
+}
+
+static void convert_rows_Y4M(void *arg, size_t task) {
+    const Y4m_job *job = arg;
+    const Image *image = job->image;
+    size_t plane = image->width * image->height;
+    size_t chroma_plane = job->chroma_width * job->chroma_height;
+    size_t first = task * job->rows_per_task;
+    size_t last = first + job->rows_per_task;
+    size_t j;
+    const unsigned char *top[3], *bottom[3];
+    unsigned char *scratch = malloc(6 * image->width);
+
+    if (!scratch) {
+        fprintf(stderr, "Failed to allocate Y4M buffer.\n");
+        exit(1);
+    }
+    if (last > job->chroma_height) {
+        last = job->chroma_height;
+    }
+    for (j = first; j < last; ++j) {
+        row_planes_Y4M(image, 2 * j, scratch, top);
+        luma_row_Y4M(job->frame + 2 * j * image->width, top, image->width);
+        if (2 * j + 1 < image->height) {
+            row_planes_Y4M(image, 2 * j + 1, scratch + 3 * image->width,
+                           bottom);
+            luma_row_Y4M(job->frame + (2 * j + 1) * image->width, bottom,
+                         image->width);
+        } else {
+            bottom[0] = top[0];
+            bottom[1] = top[1];
+            bottom[2] = top[2];
+        }
+        chroma_row_Y4M(job->frame + plane + j * job->chroma_width,
+                       job->frame + plane + chroma_plane +
+                           j * job->chroma_width,
+                       top, bottom, image->width);
+    }
+    free(scratch);
+}
+
+void write_image_Y4M(FILE *file, const Image *image, Thread_pool *pool) {
+    Y4m_job job;
+    size_t n_tasks, size;
+    double start = trace_begin();
+
+    job.image = image;
+    job.chroma_width = (image->width + 1) / 2;
+    job.chroma_height = (image->height + 1) / 2;
+    size = image->width * image->height +
+           2 * job.chroma_width * job.chroma_height;
+    job.frame = malloc(size);
+    if (!job.frame) {
+        fprintf(stderr, "Failed to allocate Y4M frame.\n");
+        exit(1);
+    }
+    if (pool && job.chroma_height > 0) {
+        n_tasks = Y4M_TASKS_PER_THREAD * thread_pool_size(pool);
+        job.rows_per_task = (job.chroma_height + n_tasks - 1) / n_tasks;
+        n_tasks = (job.chroma_height + job.rows_per_task - 1) /
+                  job.rows_per_task;
+        thread_pool_run(pool, &convert_rows_Y4M, &job, n_tasks);
+    } else {
+        job.rows_per_task = job.chroma_height;
+        convert_rows_Y4M(&job, 0);
+    }
+    trace_end(TRACE_ENCODE, start, TRACE_NO_FRAME);
+    start = trace_begin();
+    fputs("FRAME\n", file);
+    fwrite(job.frame, 1, size, file);
+    trace_end(TRACE_WRITE, start, TRACE_NO_FRAME);
+    free(job.frame);
+}
+
+void set_random_image(Image *image, const Rng *rng, size_t frame) {
+    size_t j;
+    int channel;
+
+    for (j = 0; j < image->height; ++j) {
+        if (image->planar) {
+            for (channel = 0; channel < 3; ++channel) {
+                rng_fill_plane(rng, frame, j, RNG_INIT, channel,
+                               image->planes.channel[channel] +
+                               j * image->stride, 0, image->width);
+            }
+        } else {
+            set_random_row(image->pixels + j * image->stride, image->width,
+                           rng, frame, j);
+        }
+    }
+}
+
+void copy_image(Image *dst, const Image *src) {
+    size_t j;
+    int channel;
+
+    for (j = 0; j < src->height; ++j) {
+        if (src->planar) {
+            for (channel = 0; channel < 3; ++channel) {
+                memcpy(dst->planes.channel[channel] + j * dst->stride,
+                       src->planes.channel[channel] + j * src->stride,
+                       src->width);
+            }
+        } else {
+            memcpy(dst->pixels + j * dst->stride,
+                   src->pixels + j * src->stride,
+                   src->width * sizeof(*src->pixels));
+        }
+    }
+    refresh_halo(dst);
+}
+
 Image *malloc_image(size_t width, size_t height) {
+    return malloc_image_layout(width, height, 0, 0);
+}
+
+Image *malloc_halo_image(size_t width, size_t height) {
+    return malloc_image_layout(width, height, 1, 0);
+}
+
+Image *malloc_image_layout(size_t width, size_t height, int halo,
+                           int planar) {
     Image *image = malloc(sizeof(*image));
-    image->pixels = malloc(width * height * sizeof(Pixel));
+    size_t element_size = planar ? 1 : sizeof(Pixel);
+    size_t row_size, lead, size;
+    unsigned char *storage;
+    int channel;
+
+    if (!image) {
+        return NULL;
+    }
     image->width = width;
     image->height = height;
+    image->halo = halo;
+    image->planar = planar;
+    image->band_top = 0;
+    image->frame_height = height;
+    if (halo) {
+        /*
+         * Rows padded to a whole number of FRAME_ALIGN-byte lines, and the
+         * ghost row above preceded by a line for the ghost pixel left of it,
+         * so that every interior row starts aligned.
+         */
+        image->stride = ROUND_UP(width + 2, FRAME_ALIGN);
+        row_size = image->stride * element_size;
+        lead = FRAME_ALIGN + row_size;
+        size = FRAME_ALIGN + row_size * (height + 2);
+    } else {
+        /* Rows back to back, as the writers expect. */
+        image->stride = width;
+        lead = 0;
+        size = ROUND_UP(width * height * element_size, FRAME_ALIGN);
+    }
+    storage = frame_buffer_get(planar ? 3 * size : size);
+    if (!storage) {
+        free(image);
+        return NULL;
+    }
+    image->storage = storage;
+    if (planar) {
+        image->pixels = NULL;
+        for (channel = 0; channel < 3; ++channel) {
+            image->planes.channel[channel] = storage + channel * size + lead;
+        }
+    } else {
+        image->pixels = (Pixel *)(storage + lead);
+        for (channel = 0; channel < 3; ++channel) {
+            image->planes.channel[channel] = NULL;
+        }
+    }
     return image;
 }
 
-Image *malloc_random_image(size_t width, size_t height) {
-    Image *image = malloc_image(width, height);
+/**
+ * Refresh the ghost columns of rows [first_row, last_row) of one halo-padded
+ * array of elements of element_size bytes; first points at the first interior
+ * element. The left one gets the last column, the right one the first.
+ */
+static void refresh_columns(unsigned char *first, size_t element_size,
+                            size_t width, size_t first_row, size_t last_row,
+                            size_t stride) {
+    size_t j;
+    size_t row_size = stride * element_size;
+    unsigned char *row;
+
+    for (j = first_row; j < last_row; ++j) {
+        row = first + j * row_size;
+        memcpy(row - element_size, row + (width - 1) * element_size,
+               element_size);
+        memcpy(row + width * element_size, row, element_size);
+    }
+}
+
+/**
+ * Refresh the ghost border of one halo-padded array, as refresh_columns.
+ */
+static void refresh_border(unsigned char *first, size_t element_size,
+                           size_t width, size_t height, size_t stride) {
+    size_t row_size = stride * element_size;
+
+    refresh_columns(first, element_size, width, 0, height, stride);
+    /* Ghost rows, corners included: above gets the last row, and so on. */
+    memcpy(first - row_size - element_size,
+           first + (height - 1) * row_size - element_size, row_size);
+    memcpy(first + height * row_size - element_size,
+           first - element_size, row_size);
+}
+
+void refresh_halo(Image *image) {
+    int channel;
+
+    if (!image->halo) {
+        return;
+    }
+    if (image->planar) {
+        for (channel = 0; channel < 3; ++channel) {
+            refresh_border(image->planes.channel[channel], 1, image->width,
+                           image->height, image->stride);
+        }
+    } else {
+        refresh_border((unsigned char *)image->pixels, sizeof(Pixel),
+                       image->width, image->height, image->stride);
+    }
+}
+
+void refresh_halo_columns(Image *image, size_t first_row, size_t last_row) {
+    int channel;
+
+    if (!image->halo) {
+        return;
+    }
+    if (image->planar) {
+        for (channel = 0; channel < 3; ++channel) {
+            refresh_columns(image->planes.channel[channel], 1, image->width,
+                            first_row, last_row, image->stride);
+        }
+    } else {
+        refresh_columns((unsigned char *)image->pixels, sizeof(Pixel),
+                        image->width, first_row, last_row, image->stride);
+    }
+}
+
+Image *malloc_random_image(size_t width, size_t height,
+                           const Rng *rng, size_t frame) {
+    return malloc_random_image_layout(width, height, 0, 0, rng, frame);
+}
+
+Image *malloc_random_halo_image(size_t width, size_t height,
+                                const Rng *rng, size_t frame) {
+    return malloc_random_image_layout(width, height, 1, 0, rng, frame);
+}
+
+Image *malloc_random_image_layout(size_t width, size_t height, int halo,
+                                  int planar, const Rng *rng,
+                                  size_t frame) {
+    Image *image = malloc_image_layout(width, height, halo, planar);
     if (image) {
-        set_random_image(image);
+        set_random_image(image, rng, frame);
+        refresh_halo(image);
     }
     return image;
 }
 
 void free_image(Image *image) {
-    free(image->pixels);
+    frame_buffer_put(image->storage);
     free(image);
 }
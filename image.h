@@ -2,6 +2,7 @@
 #define IMAGE_H
 #include <stdio.h>
 #include <stdlib.h>
+#include "thread_pool.h"
 
 typedef struct Pixel {
     unsigned char r;
@@ -9,22 +10,146 @@ typedef struct Pixel {
     unsigned char b;
 } Pixel;
 
+/**
+ * Pixels stored channel by channel: channel[0] holds the red bytes,
+ * channel[1] green and channel[2] blue, one byte per pixel.
+ */
+typedef struct Planes {
+    unsigned char *channel[3];
+} Planes;
+
 typedef struct Image {
+    /* First pixel of first row, for interleaved images. */
     Pixel *pixels;
+    /* First byte of first row of every channel, for planar images. */
+    Planes planes;
     size_t width;
     size_t height;
+    /*
+     * Pixels between the starts of consecutive rows. For halo images, rows
+     * are padded so that each starts FRAME_ALIGN-aligned (see frame_alloc.h).
+     */
+    size_t stride;
+    /*
+     * Nonzero if the image is surrounded by a one-pixel toroidal ghost border
+     * (see refresh_halo), so that pixels[-1], pixels[-stride], etc. are valid.
+     */
+    int halo;
+    /*
+     * Nonzero if pixels is NULL and the image is stored in planes instead.
+     * Every plane has the same stride and halo.
+     */
+    int planar;
+    /*
+     * For an image holding a band of rows of a taller toroidal frame (see
+     * tiling.h): the frame row held in row 0, and the height of the frame.
+     * 0 and height for whole frames. Random bytes are keyed by frame row
+     * (see image_frame_row).
+     */
+    size_t band_top;
+    size_t frame_height;
+    /* The buffer holding every row, ghosts included (see frame_alloc.h). */
+    void *storage;
 } Image;
 
-void set_random_pixel(Pixel *pixel);
+struct Rng;
+
 void print_pixel(const Pixel *pixel);
 void write_pixel(FILE *file, const Pixel *pixel);
 Pixel *pixel_at(const Image *image, size_t x, size_t y);
-void set_random_row(Pixel *row, size_t width);
+void set_random_row(Pixel *row, size_t width, const struct Rng *rng,
+                    size_t frame, size_t y);
 void print_image(const Image *image);
 void write_image_P3(FILE *file, const Image *image);
+
+/**
+ * Same output as write_image_P3, with rows formatted on the threads of pool
+ * (serially if pool is NULL).
+ */
+void write_image_P3_parallel(FILE *file, const Image *image,
+                             Thread_pool *pool);
 void write_image_P6(FILE *file, const Image *image);
-void set_random_image(Image *image);
+
+/**
+ * Print the PPM header of a width x height binary image, for writers that
+ * produce the pixels themselves.
+ */
+void write_header_P6(FILE *file, size_t width, size_t height);
+
+/**
+ * Write image as a PNG (8-bit RGB), compressing on the threads of pool
+ * (serially if pool is NULL). The file is the same either way.
+ */
+void write_image_PNG(FILE *file, const Image *image, Thread_pool *pool);
+
+/**
+ * Write the YUV4MPEG2 stream header for frames of the given size, once
+ * before the first frame written with write_image_Y4M.
+ */
+void write_header_Y4M(FILE *file, size_t width, size_t height);
+
+/**
+ * Write image as one Y4M frame (4:2:0, BT.601 limited range), converting on
+ * the threads of pool (may be NULL).
+ */
+void write_image_Y4M(FILE *file, const Image *image, Thread_pool *pool);
+void set_random_image(Image *image, const struct Rng *rng, size_t frame);
+
+/**
+ * Copy the pixels of src into dst, of the same size and layout, and refresh
+ * the halo of dst.
+ */
+void copy_image(Image *dst, const Image *src);
 Image *malloc_image(size_t width, size_t height);
-Image *malloc_random_image(size_t width, size_t height);
+Image *malloc_halo_image(size_t width, size_t height);
+
+/**
+ * Allocate image with or without halo, interleaved or planar.
+ */
+Image *malloc_image_layout(size_t width, size_t height, int halo,
+                           int planar);
+
+/**
+ * Interleave n pixels of planes r, g and b into dst.
+ */
+void interleave_planes(Pixel *dst, const unsigned char *r,
+                       const unsigned char *g, const unsigned char *b,
+                       size_t n);
+
+/**
+ * Row of the whole frame that row y of image holds.
+ */
+size_t image_frame_row(const Image *image, size_t y);
+
+/**
+ * Row y of every plane of a planar image.
+ */
+Planes planes_row(const Image *image, size_t y);
+
+/**
+ * Point the planes of row at consecutive width-byte runs of bytes, for rows
+ * of random bytes and other scratch rows.
+ */
+void split_planes(Planes *row, unsigned char *bytes, size_t width);
+
+/**
+ * Copy the edges of a halo image into its ghost border, wrapping around, so
+ * that pixel (x + dx, y + dy) for dx, dy in {-1, 0, 1} can be read without
+ * wrapping or bounds checks. No-op for images without a halo.
+ */
+void refresh_halo(Image *image);
+
+/**
+ * Refresh only the ghost columns of rows [first_row, last_row), for images
+ * whose rows above and below are not to wrap (see tiling.h).
+ */
+void refresh_halo_columns(Image *image, size_t first_row, size_t last_row);
+Image *malloc_random_image(size_t width, size_t height,
+                           const struct Rng *rng, size_t frame);
+Image *malloc_random_halo_image(size_t width, size_t height,
+                                const struct Rng *rng, size_t frame);
+Image *malloc_random_image_layout(size_t width, size_t height, int halo,
+                                  int planar, const struct Rng *rng,
+                                  size_t frame);
 void free_image(Image *image);
 #endif /* IMAGE_H */
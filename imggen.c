@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "imggen.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+#define DEFAULT_FRAMES 200
+#define DEFAULT_WIDTH 200
+#define DEFAULT_HEIGHT 200
+/* Frame buffers for writer threads. */
+#define DEFAULT_BUFFERS 4
+/* Frames between checkpoints. */
+#define DEFAULT_CHECKPOINT_EVERY 1000
+
+struct Imggen {
+    Image_options options;
+    const Frame_rule *rule;
+    unsigned long seed;
+    Rng rng;
+    Thread_pool *pool;
+    /* Frame resumed from, if checkpointing.resume is not NULL. */
+    Checkpoint resume;
+    Checkpointing checkpointing;
+
+    /* For imggen_next_frame, NULL until its first call. */
+    Schedule *schedule;
+    /* The last frame returned, and the one to evolve into. */
+    Image *frames[2];
+    size_t next_frame;
+};
+
+void imggen_default_options(Image_options *options) {
+    options->n_images = DEFAULT_FRAMES;
+    options->width = DEFAULT_WIDTH;
+    options->height = DEFAULT_HEIGHT;
+    options->seed = rng_default_seed();
+    options->rule = DEFAULT_FRAME_RULE;
+    options->n_threads = 0;
+    options->planar = 0;
+    options->stream = 0;
+    options->n_writers = 0;
+    options->n_buffers = DEFAULT_BUFFERS;
+    options->output.format = FRAME_PPM;
+    options->output.file = stdout;
+    options->output.prefix = NULL;
+    options->log = stderr;
+    options->blocking.depth = 1;
+    options->blocking.keyframes = 0;
+    options->blocking.active = 0;
+    options->checkpoint_path = NULL;
+    options->checkpoint_every = DEFAULT_CHECKPOINT_EVERY;
+    options->resume_path = NULL;
+}
+
+/**
+ * Check that options describe a run that can be made. Returns 0 and says
+ * why in error if not.
+ */
+static int check_options(const Image_options *options,
+                         const Frame_rule *rule, char *error) {
+    const Blocking *blocking = &options->blocking;
+
+    if (options->n_images == 0 || options->width == 0 ||
+        options->height == 0) {
+        sprintf(error, "Runs need at least one frame of at least one"
+                       " pixel.");
+    } else if (!rule) {
+        snprintf(error, IMGGEN_ERROR_LENGTH, "There is no frame rule %s.",
+                 options->rule);
+    } else if (blocking->depth == 0) {
+        sprintf(error, "Passes need at least one generation.");
+    } else if (blocking->active && blocking->depth > 1) {
+        /* Tiles of a blocked pass are evolved whole, generations at a time. */
+        sprintf(error, "Active tiles cannot be blocked.");
+    } else if (blocking->active && !rule->deterministic) {
+        snprintf(error, IMGGEN_ERROR_LENGTH, "Active tiles need a rule that"
+                 " draws no random bytes, not %s.", rule->name);
+    } else if (options->n_writers > 0 &&
+               options->n_buffers < (blocking->keyframes ? 1
+                                                         : blocking->depth) +
+                                        1) {
+        /* A pass holds its source and every frame it keeps. */
+        sprintf(error, "Need more frame buffers than generations per pass.");
+    } else if ((options->checkpoint_path || options->resume_path) &&
+               !options->stream && options->n_writers == 0) {
+        /* Frames all in memory are lost with the run: nothing to resume. */
+        sprintf(error, "Checkpoints need streamed output or writers.");
+    } else if (options->checkpoint_every == 0) {
+        sprintf(error, "Checkpoints need at least one frame between them.");
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Read the checkpoint the run of imggen resumes from, and check that it is
+ * of a run like this one. Returns 0 and says why in error if not.
+ */
+static int read_resumed_checkpoint(Imggen *imggen, char *error) {
+    const Image_options *options = &imggen->options;
+    Checkpoint *checkpoint = &imggen->resume;
+    FILE *file = checkpoint_read_header(options->resume_path, checkpoint);
+
+    if (!file) {
+        snprintf(error, IMGGEN_ERROR_LENGTH, "Cannot resume from %s.",
+                 options->resume_path);
+        return 0;
+    }
+    if (strcmp(checkpoint->rule, imggen->rule->name) != 0 ||
+        checkpoint->width != options->width ||
+        checkpoint->height != options->height) {
+        snprintf(error, IMGGEN_ERROR_LENGTH,
+                 "Checkpoint %s is of %lux%lu frames of rule %s, not %lux%lu"
+                 " frames of rule %s.",
+                 options->resume_path, (unsigned long)checkpoint->width,
+                 (unsigned long)checkpoint->height, checkpoint->rule,
+                 (unsigned long)options->width,
+                 (unsigned long)options->height, imggen->rule->name);
+    } else if (checkpoint->frame >= options->n_images) {
+        snprintf(error, IMGGEN_ERROR_LENGTH,
+                 "Checkpoint %s is of frame %lu, past the last of %lu"
+                 " frames.",
+                 options->resume_path, (unsigned long)checkpoint->frame,
+                 (unsigned long)options->n_images);
+    } else if (!checkpoint_read_frame(file, options->resume_path, checkpoint,
+                                      options->planar)) {
+        snprintf(error, IMGGEN_ERROR_LENGTH, "Cannot resume from %s.",
+                 options->resume_path);
+        return 0;
+    } else {
+        if (options->log) {
+            fprintf(options->log, "Resuming from frame %lu, seed %lu.\n",
+                    (unsigned long)checkpoint->frame, checkpoint->seed);
+        }
+        imggen->checkpointing.resume = checkpoint;
+        imggen->seed = checkpoint->seed;
+        return 1;
+    }
+    /* The frame is not read, so there is nothing to free but the file. */
+    fclose(file);
+    return 0;
+}
+
+Imggen *imggen_create(const Image_options *options, char *error) {
+    const Frame_rule *rule = find_frame_rule(options->rule);
+    Imggen *imggen;
+
+    if (!check_options(options, rule, error)) {
+        return NULL;
+    }
+    imggen = malloc(sizeof(*imggen));
+    if (!imggen) {
+        fprintf(stderr, "Failed to allocate context.\n");
+        exit(1);
+    }
+    imggen->options = *options;
+    imggen->rule = rule;
+    imggen->seed = options->seed;
+    imggen->checkpointing.resume = NULL;
+    imggen->checkpointing.checkpointer = NULL;
+    imggen->schedule = NULL;
+    imggen->frames[0] = imggen->frames[1] = NULL;
+    imggen->next_frame = 0;
+
+    if (options->resume_path && !read_resumed_checkpoint(imggen, error)) {
+        free(imggen);
+        return NULL;
+    }
+    rng_init(&imggen->rng, imggen->seed);
+    if (options->checkpoint_path) {
+        imggen->checkpointing.checkpointer = checkpointer_create(
+            options->checkpoint_path, options->checkpoint_every, imggen->seed,
+            rule->name, options->width, options->height);
+        if (!imggen->checkpointing.checkpointer) {
+            snprintf(error, IMGGEN_ERROR_LENGTH,
+                     "Failed to start checkpoints to %s.",
+                     options->checkpoint_path);
+            if (imggen->checkpointing.resume) {
+                free_image(imggen->resume.image);
+            }
+            free(imggen);
+            return NULL;
+        }
+    }
+    imggen->pool = thread_pool_create(options->n_threads);
+    if (!imggen->pool) {
+        fprintf(stderr, "Failed to create thread pool.\n");
+        exit(1);
+    }
+    return imggen;
+}
+
+unsigned long imggen_seed(const Imggen *imggen) {
+    return imggen->seed;
+}
+
+void imggen_run(Imggen *imggen) {
+    const Image_options *options = &imggen->options;
+    Image **images;
+
+    if (options->n_writers > 0) {
+        pipeline_images(options, &imggen->rng, imggen->pool,
+                        &imggen->checkpointing);
+    } else if (options->stream) {
+        stream_images(options, &imggen->rng, imggen->pool,
+                      &imggen->checkpointing);
+    } else {
+        images = generate_images(options, &imggen->rng, imggen->pool);
+        write_images(images, options, imggen->pool);
+        free_images(images, options->n_images);
+    }
+}
+
+const Image *imggen_next_frame(Imggen *imggen, size_t *frame) {
+    const Image_options *options = &imggen->options;
+    Image *last;
+    int k;
+
+    if (!imggen->schedule) {
+        imggen->schedule = schedule_frames(options, imggen->pool);
+        for (k = 0; k < 2; ++k) {
+            imggen->frames[k] = malloc_image_layout(
+                options->width, options->height, 1, options->planar);
+            if (!imggen->frames[k]) {
+                fprintf(stderr, "Failed to allocate frames.\n");
+                exit(1);
+            }
+        }
+        if (imggen->checkpointing.resume) {
+            copy_image(imggen->frames[0], imggen->resume.image);
+            imggen->next_frame = imggen->resume.frame;
+        } else {
+            set_random_image(imggen->frames[0], &imggen->rng, 0);
+            refresh_halo(imggen->frames[0]);
+        }
+    } else {
+        evolve_scheduled_frame(imggen->schedule, imggen->pool,
+                               imggen->frames[1], imggen->frames[0],
+                               &imggen->rng, imggen->next_frame);
+        last = imggen->frames[1];
+        imggen->frames[1] = imggen->frames[0];
+        imggen->frames[0] = last;
+        if (imggen->checkpointing.checkpointer) {
+            checkpointer_offer(imggen->checkpointing.checkpointer, last,
+                               imggen->next_frame);
+        }
+    }
+    *frame = imggen->next_frame++;
+    return imggen->frames[0];
+}
+
+void imggen_free(Imggen *imggen) {
+    int k;
+
+    thread_pool_free(imggen->pool);
+    if (imggen->checkpointing.checkpointer) {
+        checkpointer_free(imggen->checkpointing.checkpointer);
+    }
+    if (imggen->checkpointing.resume) {
+        free_image(imggen->resume.image);
+    }
+    if (imggen->schedule) {
+        free_scheduled_frames(imggen->schedule);
+        for (k = 0; k < 2; ++k) {
+            free_image(imggen->frames[k]);
+        }
+    }
+    free(imggen);
+}
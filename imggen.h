@@ -0,0 +1,79 @@
+#ifndef IMGGEN_H
+#define IMGGEN_H
+#include <stddef.h>
+#include "batch.h"
+#include "ensemble.h"
+#include "evolve_image.h"
+#include "evolve_row.h"
+#include "image.h"
+
+/**
+ * libimggen: the generators behind main_image and main_row, as a library.
+ *
+ * A run of frame generation lives in an Imggen context that holds all of its
+ * state: options, rule, random number generator (keyed by the seed, see
+ * rng.h), threads, frame buffers, checkpoints and output. So any number of
+ * runs can go at once in one process, each driven by one thread at a time.
+ * All they share is this process-wide state, the first three thread-safe:
+ *
+ * - the pool of free frame buffers and its statistics (see frame_alloc.h);
+ * - the page mode of frame_alloc_set_pages, which applies to every buffer
+ *   allocated after it is set, by any run, so it is best set once before
+ *   the first context is created;
+ * - the trace (see trace.h), whose spans and counters are those of every
+ *   run together, and which is started before any context;
+ * - SIGPIPE, which serve_batch_socket ignores for the rest of the process
+ *   (see batch.h).
+ *
+ * Images of main_row are made with parse_row_job and run_row_job (see
+ * evolve_row.h), which are reentrant too, and served in batches by batch.h.
+ * Ensembles of them evolved together are in ensemble.h.
+ *
+ * As everywhere in imggen, running out of memory or threads ends the
+ * process.
+ */
+
+/* Bytes for the error messages of imggen_create. */
+#define IMGGEN_ERROR_LENGTH 256
+
+/**
+ * Fill options with the defaults of main_image: 200 frames of 200x200 pixels
+ * of DEFAULT_FRAME_RULE, seeded with rng_default_seed(), one thread per CPU,
+ * written as PPM to stdout, progress logged to stderr.
+ */
+void imggen_default_options(Image_options *options);
+
+typedef struct Imggen Imggen;
+
+/**
+ * Context for a run as options say, copied (strings are not, and must
+ * outlive the context): starts its threads, reads the checkpoint it resumes
+ * from and starts its checkpoints. Returns NULL and says why in error, on
+ * one line, if options are inconsistent or the checkpoint cannot be used.
+ */
+Imggen *imggen_create(const Image_options *options, char *error);
+
+/**
+ * Seed of the run: the checkpoint's, if it resumes from one.
+ */
+unsigned long imggen_seed(const Imggen *imggen);
+
+/**
+ * Generate every frame of the run and write it to its output: all in memory
+ * first, streamed, or through writer threads, as its options say.
+ */
+void imggen_run(Imggen *imggen);
+
+/**
+ * Generate the next frame of the run and return it, and its number in
+ * *frame: frame 0 (or the one resumed from) on the first call. For callers
+ * that want frames rather than output; the number of frames is not a limit.
+ * The frame, with an up-to-date halo, is the context's until the next call.
+ * Frames are evolved one at a time, whatever the blocking depth, and offered
+ * to the run's checkpoints.
+ */
+const Image *imggen_next_frame(Imggen *imggen, size_t *frame);
+
+void imggen_free(Imggen *imggen);
+
+#endif /* IMGGEN_H */
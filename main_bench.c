@@ -0,0 +1,349 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "evolve_image.h"
+#include "evolve_row.h"
+#include "frame_alloc.h"
+#include "simd.h"
+#include "tiling.h"
+
+/*
+ * Times every row evolver and frame evolver over a sweep of sizes, from
+ * working sets that fit in L1 up to ones that only fit in DRAM, and prints
+ * the results to stdout as JSON. Nothing is written out; only the evolvers
+ * themselves are timed (random bytes for row evolvers are drawn beforehand).
+ */
+
+#define SEED 1
+/* Each repetition evolves at least this many pixels, to dwarf clock noise. */
+#define MIN_PIXELS_PER_REP (1UL << 22)
+#define REPETITIONS 5
+#define WARMUP 1
+
+/* Row widths: 12 bytes per pixel of working set (see bench_row). */
+static const size_t row_widths[] = {1024, 16384, 262144, 4194304};
+/* Frame sides: 6 bytes per pixel of working set (see bench_frame). */
+static const size_t frame_sides[] = {64, 256, 1024, 4096};
+#define N_SIZES (sizeof(row_widths) / sizeof(*row_widths))
+
+typedef struct Row_kernel {
+    const char *name;
+    Row_evolver interleaved;
+    Planar_row_evolver planar;
+} Row_kernel;
+
+static const Row_kernel row_kernels[] = {
+    {"single_parent", &evolve_row_single_parent,
+     &evolve_row_planar_single_parent},
+    {"dad_mom_genes", &evolve_row_dad_mom_genes,
+     &evolve_row_planar_dad_mom_genes},
+    {"dad_or_mom", &evolve_row_dad_or_mom, &evolve_row_planar_dad_or_mom},
+    {"3_parent_genes", &evolve_row_3_parent_genes,
+     &evolve_row_planar_3_parent_genes},
+    {"dad_mom_average", &evolve_row_dad_mom_average,
+     &evolve_row_planar_dad_mom_average},
+    {"dad_mom_dad_above", &evolve_row_dad_mom_dad_above,
+     &evolve_row_planar_dad_mom_dad_above},
+    {"3_parent_bright", &evolve_row_3_parent_bright,
+     &evolve_row_planar_3_parent_bright}};
+
+typedef struct Frame_kernel {
+    const char *name;
+    Image_evolver evolver;
+} Frame_kernel;
+
+static const Frame_kernel frame_kernels[] = {
+    {"4_parent_genes", &evolve_image_4_parent_genes},
+    {"4_parent_average", &evolve_image_4_parent_average},
+    {"4_parent_pick_one", &evolve_image_4_parent_pick_one},
+    {"8_parent_pick_one", &evolve_image_8_parent_pick_one},
+    {"8_parent_extreme", &evolve_image_8_parent_extreme},
+    {"8_parent_bright", &evolve_image_8_parent_bright}};
+
+typedef struct Bench_options {
+    int repetitions;
+    int warmup;
+    /* Sizes to run, from the smallest; fewer skips the DRAM-sized ones. */
+    size_t n_sizes;
+    size_t n_threads;
+    /* Generations per pass for the blocked frame runs, 0 for none. */
+    size_t depth;
+} Bench_options;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + 1e-9 * (double)time.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print one result as a JSON object, from the seconds taken by each of
+ * n_reps repetitions of pixels pixels each. Sorts seconds.
+ */
+static void report(int first, const char *group, const char *kernel,
+                   const char *layout, size_t width, size_t height,
+                   size_t pixels, int bytes_per_pixel, double *seconds,
+                   int n_reps) {
+    double median, best;
+
+    qsort(seconds, (size_t)n_reps, sizeof(*seconds), &compare_doubles);
+    median = seconds[n_reps / 2];
+    best = seconds[0];
+    printf("%s    {\"group\": \"%s\", \"kernel\": \"%s\", \"layout\": \"%s\","
+           " \"width\": %lu, \"height\": %lu, \"working_set_bytes\": %lu,"
+           " \"pixels_per_rep\": %lu, \"mpixel_per_s\": %.2f,"
+           " \"ns_per_pixel\": %.4f, \"best_ns_per_pixel\": %.4f,"
+           " \"bytes_per_pixel\": %d}",
+           first ? "" : ",\n", group, kernel, layout, (unsigned long)width,
+           (unsigned long)height,
+           (unsigned long)(width * height * (size_t)bytes_per_pixel),
+           (unsigned long)pixels, 1e-6 * (double)pixels / median,
+           1e9 * median / (double)pixels, 1e9 * best / (double)pixels,
+           bytes_per_pixel);
+    fflush(stdout);
+}
+
+/**
+ * Time a row evolver on rows width pixels wide. Each row reads the source
+ * row and the choice and noise rows and writes the destination row: 12 bytes
+ * per pixel. Rows alternate between two buffers, as in stream_image.
+ */
+static void bench_row(int first, const Row_kernel *kernel, int planar,
+                      size_t width, const Bench_options *options,
+                      const Rng *rng) {
+    unsigned char *bytes[4];
+    Planes rows[4];
+    size_t n_rows = (MIN_PIXELS_PER_REP + width - 1) / width;
+    size_t j;
+    double *seconds = malloc(options->repetitions * sizeof(*seconds));
+    double start;
+    int i, rep;
+
+    for (i = 0; i < 4; ++i) {
+        bytes[i] = malloc(3 * width);
+        if (!bytes[i]) {
+            fprintf(stderr, "Failed to allocate rows.\n");
+            exit(1);
+        }
+        split_planes(rows + i, bytes[i], width);
+    }
+    if (!seconds) {
+        fprintf(stderr, "Failed to allocate timings.\n");
+        exit(1);
+    }
+    /* rows[0] and rows[1] are source and destination, then choice, noise. */
+    if (planar) {
+        rng_fill_planes(rng, 0, 0, RNG_INIT, rows + 0, 0, width);
+        rng_fill_planes(rng, 0, 1, RNG_CHOICE, rows + 2, 0, width);
+        rng_fill_planes(rng, 0, 1, RNG_NOISE, rows + 3, 0, width);
+    } else {
+        set_random_row((Pixel *)bytes[0], width, rng, 0, 0);
+        rng_fill_row(rng, 0, 1, RNG_CHOICE, (Pixel *)bytes[2], 0, width);
+        rng_fill_row(rng, 0, 1, RNG_NOISE, (Pixel *)bytes[3], 0, width);
+    }
+
+    for (rep = -options->warmup; rep < options->repetitions; ++rep) {
+        start = now();
+        for (j = 0; j < n_rows; ++j) {
+            if (planar) {
+                (*kernel->planar)(rows + (j + 1) % 2, rows + j % 2, width,
+                                  rows + 2, rows + 3);
+            } else {
+                (*kernel->interleaved)((Pixel *)bytes[(j + 1) % 2],
+                                       (const Pixel *)bytes[j % 2], width,
+                                       (const Pixel *)bytes[2],
+                                       (const Pixel *)bytes[3]);
+            }
+        }
+        if (rep >= 0) {
+            seconds[rep] = now() - start;
+        }
+    }
+    report(first, "row", kernel->name, planar ? "planar" : "interleaved",
+           width, 1, n_rows * width, 12, seconds, options->repetitions);
+
+    for (i = 0; i < 4; ++i) {
+        free(bytes[i]);
+    }
+    free(seconds);
+}
+
+/**
+ * Time a frame evolver on side x side frames across the threads of pool.
+ * Each frame reads the source frame and writes the destination: 6 bytes per
+ * pixel. Frames alternate between two buffers, as in stream_images.
+ *
+ * If depth is not 0, frames are evolved depth generations per pass through
+ * tiles (see tiling.h), keeping only the last of every pass, as with
+ * main_image --keyframes: 6 bytes of memory traffic per pixel per pass.
+ */
+static void bench_frame(int first, const Frame_kernel *kernel, int planar,
+                        size_t side, size_t depth,
+                        const Bench_options *options, const Rng *rng,
+                        Thread_pool *pool) {
+    Image *frames[2];
+    Image **dst_images = NULL;
+    Tiling *tiling = NULL;
+    size_t pixels = side * side;
+    size_t n_frames = (MIN_PIXELS_PER_REP + pixels - 1) / pixels;
+    size_t frame = 1, i;
+    double *seconds = malloc(options->repetitions * sizeof(*seconds));
+    double start;
+    int rep;
+
+    if (!seconds) {
+        fprintf(stderr, "Failed to allocate timings.\n");
+        exit(1);
+    }
+    frames[0] = malloc_random_image_layout(side, side, 1, planar, rng, 0);
+    frames[1] = malloc_random_image_layout(side, side, 1, planar, rng, 1);
+    if (depth) {
+        tiling = tiling_create(side, side, planar, depth, pool);
+        dst_images = calloc(depth, sizeof(*dst_images));
+        if (!tiling || !dst_images) {
+            fprintf(stderr, "Failed to allocate tiles.\n");
+            exit(1);
+        }
+        n_frames = (n_frames + depth - 1) / depth * depth;
+    }
+
+    for (rep = -options->warmup; rep < options->repetitions; ++rep) {
+        start = now();
+        if (depth) {
+            for (i = 0; i < n_frames; i += depth, ++frame) {
+                dst_images[depth - 1] = frames[frame % 2];
+                evolve_tiles(tiling, pool, kernel->evolver, dst_images,
+                             frames[(frame - 1) % 2], depth, rng, i + 1);
+            }
+        } else {
+            for (i = 0; i < n_frames; ++i, ++frame) {
+                evolve_image_parallel(pool, kernel->evolver,
+                                      frames[frame % 2],
+                                      frames[(frame - 1) % 2], rng, frame);
+            }
+        }
+        if (rep >= 0) {
+            seconds[rep] = now() - start;
+        }
+    }
+    report(first, depth ? "frame_blocked" : "frame", kernel->name,
+           planar ? "planar" : "interleaved", side, side, n_frames * pixels,
+           6, seconds, options->repetitions);
+
+    free_image(frames[0]);
+    free_image(frames[1]);
+    if (depth) {
+        free(dst_images);
+        tiling_free(tiling);
+    }
+    free(seconds);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--threads N] [--reps N] [--warmup N]"
+                    " [--block N] [--quick]\n",
+            program);
+    fprintf(stderr, "\t--threads 0 (default) uses one thread per CPU for"
+                    " frame evolvers.\n");
+    fprintf(stderr, "\t--reps N timed repetitions (default %d), after"
+                    " --warmup N untimed ones\n\t(default %d).\n",
+            REPETITIONS, WARMUP);
+    fprintf(stderr, "\t--quick skips the DRAM-sized working sets.\n");
+    fprintf(stderr, "\t--block N also times frame evolvers N generations"
+                    " per pass through tiles.\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Bench_options options;
+    Thread_pool *pool;
+    Rng rng;
+    unsigned long value;
+    size_t k, s;
+    int i, planar, first = 1;
+
+    options.repetitions = REPETITIONS;
+    options.warmup = WARMUP;
+    options.n_sizes = N_SIZES;
+    options.n_threads = 0;
+    options.depth = 0;
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            options.n_sizes = N_SIZES - 1;
+            continue;
+        }
+        if (i + 1 == argc || 1 != sscanf(argv[i + 1], "%lu", &value)) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            options.n_threads = (size_t)value;
+        } else if (strcmp(argv[i], "--reps") == 0 && value > 0) {
+            options.repetitions = (int)value;
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            options.warmup = (int)value;
+        } else if (strcmp(argv[i], "--block") == 0) {
+            options.depth = (size_t)value;
+        } else {
+            usage(argv[0]);
+        }
+        ++i;
+    }
+
+    rng_init(&rng, SEED);
+    pool = thread_pool_create(options.n_threads);
+    if (!pool) {
+        fprintf(stderr, "Failed to create thread pool.\n");
+        exit(1);
+    }
+#if defined(__AVX2__)
+    printf("{\n  \"simd\": \"avx2\",\n");
+#elif defined(__SSE2__)
+    printf("{\n  \"simd\": \"sse2\",\n");
+#else
+    printf("{\n  \"simd\": \"none\",\n");
+#endif
+    printf("  \"threads\": %lu,\n  \"repetitions\": %d,\n  \"warmup\": %d,\n"
+           "  \"results\": [\n",
+           (unsigned long)thread_pool_size(pool), options.repetitions,
+           options.warmup);
+
+    for (s = 0; s < options.n_sizes; ++s) {
+        for (k = 0; k < sizeof(row_kernels) / sizeof(*row_kernels); ++k) {
+            for (planar = 0; planar < 2; ++planar) {
+                fprintf(stderr, "\33[2K\rRow %s, width %lu...",
+                        row_kernels[k].name, (unsigned long)row_widths[s]);
+                bench_row(first, row_kernels + k, planar, row_widths[s],
+                          &options, &rng);
+                first = 0;
+            }
+        }
+    }
+    for (s = 0; s < options.n_sizes; ++s) {
+        for (k = 0; k < sizeof(frame_kernels) / sizeof(*frame_kernels); ++k) {
+            for (planar = 0; planar < 2; ++planar) {
+                fprintf(stderr, "\33[2K\rFrame %s, %lux%lu...",
+                        frame_kernels[k].name, (unsigned long)frame_sides[s],
+                        (unsigned long)frame_sides[s]);
+                bench_frame(first, frame_kernels + k, planar, frame_sides[s],
+                            0, &options, &rng, pool);
+                if (options.depth) {
+                    bench_frame(first, frame_kernels + k, planar,
+                                frame_sides[s], options.depth, &options,
+                                &rng, pool);
+                }
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+    fprintf(stderr, "\33[2K\rDone benchmarking.\n");
+    frame_alloc_report(stderr);
+    thread_pool_free(pool);
+    return 0;
+}
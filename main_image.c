@@ -1,10 +1,176 @@
-#include "evolve_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_alloc.h"
+#include "imggen.h"
+#include "trace.h"
 
-#define N_IMAGES 200
-#define WIDTH 200
-#define HEIGHT 200
+static void usage(const char *program, const Image_options *defaults) {
+    fprintf(stderr, "Usage: %s [--seed N] [--threads N] [--frames N]"
+                    " [--width N] [--height N] [--rule NAME] [--planar]"
+                    " [--stream] [--writers N] [--queue N] [--png | --y4m]"
+                    " [--output PREFIX] [--block N] [--keyframes] [--active]"
+                    " [--small-pages | --hugetlb] [--trace FILE]"
+                    " [--counters] [--checkpoint FILE]"
+                    " [--checkpoint-every N] [--resume FILE]\n",
+            program);
+    fprintf(stderr, "\tFrames are %lux%lu pixels, %lu of them, of rule %s"
+                    " unless told otherwise.\n\tRules are:\n",
+            (unsigned long)defaults->width, (unsigned long)defaults->height,
+            (unsigned long)defaults->n_images, defaults->rule);
+    print_frame_rules(stderr);
+    fprintf(stderr, "\t--threads 0 (default) uses one thread per CPU.\n");
+    fprintf(stderr, "\t--stream writes each frame as soon as it is done,"
+                    " keeping two in memory.\n");
+    fprintf(stderr, "\t--writers N writes frames on N threads of their own,"
+                    " through a queue of\n\t--queue N (at least 2, default %lu)"
+                    " frame buffers.\n", (unsigned long)defaults->n_buffers);
+    fprintf(stderr, "\t--png writes frames as PNG instead of PPM.\n");
+    fprintf(stderr, "\t--block N evolves N generations per pass over"
+                    " cache-sized bands of rows.\n");
+    fprintf(stderr, "\t--keyframes keeps and writes only the last frame of"
+                    " every pass.\n");
+    fprintf(stderr, "\t--active evolves only tiles near pixels that changed"
+                    " in the last frame.\n");
+    fprintf(stderr, "\t--y4m writes one YUV4MPEG2 (4:2:0) video stream.\n");
+    fprintf(stderr, "\t--output PREFIX writes every frame to a file of its"
+                    " own, PREFIX0000000.ppm\n\tand on, instead of to"
+                    " stdout.\n");
+    fprintf(stderr, "\t--small-pages backs frames with ordinary pages,"
+                    " --hugetlb with reserved huge\n\tpages where there are"
+                    " any, instead of transparent huge pages.\n");
+    fprintf(stderr, "\t--trace FILE saves a Chrome trace of every phase of"
+                    " every frame.\n");
+    fprintf(stderr, "\t--counters adds CPU hardware counters to the timing"
+                    " summary.\n");
+    fprintf(stderr, "\t--checkpoint FILE saves the frame reached to FILE"
+                    " every --checkpoint-every N\n\tframes (default %lu),"
+                    " in the background; --resume FILE carries on from\n"
+                    "\tit, writing that frame and the ones after it. Both"
+                    " need --stream or\n\t--writers.\n",
+            (unsigned long)defaults->checkpoint_every);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Image_options options, defaults;
+    Imggen *imggen;
+    unsigned long value;
+    const char *trace_path = NULL;
+    char error[IMGGEN_ERROR_LENGTH];
+    int counters = 0, queue_given = 0;
+    int i;
+
+    imggen_default_options(&defaults);
+    options = defaults;
+    for (i = 1; i < argc; ++i) {
+        /* Flags first, then options with a value. */
+        if (strcmp(argv[i], "--planar") == 0) {
+            options.planar = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--stream") == 0) {
+            options.stream = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--png") == 0) {
+            options.output.format = FRAME_PNG;
+            continue;
+        }
+        if (strcmp(argv[i], "--y4m") == 0) {
+            options.output.format = FRAME_Y4M;
+            continue;
+        }
+        if (strcmp(argv[i], "--keyframes") == 0) {
+            options.blocking.keyframes = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--active") == 0) {
+            options.blocking.active = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--small-pages") == 0) {
+            frame_alloc_set_pages(FRAME_PAGES_SMALL);
+            continue;
+        }
+        if (strcmp(argv[i], "--hugetlb") == 0) {
+            frame_alloc_set_pages(FRAME_PAGES_HUGETLB);
+            continue;
+        }
+        if (strcmp(argv[i], "--counters") == 0) {
+            counters = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--rule") == 0 && i + 1 < argc) {
+            options.rule = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            options.output.prefix = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            options.checkpoint_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            options.resume_path = argv[++i];
+            continue;
+        }
+        if (i + 1 == argc || 1 != sscanf(argv[i + 1], "%lu", &value)) {
+            usage(argv[0], &defaults);
+        }
+        if (strcmp(argv[i], "--seed") == 0) {
+            options.seed = value;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            options.n_threads = (size_t)value;
+        } else if (strcmp(argv[i], "--frames") == 0 && value > 0) {
+            options.n_images = (size_t)value;
+        } else if (strcmp(argv[i], "--width") == 0 && value > 0) {
+            options.width = (size_t)value;
+        } else if (strcmp(argv[i], "--height") == 0 && value > 0) {
+            options.height = (size_t)value;
+        } else if (strcmp(argv[i], "--writers") == 0) {
+            options.n_writers = (size_t)value;
+        } else if (strcmp(argv[i], "--queue") == 0 && value >= 2) {
+            options.n_buffers = (size_t)value;
+            queue_given = 1;
+        } else if (strcmp(argv[i], "--block") == 0 && value > 0) {
+            options.blocking.depth = (size_t)value;
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && value > 0) {
+            options.checkpoint_every = (size_t)value;
+        } else {
+            usage(argv[0], &defaults);
+        }
+        ++i;
+    }
+
+    /* Writers need a buffer for every frame a pass keeps, and its source. */
+    if (!queue_given && !options.blocking.keyframes &&
+        options.n_buffers < options.blocking.depth + 1) {
+        options.n_buffers = options.blocking.depth + 1;
+    }
 
-int main() {
-    main_image_generation(N_IMAGES, WIDTH, HEIGHT);
+    /* A resumed run has the checkpoint's seed. */
+    if (!options.resume_path) {
+        fprintf(stderr, "Seed: %lu\n", options.seed);
+    }
+    if (!trace_start(trace_path, counters)) {
+        fprintf(stderr, "Failed to open trace file %s.\n", trace_path);
+        exit(1);
+    }
+    imggen = imggen_create(&options, error);
+    if (!imggen) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+    imggen_run(imggen);
+    imggen_free(imggen);
+    trace_finish(stderr);
+    frame_alloc_report(stderr);
     return 0;
 }
@@ -1,4 +1,7 @@
-#include "evolve_row.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "imggen.h"
 
 /**
  * A couple of interesting things I want to investigate.
@@ -16,6 +19,80 @@
  */
 
 int main(int argc, char *argv[]) {
-    main_row_generation(argc, argv);
+    unsigned long n_threads = 0;
+    const char *batch_path = NULL, *listen_path = NULL;
+    char error[ROW_JOB_ERROR_LENGTH];
+    char **words;
+    int i, n_words = 0;
+    Thread_pool *pool;
+    Row_job job;
+
+    /* Options of the process; the rest describe the image. */
+    words = malloc(argc * sizeof(*words));
+    if (!words) {
+        fprintf(stderr, "Failed to allocate arguments.\n");
+        exit(1);
+    }
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 == argc ||
+                1 != sscanf(argv[i + 1], "%lu", &n_threads)) {
+                fprintf(stderr, "Enter threads as a non-negative integer.\n");
+                exit(1);
+            }
+            ++i;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listen_path = argv[++i];
+        } else {
+            words[n_words++] = argv[i];
+        }
+    }
+
+    if (batch_path || listen_path) {
+        if (n_words > 0 || (batch_path && listen_path)) {
+            fprintf(stderr, "--batch FILE and --listen PATH take no other"
+                            " arguments but --threads N.\n");
+            exit(1);
+        }
+        if (!(batch_path ? serve_batch_file(batch_path, (size_t)n_threads)
+                         : serve_batch_socket(listen_path,
+                                              (size_t)n_threads))) {
+            exit(1);
+        }
+        free(words);
+        return 0;
+    }
+    if (!parse_row_job(&job, n_words, words, error)) {
+        fprintf(stderr, "%s\n", error);
+        print_row_job_usage(stderr);
+        fprintf(stderr, "Or: --batch FILE (- for stdin) or --listen PATH,"
+                        " and --threads N.\n");
+        exit(1);
+    }
+    if (job.n_members > 1) {
+        fprintf(stderr, "Seeds: %lu to %lu\n", job.seed,
+                job.seed + (unsigned long)job.n_members - 1);
+    } else {
+        fprintf(stderr, "Seed: %lu\n", job.seed);
+    }
+    /* Streamed rows are generated serially. */
+    pool = NULL;
+    if (!job.stream) {
+        pool = thread_pool_create((size_t)n_threads);
+        if (!pool) {
+            fprintf(stderr, "Failed to create thread pool.\n");
+            exit(1);
+        }
+    }
+    if (!run_row_job(&job, pool, error)) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
+    if (pool) {
+        thread_pool_free(pool);
+    }
+    free(words);
     return 0;
 }
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pyramid.h"
+
+/* Bytes of a level's file name beyond the image's, terminator included. */
+#define MAX_SUFFIX_LENGTH 32
+
+typedef struct Level {
+    size_t width;
+    size_t height;
+    /* Width of the level above, whose rows this one takes. */
+    size_t src_width;
+    /*
+     * Bytes of the rows above, summed as they come, while pending is
+     * nonzero: 3 * width pairs of pixels, the last pixel of an odd row
+     * repeated to make up its pair (which makes the mean that of the pixels
+     * there are).
+     */
+    unsigned short *sums;
+    int pending;
+    /* Row finished, width pixels. */
+    Pixel *row;
+    FILE *file;
+} Level;
+
+struct Pyramid {
+    int n_levels;
+    Level *levels;
+};
+
+int pyramid_max_levels(size_t width, size_t height) {
+    int n = 0;
+    while (width > 1 || height > 1) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * Open the file of level, 1/scale the size of the image at path, and write
+ * its header. NULL if it cannot be opened.
+ */
+static FILE *open_level(const char *path, const Level *level,
+                        unsigned long scale) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(path, '.');
+    size_t stem = dot && (!slash || dot > slash) ? (size_t)(dot - path)
+                                                 : strlen(path);
+    char *name = malloc(stem + MAX_SUFFIX_LENGTH);
+    FILE *file;
+
+    if (!name) {
+        fprintf(stderr, "Failed to allocate file name.\n");
+        exit(1);
+    }
+    memcpy(name, path, stem);
+    sprintf(name + stem, "-%lu.ppm", scale);
+    file = fopen(name, "wb");
+    free(name);
+    if (file) {
+        write_header_P6(file, level->width, level->height);
+    }
+    return file;
+}
+
+Pyramid *pyramid_create(const char *path, size_t width, size_t height,
+                        int n_levels) {
+    Pyramid *pyramid = malloc(sizeof(*pyramid));
+    unsigned long scale = 1;
+    Level *level;
+    int k;
+
+    if (!pyramid) {
+        return NULL;
+    }
+    pyramid->n_levels = n_levels;
+    pyramid->levels = calloc(n_levels, sizeof(*pyramid->levels));
+    if (!pyramid->levels) {
+        free(pyramid);
+        return NULL;
+    }
+    for (k = 0; k < n_levels; ++k) {
+        level = pyramid->levels + k;
+        level->src_width = width;
+        level->width = width = (width + 1) / 2;
+        level->height = height = (height + 1) / 2;
+        level->sums = malloc(6 * width * sizeof(*level->sums));
+        level->row = malloc(width * sizeof(*level->row));
+        level->pending = 0;
+        if (!level->sums || !level->row) {
+            fprintf(stderr, "Failed to allocate pyramid rows.\n");
+            exit(1);
+        }
+        scale *= 2;
+        level->file = open_level(path, level, scale);
+        if (!level->file) {
+            pyramid->n_levels = k + 1;
+            pyramid_finish(pyramid);
+            return NULL;
+        }
+    }
+    return pyramid;
+}
+
+static void add_level_row(Pyramid *pyramid, int k, const Pixel *row);
+
+/**
+ * Write the finished row of level k and pass it on to the level below.
+ */
+static void emit_level_row(Pyramid *pyramid, int k) {
+    Level *level = pyramid->levels + k;
+
+    fwrite(level->row, sizeof(*level->row), level->width, level->file);
+    if (k + 1 < pyramid->n_levels) {
+        add_level_row(pyramid, k + 1, level->row);
+    }
+}
+
+/**
+ * Add row, of the level above, to level k.
+ */
+static void add_level_row(Pyramid *pyramid, int k, const Pixel *row) {
+    Level *level = pyramid->levels + k;
+    const unsigned char *bytes = (const unsigned char *)row;
+    unsigned short *sums = level->sums;
+    unsigned char *out = (unsigned char *)level->row;
+    size_t n = 3 * level->src_width, i;
+
+    /* Byte by byte, so that the loops vectorize. */
+    if (!level->pending) {
+        for (i = 0; i < n; ++i) {
+            sums[i] = bytes[i];
+        }
+    } else {
+        for (i = 0; i < n; ++i) {
+            sums[i] = (unsigned short)(sums[i] + bytes[i]);
+        }
+    }
+    if (level->src_width % 2) {
+        for (i = 0; i < 3; ++i) {
+            sums[n + i] = sums[n - 3 + i];
+        }
+    }
+    if (!level->pending) {
+        level->pending = 1;
+        return;
+    }
+    for (i = 0; i < 3 * level->width; i += 3) {
+        out[i] = (unsigned char)((sums[2 * i] + sums[2 * i + 3] + 2) >> 2);
+        out[i + 1] = (unsigned char)((sums[2 * i + 1] + sums[2 * i + 4] + 2)
+                                     >> 2);
+        out[i + 2] = (unsigned char)((sums[2 * i + 2] + sums[2 * i + 5] + 2)
+                                     >> 2);
+    }
+    level->pending = 0;
+    emit_level_row(pyramid, k);
+}
+
+void pyramid_add_row(Pyramid *pyramid, const Pixel *row) {
+    add_level_row(pyramid, 0, row);
+}
+
+void pyramid_add_image(Pyramid *pyramid, const Image *image) {
+    Pixel *buffer = NULL;
+    Planes row;
+    size_t j;
+
+    if (image->planar) {
+        buffer = malloc(image->width * sizeof(*buffer));
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate row.\n");
+            exit(1);
+        }
+    }
+    for (j = 0; j < image->height; ++j) {
+        if (image->planar) {
+            row = planes_row(image, j);
+            interleave_planes(buffer, row.channel[0], row.channel[1],
+                              row.channel[2], image->width);
+            pyramid_add_row(pyramid, buffer);
+        } else {
+            pyramid_add_row(pyramid, image->pixels + j * image->stride);
+        }
+    }
+    free(buffer);
+}
+
+int pyramid_finish(Pyramid *pyramid) {
+    Level *level;
+    unsigned char *out;
+    size_t i, c;
+    int k, written = 1;
+
+    /*
+     * A row left pending at an odd bottom edge stands in for the missing
+     * one below it. Finishing a level may finish a row of the next, so they
+     * go from the top.
+     */
+    for (k = 0; k < pyramid->n_levels; ++k) {
+        level = pyramid->levels + k;
+        if (level->pending && level->file) {
+            out = (unsigned char *)level->row;
+            for (i = 0; i < 3 * level->width; i += 3) {
+                for (c = 0; c < 3; ++c) {
+                    out[i + c] = (unsigned char)((level->sums[2 * i + c] +
+                                                  level->sums[2 * i + 3 + c] +
+                                                  1) >> 1);
+                }
+            }
+            level->pending = 0;
+            emit_level_row(pyramid, k);
+        }
+    }
+    for (k = 0; k < pyramid->n_levels; ++k) {
+        level = pyramid->levels + k;
+        if (level->file) {
+            written = !ferror(level->file) && written;
+            written = fclose(level->file) == 0 && written;
+        }
+        free(level->sums);
+        free(level->row);
+    }
+    free(pyramid->levels);
+    free(pyramid);
+    return written;
+}
@@ -0,0 +1,51 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+#include <stddef.h>
+#include "image.h"
+
+/**
+ * Image pyramid (mipmap levels) built from the rows of an image as they are
+ * generated, top to bottom, in the same pass: no second read of the image.
+ *
+ * Level k is half the width and height of level k - 1 (rounded up), level 0
+ * being the image: every pixel is the mean, rounded to nearest, of the 2x2
+ * pixels of level k - 1 it covers (1x2, 2x1 or 1x1 at an odd right or bottom
+ * edge). A level holds one row of pair sums until the row below it comes,
+ * then hands its finished row to the next level, so the state is about one
+ * image row in all, whatever the height.
+ *
+ * Every level is written as a binary PPM as it goes, to a file named after
+ * the image's with the scale before its extension: image-2.ppm, image-4.ppm,
+ * ... for image.ppm or image.png.
+ */
+typedef struct Pyramid Pyramid;
+
+/**
+ * Levels 1 to n_levels of a width x height image to be written to path,
+ * their files opened and headers written. NULL if a file cannot be opened.
+ */
+Pyramid *pyramid_create(const char *path, size_t width, size_t height,
+                        int n_levels);
+
+/**
+ * Most levels of a width x height image: until it is down to one pixel.
+ */
+int pyramid_max_levels(size_t width, size_t height);
+
+/**
+ * Add the next row of the image, interleaved, width pixels.
+ */
+void pyramid_add_row(Pyramid *pyramid, const Pixel *row);
+
+/**
+ * Add every row of image, which is all of the image, in order.
+ */
+void pyramid_add_image(Pyramid *pyramid, const Image *image);
+
+/**
+ * Finish the levels once every row is added, close their files and free
+ * pyramid. Returns 0 if a file could not be written.
+ */
+int pyramid_finish(Pyramid *pyramid);
+
+#endif /* PYRAMID_H */
@@ -0,0 +1,282 @@
+#include <time.h>
+#include "rng.h"
+#include "simd.h"
+
+#define PHILOX_ROUNDS 10
+#define PHILOX_M0 0xD2511F53UL
+#define PHILOX_M1 0xCD9E8D57UL
+#define PHILOX_W0 0x9E3779B9UL
+#define PHILOX_W1 0xBB67AE85UL
+
+/* Columns covered by one block: 128 bits, one byte per column. */
+#define RNG_BLOCK_COLUMNS 16
+/* Blocks computed together, one per 32-bit vector lane. */
+#ifdef SIMD
+#define RNG_LANES (VEC_BYTES / 4)
+#else
+#define RNG_LANES 4
+#endif
+
+void rng_init(Rng *rng, unsigned long seed) {
+    rng->key[0] = (uint32_t)(seed & 0xFFFFFFFFUL);
+    /* Two shifts, so this is well defined for 32-bit unsigned long too. */
+    rng->key[1] = (uint32_t)((seed >> 16 >> 16) & 0xFFFFFFFFUL);
+}
+
+void rng_block(const Rng *rng, const uint32_t counter[4], uint32_t result[4]) {
+    uint32_t x0, x1, x2, x3, k0, k1;
+    uint64_t product0, product1;
+    int round;
+
+    x0 = counter[0];
+    x1 = counter[1];
+    x2 = counter[2];
+    x3 = counter[3];
+    k0 = rng->key[0];
+    k1 = rng->key[1];
+
+    for (round = 0; round < PHILOX_ROUNDS; ++round) {
+        product0 = (uint64_t)PHILOX_M0 * x0;
+        product1 = (uint64_t)PHILOX_M1 * x2;
+        x0 = (uint32_t)(product1 >> 32) ^ x1 ^ k0;
+        x2 = (uint32_t)(product0 >> 32) ^ x3 ^ k1;
+        x1 = (uint32_t)product1;
+        x3 = (uint32_t)product0;
+        k0 += (uint32_t)PHILOX_W0;
+        k1 += (uint32_t)PHILOX_W1;
+    }
+
+    result[0] = x0;
+    result[1] = x1;
+    result[2] = x2;
+    result[3] = x3;
+}
+
+/**
+ * Compute RNG_LANES Philox blocks at once, the block in lane l for key
+ * (key0[l], key1[l]) and counter (c0, c1, c2[l], c3). Word w of the block in
+ * lane l goes to words[w][l].
+ */
+static void rng_lanes(const uint32_t key0[RNG_LANES],
+                      const uint32_t key1[RNG_LANES], uint32_t c0,
+                      uint32_t c1, const uint32_t c2[RNG_LANES], uint32_t c3,
+                      uint32_t words[4][RNG_LANES]) {
+#ifdef SIMD
+    /*
+     * Same rounds as rng_block, one block per 32-bit lane. Products of the
+     * even lanes and of the odd lanes (shifted down) are computed separately
+     * and their halves merged back into lanes.
+     */
+    Vec low_halves = vec_srli_u64(vec_set1_u32(0xFFFFFFFFUL), 32);
+    Vec m0 = vec_set1_u32(PHILOX_M0), m1 = vec_set1_u32(PHILOX_M1);
+    Vec k0 = vec_load(key0), k1 = vec_load(key1);
+    Vec x0 = vec_set1_u32(c0), x1 = vec_set1_u32(c1), x3 = vec_set1_u32(c3);
+    Vec x2 = vec_load(c2);
+    int round;
+
+    for (round = 0; round < PHILOX_ROUNDS; ++round) {
+        Vec even0 = vec_mul_even_u32(x0, m0);
+        Vec odd0 = vec_mul_even_u32(vec_srli_u64(x0, 32), m0);
+        Vec even1 = vec_mul_even_u32(x2, m1);
+        Vec odd1 = vec_mul_even_u32(vec_srli_u64(x2, 32), m1);
+        Vec lo0 = vec_or(vec_and(even0, low_halves), vec_slli_u64(odd0, 32));
+        Vec hi0 = vec_or(vec_srli_u64(even0, 32), vec_andnot(low_halves, odd0));
+        Vec lo1 = vec_or(vec_and(even1, low_halves), vec_slli_u64(odd1, 32));
+        Vec hi1 = vec_or(vec_srli_u64(even1, 32), vec_andnot(low_halves, odd1));
+        x0 = vec_xor(vec_xor(hi1, x1), k0);
+        x2 = vec_xor(vec_xor(hi0, x3), k1);
+        x1 = lo1;
+        x3 = lo0;
+        k0 = vec_add_u32(k0, vec_set1_u32(PHILOX_W0));
+        k1 = vec_add_u32(k1, vec_set1_u32(PHILOX_W1));
+    }
+    vec_store(words[0], x0);
+    vec_store(words[1], x1);
+    vec_store(words[2], x2);
+    vec_store(words[3], x3);
+#else
+    uint32_t counter[4], result[4];
+    Rng rng;
+    int lane, w;
+
+    counter[0] = c0;
+    counter[1] = c1;
+    counter[3] = c3;
+    for (lane = 0; lane < RNG_LANES; ++lane) {
+        rng.key[0] = key0[lane];
+        rng.key[1] = key1[lane];
+        counter[2] = c2[lane];
+        rng_block(&rng, counter, result);
+        for (w = 0; w < 4; ++w) {
+            words[w][lane] = result[w];
+        }
+    }
+#endif
+}
+
+/**
+ * Compute RNG_LANES consecutive Philox blocks of rng, for counters (c0, c1,
+ * first_block + lane, c3), into words as rng_lanes does.
+ */
+static void rng_blocks(const Rng *rng, uint32_t c0, uint32_t c1,
+                       uint32_t first_block, uint32_t c3,
+                       uint32_t words[4][RNG_LANES]) {
+    uint32_t key0[RNG_LANES], key1[RNG_LANES], c2[RNG_LANES];
+    int lane;
+
+    for (lane = 0; lane < RNG_LANES; ++lane) {
+        key0[lane] = rng->key[0];
+        key1[lane] = rng->key[1];
+        c2[lane] = first_block + (uint32_t)lane;
+    }
+    rng_lanes(key0, key1, c0, c1, c2, c3, words);
+}
+
+/**
+ * Fill columns [first_column, first_column + n_columns) of one channel of a
+ * row: byte of column i goes to bytes[step * (i - first_column)].
+ */
+static void fill_channel(const Rng *rng, size_t frame, size_t y, int stream,
+                         int channel, unsigned char *bytes, size_t step,
+                         size_t first_column, size_t n_columns) {
+    /*
+     * Counter is (frame, row, column block, stream and channel), so every
+     * channel of every stream is a separate sequence of blocks, and bytes
+     * can be generated plane by plane.
+     */
+    uint32_t words[4][RNG_LANES];
+    unsigned char block_bytes[RNG_LANES * RNG_BLOCK_COLUMNS];
+    size_t group, first_block, last_block, i, begin, end;
+    int lane, byte;
+
+    if (n_columns == 0) {
+        return;
+    }
+    first_block = first_column / RNG_BLOCK_COLUMNS;
+    last_block = (first_column + n_columns - 1) / RNG_BLOCK_COLUMNS;
+
+    for (group = first_block; group <= last_block; group += RNG_LANES) {
+        /* Columns of the row covered by this group of blocks. */
+        begin = group * RNG_BLOCK_COLUMNS;
+        end = begin + RNG_LANES * RNG_BLOCK_COLUMNS;
+        if (begin < first_column) {
+            begin = first_column;
+        }
+        if (end > first_column + n_columns) {
+            end = first_column + n_columns;
+        }
+        rng_blocks(rng, (uint32_t)frame, (uint32_t)y, (uint32_t)group,
+                   (uint32_t)(stream * 4 + channel), words);
+        /* Bytes of each block in little-endian order, block by block. */
+        for (lane = 0; lane < RNG_LANES; ++lane) {
+            for (byte = 0; byte < RNG_BLOCK_COLUMNS; ++byte) {
+                block_bytes[lane * RNG_BLOCK_COLUMNS + byte] = (unsigned char)
+                    (words[byte / 4][lane] >> (8 * (byte % 4)));
+            }
+        }
+        for (i = begin; i < end; ++i) {
+            bytes[step * (i - first_column)] =
+                block_bytes[i - group * RNG_BLOCK_COLUMNS];
+        }
+    }
+}
+
+void rng_fill_row(const Rng *rng, size_t frame, size_t y, int stream,
+                  Pixel *row, size_t first_column, size_t n_columns) {
+    int channel;
+    for (channel = 0; channel < 3; ++channel) {
+        fill_channel(rng, frame, y, stream, channel,
+                     (unsigned char *)row + channel, 3,
+                     first_column, n_columns);
+    }
+}
+
+void rng_fill_plane(const Rng *rng, size_t frame, size_t y, int stream,
+                    int channel, unsigned char *plane, size_t first_column,
+                    size_t n_columns) {
+    fill_channel(rng, frame, y, stream, channel, plane, 1, first_column,
+                 n_columns);
+}
+
+void rng_fill_planes(const Rng *rng, size_t frame, size_t y, int stream,
+                     const Planes *row, size_t first_column,
+                     size_t n_columns) {
+    int channel;
+    for (channel = 0; channel < 3; ++channel) {
+        fill_channel(rng, frame, y, stream, channel, row->channel[channel], 1,
+                     first_column, n_columns);
+    }
+}
+
+void rng_fill_ensemble(const Rng *rngs, size_t n_members, size_t frame,
+                       size_t y, int stream, const Planes *row,
+                       size_t first_column, size_t n_columns) {
+    /*
+     * Same counters as fill_channel, but each lane takes the same block of a
+     * different member, so that the bytes of a column come out together, a
+     * run of RNG_LANES members. A last short group of members repeats the
+     * last key in its spare lanes.
+     */
+    uint32_t key0[RNG_LANES], key1[RNG_LANES], c2[RNG_LANES];
+    uint32_t words[4][RNG_LANES];
+    size_t first_member, n_lanes, block, begin, end, i;
+    unsigned char *bytes;
+    int channel, lane, byte;
+
+    if (n_columns == 0) {
+        return;
+    }
+    for (first_member = 0; first_member < n_members;
+         first_member += RNG_LANES) {
+        n_lanes = n_members - first_member < RNG_LANES
+                      ? n_members - first_member
+                      : RNG_LANES;
+        for (lane = 0; lane < RNG_LANES; ++lane) {
+            const Rng *rng = rngs + first_member +
+                             ((size_t)lane < n_lanes ? (size_t)lane
+                                                     : n_lanes - 1);
+            key0[lane] = rng->key[0];
+            key1[lane] = rng->key[1];
+        }
+        for (channel = 0; channel < 3; ++channel) {
+            for (block = first_column / RNG_BLOCK_COLUMNS;
+                 block * RNG_BLOCK_COLUMNS < first_column + n_columns;
+                 ++block) {
+                begin = block * RNG_BLOCK_COLUMNS;
+                end = begin + RNG_BLOCK_COLUMNS;
+                if (begin < first_column) {
+                    begin = first_column;
+                }
+                if (end > first_column + n_columns) {
+                    end = first_column + n_columns;
+                }
+                for (lane = 0; lane < RNG_LANES; ++lane) {
+                    c2[lane] = (uint32_t)block;
+                }
+                rng_lanes(key0, key1, (uint32_t)frame, (uint32_t)y, c2,
+                          (uint32_t)(stream * 4 + channel), words);
+                for (i = begin; i < end; ++i) {
+                    bytes = row->channel[channel] +
+                            (i - first_column) * n_members + first_member;
+                    byte = (int)(i % RNG_BLOCK_COLUMNS);
+                    if (n_lanes == RNG_LANES) {
+                        /* A constant count, for the compiler to unroll. */
+                        for (lane = 0; lane < RNG_LANES; ++lane) {
+                            bytes[lane] = (unsigned char)
+                                (words[byte / 4][lane] >> (8 * (byte % 4)));
+                        }
+                    } else {
+                        for (lane = 0; (size_t)lane < n_lanes; ++lane) {
+                            bytes[lane] = (unsigned char)
+                                (words[byte / 4][lane] >> (8 * (byte % 4)));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+unsigned long rng_default_seed(void) {
+    return (unsigned long)time(NULL);
+}
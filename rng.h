@@ -0,0 +1,79 @@
+#ifndef RNG_H
+#define RNG_H
+#include <stddef.h>
+#include <stdint.h>
+#include "image.h"
+
+/**
+ * Counter-based random number generator (Philox4x32-10).
+ *
+ * Every random byte is a pure function of (seed, frame, row, column, channel,
+ * stream), so the draws for any pixel can be computed independently of all
+ * the others, on any thread, in any order, and a run is reproducible from its
+ * seed alone.
+ */
+typedef struct Rng {
+    uint32_t key[2];
+} Rng;
+
+/**
+ * Independent streams of random bytes. Every pixel channel gets one byte from
+ * each stream.
+ */
+#define RNG_CHOICE 0 /* which parent a gene (or whole pixel) is taken from */
+#define RNG_NOISE 1  /* mutation amount */
+#define RNG_INIT 2   /* initial random pixel values */
+
+/**
+ * Map random byte to an integer in [0, n - 1], n <= 256.
+ */
+#define RNG_BELOW(byte, n) ((int)(((unsigned)(byte) * (unsigned)(n)) >> 8))
+
+/**
+ * Key generator with seed.
+ */
+void rng_init(Rng *rng, unsigned long seed);
+
+/**
+ * Compute one Philox4x32-10 block: 128 random bits for counter.
+ */
+void rng_block(const Rng *rng, const uint32_t counter[4], uint32_t result[4]);
+
+/**
+ * Fill n_columns pixels of row with random bytes from stream for columns
+ * first_column onwards: row points at the pixel for column first_column.
+ * Channel c of column i in row y of frame is always the same byte,
+ * regardless of which range it was requested as part of.
+ */
+void rng_fill_row(const Rng *rng, size_t frame, size_t y, int stream,
+                  Pixel *row, size_t first_column, size_t n_columns);
+
+/**
+ * Same bytes as rng_fill_row, for a single channel stored as a plane.
+ */
+void rng_fill_plane(const Rng *rng, size_t frame, size_t y, int stream,
+                    int channel, unsigned char *plane, size_t first_column,
+                    size_t n_columns);
+
+/**
+ * Same bytes as rng_fill_row, for a planar row.
+ */
+void rng_fill_planes(const Rng *rng, size_t frame, size_t y, int stream,
+                     const Planes *row, size_t first_column,
+                     size_t n_columns);
+
+/**
+ * Same bytes as rng_fill_planes, for the rows of an ensemble of n_members
+ * images, member m drawing from rngs[m]: the byte of member m for column i
+ * goes to byte (i - first_column) * n_members + m of its channel's plane.
+ */
+void rng_fill_ensemble(const Rng *rngs, size_t n_members, size_t frame,
+                       size_t y, int stream, const Planes *row,
+                       size_t first_column, size_t n_columns);
+
+/**
+ * Seed to use when none was given on the command line.
+ */
+unsigned long rng_default_seed(void);
+
+#endif /* RNG_H */
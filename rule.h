@@ -0,0 +1,247 @@
+#ifndef RULE_H
+#define RULE_H
+#include <stddef.h>
+#include "image.h"
+#include "rng.h"
+
+/*
+ * Neighbourhood rules. Every strategy is described here once, declaratively,
+ * and evolve_row.c and evolve_image.c expand the descriptions into loops at
+ * build time, so each rule gets an inner loop of its own with its operators
+ * inlined, and there is no call per pixel.
+ *
+ * A rule is RULE(name, parents, combine, noise, kernels):
+ *
+ * parents lists the source pixels read for a destination pixel, as
+ * P(k, dx, dy) for parent k at dx columns and dy rows from it. Row rules read
+ * the previous row (dy = -1), wrapping around its ends; frame rules read the
+ * previous frame through its halo.
+ *
+ * combine makes a value per channel from the n parents, using the choice
+ * byte of each channel:
+ *     pick_one  the whole of parent RNG_BELOW(red choice, n),
+ *     gene      channel c of parent RNG_BELOW(choice c, n),
+ *     average   the sum of parent / n, rounding each term down,
+ *     extreme   the whole of the parent of greatest extremity (see
+ *               extremity()), the first one on ties,
+ *     bright    the whole of the parent of greatest r + g + b, the first one
+ *               on ties.
+ *
+ * noise then perturbs each channel using its noise byte:
+ *     none      leave it,
+ *     jitter    see jitter(): -8 to 8, bouncing off 0 and 255,
+ *     rise      add RNG_BELOW(noise, 16), wrapping,
+ *     spread    add RNG_BELOW(noise, 17) - 8, wrapping.
+ *
+ * kernels is vector if hand-vectorized kernels built from evolve_plane.h
+ * cover the rule (they take over where they apply and must give the same
+ * bytes), generic if the expanded loops do everything, and full if
+ * hand-written evolvers cover every layout, so the expansion only documents
+ * the rule (frame rules only).
+ */
+
+/* Row parents. Mom comes first: RNG_BELOW(choice, 2) == 1 picks dad. */
+#define ROW_PARENTS_ABOVE(P) P(0, 0, -1)
+#define ROW_PARENTS_MOM_DAD(P) P(0, 1, -1) P(1, -1, -1)
+#define ROW_PARENTS_DAD_ABOVE(P) P(0, 0, -1) P(1, 1, -1)
+#define ROW_PARENTS_3(P) P(0, -1, -1) P(1, 0, -1) P(2, 1, -1)
+
+/* Frame parents: above, below, left, right, then the corners. */
+#define FRAME_PARENTS_4(P) P(0, 0, -1) P(1, 0, 1) P(2, -1, 0) P(3, 1, 0)
+#define FRAME_PARENTS_8(P) \
+    P(0, 0, -1) P(1, -1, -1) P(2, 1, -1) P(3, 0, 1) \
+    P(4, -1, 1) P(5, 1, 1) P(6, -1, 0) P(7, 1, 0)
+
+#define ROW_RULES(RULE) \
+    RULE(single_parent, ROW_PARENTS_ABOVE, gene, rise, vector) \
+    RULE(dad_mom_genes, ROW_PARENTS_MOM_DAD, gene, jitter, vector) \
+    RULE(dad_or_mom, ROW_PARENTS_MOM_DAD, pick_one, none, vector) \
+    RULE(3_parent_genes, ROW_PARENTS_3, gene, jitter, vector) \
+    RULE(dad_mom_average, ROW_PARENTS_MOM_DAD, average, spread, vector) \
+    RULE(dad_mom_dad_above, ROW_PARENTS_DAD_ABOVE, average, spread, vector) \
+    RULE(3_parent_bright, ROW_PARENTS_3, bright, jitter, generic)
+
+#define FRAME_RULES(RULE) \
+    RULE(4_parent_genes, FRAME_PARENTS_4, gene, jitter, vector) \
+    RULE(4_parent_average, FRAME_PARENTS_4, average, spread, vector) \
+    RULE(4_parent_pick_one, FRAME_PARENTS_4, pick_one, none, vector) \
+    RULE(8_parent_pick_one, FRAME_PARENTS_8, pick_one, none, vector) \
+    RULE(8_parent_extreme, FRAME_PARENTS_8, extreme, none, full) \
+    RULE(8_parent_bright, FRAME_PARENTS_8, bright, jitter, generic)
+
+#define RULE_COUNT_PARENT(k, dx, dy) + 1
+/* Number of parents in a parent list, as a constant expression. */
+#define RULE_N_PARENTS(parents) (0 parents(RULE_COUNT_PARENT))
+
+/* Whether an operator reads random bytes, so that loops can skip drawing. */
+#define RULE_USES_CHOICE_pick_one 1
+#define RULE_USES_CHOICE_gene 1
+#define RULE_USES_CHOICE_average 0
+#define RULE_USES_CHOICE_extreme 0
+#define RULE_USES_CHOICE_bright 0
+#define RULE_USES_NOISE_none 0
+#define RULE_USES_NOISE_jitter 1
+#define RULE_USES_NOISE_rise 1
+#define RULE_USES_NOISE_spread 1
+
+static __inline__ void rule_copy(int v[3], const unsigned char parent[3]) {
+    v[0] = parent[0];
+    v[1] = parent[1];
+    v[2] = parent[2];
+}
+
+static __inline__ void combine_pick_one(int n, unsigned char (*p)[3],
+                                        const unsigned char choice[3],
+                                        int v[3]) {
+    rule_copy(v, p[RNG_BELOW(choice[0], n)]);
+}
+
+static __inline__ void combine_gene(int n, unsigned char (*p)[3],
+                                    const unsigned char choice[3], int v[3]) {
+    int c;
+    for (c = 0; c < 3; ++c) {
+        v[c] = p[RNG_BELOW(choice[c], n)][c];
+    }
+}
+
+static __inline__ void combine_average(int n, unsigned char (*p)[3],
+                                       const unsigned char choice[3],
+                                       int v[3]) {
+    int c, k;
+    (void)choice;
+    for (c = 0; c < 3; ++c) {
+        v[c] = 0;
+        for (k = 0; k < n; ++k) {
+            v[c] += p[k][c] / n;
+        }
+    }
+}
+
+/**
+ * extremity() of pixel p: |max(r, min(g, b)) - max(g, b)|.
+ */
+static __inline__ int rule_extremity(const unsigned char p[3]) {
+    int low = p[1] < p[2] ? p[1] : p[2];
+    int high = p[1] < p[2] ? p[2] : p[1];
+    int middle = p[0] > low ? p[0] : low;
+    return high > middle ? high - middle : middle - high;
+}
+
+static __inline__ void combine_extreme(int n, unsigned char (*p)[3],
+                                       const unsigned char choice[3],
+                                       int v[3]) {
+    int k, best = 0, best_extremity = rule_extremity(p[0]), cur_extremity;
+    (void)choice;
+    for (k = 1; k < n; ++k) {
+        cur_extremity = rule_extremity(p[k]);
+        if (cur_extremity > best_extremity) {
+            best = k;
+            best_extremity = cur_extremity;
+        }
+    }
+    rule_copy(v, p[best]);
+}
+
+static __inline__ void combine_bright(int n, unsigned char (*p)[3],
+                                      const unsigned char choice[3],
+                                      int v[3]) {
+    int k, best = 0, best_sum = p[0][0] + p[0][1] + p[0][2], cur_sum;
+    (void)choice;
+    for (k = 1; k < n; ++k) {
+        cur_sum = p[k][0] + p[k][1] + p[k][2];
+        if (cur_sum > best_sum) {
+            best = k;
+            best_sum = cur_sum;
+        }
+    }
+    rule_copy(v, p[best]);
+}
+
+static __inline__ unsigned char noise_none(int value, unsigned char noise) {
+    (void)noise;
+    return (unsigned char)value;
+}
+
+static __inline__ unsigned char noise_jitter(int value, unsigned char noise) {
+    int sum = (unsigned char)value + (int)RNG_BELOW(noise, 17) - 8;
+    /*
+     * Small value, negative jitter would underflow: bounce up to a small
+     * positive value. Example: value = 4, jitter -7 gives 3, not 253.
+     *
+     * Big value, positive jitter would overflow: bounce down to a big value.
+     * Example: value = 250, jitter 10 gives 252, not 4.
+     *
+     * Written as a select rather than branches, as the sign of the jitter is
+     * random and would be mispredicted half the time.
+     */
+    return (unsigned char)(sum < 0 || sum > 255 ? -sum : sum);
+}
+
+static __inline__ unsigned char noise_rise(int value, unsigned char noise) {
+    return (unsigned char)(value + RNG_BELOW(noise, 16));
+}
+
+static __inline__ unsigned char noise_spread(int value, unsigned char noise) {
+    return (unsigned char)(value + RNG_BELOW(noise, 17) - 8);
+}
+
+/**
+ * Channels of pixel position (a multiple of step bytes from the start) of
+ * the row whose channels start at row.
+ */
+static __inline__ void rule_load(unsigned char p[3], const Planes *row,
+                                 ptrdiff_t position, size_t step) {
+    ptrdiff_t offset = position * (ptrdiff_t)step;
+    p[0] = row->channel[0][offset];
+    p[1] = row->channel[1][offset];
+    p[2] = row->channel[2][offset];
+}
+
+/**
+ * Channels of interleaved row pixels, a step of 3 bytes apart.
+ */
+static __inline__ void rule_pixel_planes(Planes *row, const Pixel *pixels) {
+    unsigned char *bytes = (unsigned char *)pixels;
+    row->channel[0] = bytes;
+    row->channel[1] = bytes + 1;
+    row->channel[2] = bytes + 2;
+}
+
+/*
+ * Parent loaders, for parents(P) inside RULE_PIXEL: position of parent k
+ * from the loop's i and, for frames, stride, or for rows, wrapping at size.
+ */
+#define RULE_LOAD_FRAME(k, dx, dy) \
+    rule_load(p[k], &src, (ptrdiff_t)i + (dx) + (dy) * (ptrdiff_t)stride, \
+              step);
+#define RULE_LOAD_ROW(k, dx, dy) \
+    rule_load(p[k], &src, (ptrdiff_t)i + (dx), step);
+#define RULE_LOAD_ROW_WRAPPED(k, dx, dy) \
+    rule_load(p[k], &src, (ptrdiff_t)((i + size + (dx)) % size), step);
+
+/*
+ * Evolve pixel i of dst from src with rule parents, combine_op, noise_op,
+ * loading parents with LOAD. dst and src are Planes a step of step bytes per
+ * pixel, choice and noise random bytes a step of random_step.
+ */
+#define RULE_PIXEL(parents, combine_op, noise_op, LOAD) do { \
+    unsigned char p[RULE_N_PARENTS(parents)][3]; \
+    unsigned char choice_bytes[3], noise_bytes[3]; \
+    int value[3], c; \
+    parents(LOAD) \
+    for (c = 0; c < 3; ++c) { \
+        if (RULE_USES_CHOICE_##combine_op) { \
+            choice_bytes[c] = choice.channel[c][i * random_step]; \
+        } \
+        if (RULE_USES_NOISE_##noise_op) { \
+            noise_bytes[c] = noise.channel[c][i * random_step]; \
+        } \
+    } \
+    combine_##combine_op(RULE_N_PARENTS(parents), p, choice_bytes, value); \
+    for (c = 0; c < 3; ++c) { \
+        dst.channel[c][i * step] = noise_##noise_op(value[c], \
+                                                    noise_bytes[c]); \
+    } \
+} while (0)
+
+#endif /* RULE_H */
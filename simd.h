@@ -0,0 +1,125 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * Thin layer over SSE2 or AVX2 integer intrinsics, whichever the compiler
+ * targets (see ARCH in the Makefile), so that vector kernels are written
+ * once. SIMD is defined when either is available; code without it falls
+ * back to the scalar paths. All operations work on unsigned bytes unless the
+ * name says otherwise (u16 = 16-bit lanes, and so on; mul_even_u32 multiplies
+ * the even 32-bit lanes into 64-bit products). Unpack and pack operate within
+ * 128-bit lanes, so unpacking into u16 and packing back preserves order;
+ * packus_u16_across packs all of a, then all of b.
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD 1
+#define VEC_BYTES 32
+typedef __m256i Vec;
+#define vec_load(p) _mm256_loadu_si256((const Vec *)(const void *)(p))
+#define vec_store(p, v) _mm256_storeu_si256((Vec *)(void *)(p), (v))
+#define vec_set1(b) _mm256_set1_epi8((char)(b))
+#define vec_set1_u16(w) _mm256_set1_epi16((short)(w))
+#define vec_zero() _mm256_setzero_si256()
+#define vec_and(a, b) _mm256_and_si256((a), (b))
+#define vec_andnot(a, b) _mm256_andnot_si256((a), (b))
+#define vec_or(a, b) _mm256_or_si256((a), (b))
+#define vec_add(a, b) _mm256_add_epi8((a), (b))
+#define vec_sub(a, b) _mm256_sub_epi8((a), (b))
+#define vec_adds(a, b) _mm256_adds_epu8((a), (b))
+#define vec_subs(a, b) _mm256_subs_epu8((a), (b))
+#define vec_min(a, b) _mm256_min_epu8((a), (b))
+#define vec_max(a, b) _mm256_max_epu8((a), (b))
+#define vec_avg(a, b) _mm256_avg_epu8((a), (b))
+#define vec_cmpeq(a, b) _mm256_cmpeq_epi8((a), (b))
+#define vec_unpacklo(a, b) _mm256_unpacklo_epi8((a), (b))
+#define vec_unpackhi(a, b) _mm256_unpackhi_epi8((a), (b))
+#define vec_add_u16(a, b) _mm256_add_epi16((a), (b))
+#define vec_sub_u16(a, b) _mm256_sub_epi16((a), (b))
+#define vec_mullo_u16(a, b) _mm256_mullo_epi16((a), (b))
+#define vec_srli_u16(a, n) _mm256_srli_epi16((a), (n))
+#define vec_slli_u16(a, n) _mm256_slli_epi16((a), (n))
+#define vec_packus_u16(a, b) _mm256_packus_epi16((a), (b))
+#define vec_packus_u16_across(a, b) \
+    _mm256_permute4x64_epi64(_mm256_packus_epi16((a), (b)), 0xD8)
+#define vec_xor(a, b) _mm256_xor_si256((a), (b))
+#define vec_set1_u32(d) _mm256_set1_epi32((int)(d))
+#define vec_add_u32(a, b) _mm256_add_epi32((a), (b))
+#define vec_mul_even_u32(a, b) _mm256_mul_epu32((a), (b))
+#define vec_srli_u64(a, n) _mm256_srli_epi64((a), (n))
+#define vec_slli_u64(a, n) _mm256_slli_epi64((a), (n))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD 1
+#define VEC_BYTES 16
+typedef __m128i Vec;
+#define vec_load(p) _mm_loadu_si128((const Vec *)(const void *)(p))
+#define vec_store(p, v) _mm_storeu_si128((Vec *)(void *)(p), (v))
+#define vec_set1(b) _mm_set1_epi8((char)(b))
+#define vec_set1_u16(w) _mm_set1_epi16((short)(w))
+#define vec_zero() _mm_setzero_si128()
+#define vec_and(a, b) _mm_and_si128((a), (b))
+#define vec_andnot(a, b) _mm_andnot_si128((a), (b))
+#define vec_or(a, b) _mm_or_si128((a), (b))
+#define vec_add(a, b) _mm_add_epi8((a), (b))
+#define vec_sub(a, b) _mm_sub_epi8((a), (b))
+#define vec_adds(a, b) _mm_adds_epu8((a), (b))
+#define vec_subs(a, b) _mm_subs_epu8((a), (b))
+#define vec_min(a, b) _mm_min_epu8((a), (b))
+#define vec_max(a, b) _mm_max_epu8((a), (b))
+#define vec_avg(a, b) _mm_avg_epu8((a), (b))
+#define vec_cmpeq(a, b) _mm_cmpeq_epi8((a), (b))
+#define vec_unpacklo(a, b) _mm_unpacklo_epi8((a), (b))
+#define vec_unpackhi(a, b) _mm_unpackhi_epi8((a), (b))
+#define vec_add_u16(a, b) _mm_add_epi16((a), (b))
+#define vec_sub_u16(a, b) _mm_sub_epi16((a), (b))
+#define vec_mullo_u16(a, b) _mm_mullo_epi16((a), (b))
+#define vec_srli_u16(a, n) _mm_srli_epi16((a), (n))
+#define vec_slli_u16(a, n) _mm_slli_epi16((a), (n))
+#define vec_packus_u16(a, b) _mm_packus_epi16((a), (b))
+#define vec_packus_u16_across(a, b) _mm_packus_epi16((a), (b))
+#define vec_xor(a, b) _mm_xor_si128((a), (b))
+#define vec_set1_u32(d) _mm_set1_epi32((int)(d))
+#define vec_add_u32(a, b) _mm_add_epi32((a), (b))
+#define vec_mul_even_u32(a, b) _mm_mul_epu32((a), (b))
+#define vec_srli_u64(a, n) _mm_srli_epi64((a), (n))
+#define vec_slli_u64(a, n) _mm_slli_epi64((a), (n))
+#endif
+
+#ifdef SIMD
+/* Where mask bytes are 0xFF take a, else b. */
+#define vec_select(mask, a, b) vec_or(vec_and((mask), (a)), \
+                                      vec_andnot((mask), (b)))
+/* 0xFF where a <= b (unsigned), else 0. */
+#define vec_le(a, b) vec_cmpeq(vec_min((a), (b)), (a))
+
+/**
+ * RNG_BELOW(byte, n) for every byte.
+ */
+static __inline__ Vec vec_below(Vec bytes, int n) {
+    Vec lo = vec_unpacklo(bytes, vec_zero());
+    Vec hi = vec_unpackhi(bytes, vec_zero());
+    lo = vec_srli_u16(vec_mullo_u16(lo, vec_set1_u16(n)), 8);
+    hi = vec_srli_u16(vec_mullo_u16(hi, vec_set1_u16(n)), 8);
+    return vec_packus_u16(lo, hi);
+}
+
+/**
+ * jitter(value, noise) for every byte, bounce included.
+ */
+static __inline__ Vec vec_jitter(Vec value, Vec noise) {
+    Vec amount = vec_below(noise, 17);
+    /* Jitter amount - 8 split into its positive and negative part. */
+    Vec up = vec_subs(amount, vec_set1(8));
+    Vec down = vec_subs(vec_set1(8), amount);
+    Vec raised = vec_add(value, up);
+    Vec result = vec_sub(raised, down);
+    /* No underflow (down <= value) and no overflow (saturation is a no-op). */
+    Vec in_range = vec_and(vec_cmpeq(vec_subs(down, value), vec_zero()),
+                           vec_cmpeq(vec_adds(value, up), raised));
+    return vec_select(in_range, result, vec_sub(vec_zero(), result));
+}
+#endif
+
+#endif /* SIMD_H */
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+struct Thread_pool {
+    pthread_t *workers;
+    size_t n_workers;
+
+    pthread_mutex_t lock;
+    /* Signalled when a new batch is posted or the pool shuts down. */
+    pthread_cond_t batch_posted;
+    /* Signalled when the last task of a batch finishes. */
+    pthread_cond_t batch_done;
+
+    /* Current batch, protected by lock. */
+    Task task;
+    void *arg;
+    size_t n_tasks;
+    size_t next_task;
+    size_t n_finished;
+    unsigned long batch;
+    int shutting_down;
+};
+
+/**
+ * Claim and run tasks of the current batch until there are none left.
+ * Called with lock held, returns with lock held.
+ */
+static void run_tasks(Thread_pool *pool) {
+    while (pool->next_task < pool->n_tasks) {
+        size_t task_index = pool->next_task++;
+        pthread_mutex_unlock(&pool->lock);
+        (*pool->task)(pool->arg, task_index);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->n_finished == pool->n_tasks) {
+            pthread_cond_broadcast(&pool->batch_done);
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    Thread_pool *pool = arg;
+    unsigned long seen_batch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutting_down && pool->batch == seen_batch) {
+            pthread_cond_wait(&pool->batch_posted, &pool->lock);
+        }
+        if (pool->shutting_down) {
+            break;
+        }
+        seen_batch = pool->batch;
+        run_tasks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+Thread_pool *thread_pool_create(size_t n_threads) {
+    Thread_pool *pool;
+    size_t i;
+
+    if (n_threads == 0) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? (size_t)n_cpus : 1;
+    }
+
+    pool = malloc(sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->n_workers = n_threads - 1;
+    pool->workers = malloc((pool->n_workers + 1) * sizeof(*pool->workers));
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->n_tasks = pool->next_task = pool->n_finished = 0;
+    pool->batch = 0;
+    pool->shutting_down = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->batch_posted, NULL);
+    pthread_cond_init(&pool->batch_done, NULL);
+
+    for (i = 0; i < pool->n_workers; ++i) {
+        if (pthread_create(pool->workers + i, NULL, &worker_main, pool)) {
+            fprintf(stderr, "Failed to start worker thread.\n");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void thread_pool_run(Thread_pool *pool, Task task, void *arg, size_t n_tasks) {
+    if (n_tasks == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->n_tasks = n_tasks;
+    pool->next_task = 0;
+    pool->n_finished = 0;
+    ++pool->batch;
+    pthread_cond_broadcast(&pool->batch_posted);
+
+    /* Calling thread works too, then waits for stragglers. */
+    run_tasks(pool);
+    while (pool->n_finished < pool->n_tasks) {
+        pthread_cond_wait(&pool->batch_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t thread_pool_size(const Thread_pool *pool) {
+    return pool->n_workers + 1;
+}
+
+void thread_pool_free(Thread_pool *pool) {
+    size_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->batch_posted);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->n_workers; ++i) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->batch_posted);
+    pthread_cond_destroy(&pool->batch_done);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,38 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <stddef.h>
+
+/**
+ * Fixed set of worker threads that live for the whole run and execute
+ * batches of independent tasks.
+ */
+typedef struct Thread_pool Thread_pool;
+
+/**
+ * Task function: called once for every task_index in [0, n_tasks).
+ */
+typedef void (*Task)(void *arg, size_t task_index);
+
+/**
+ * Create pool running tasks on n_threads threads in total, the calling
+ * thread included. n_threads == 0 means one per online CPU.
+ */
+Thread_pool *thread_pool_create(size_t n_threads);
+
+/**
+ * Run task for every index in [0, n_tasks) and wait for all of them to
+ * finish. Tasks may run in any order on any thread.
+ */
+void thread_pool_run(Thread_pool *pool, Task task, void *arg, size_t n_tasks);
+
+/**
+ * Number of threads, calling thread included.
+ */
+size_t thread_pool_size(const Thread_pool *pool);
+
+/**
+ * Join workers and free pool.
+ */
+void thread_pool_free(Thread_pool *pool);
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,170 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tiling.h"
+
+/* Cache for the two band images of a tile: a typical L2. */
+#define TILE_CACHE_BYTES (512 * 1024)
+/*
+ * Tiles are at least this many times as tall as a pass is deep. Each
+ * generation of a pass of depth n computes n - 1 rows per tile more than
+ * the tile on average, so this bounds that extra work to a quarter.
+ */
+#define MIN_TILE_DEPTHS 4
+
+struct Tiling {
+    size_t width;
+    size_t height;
+    size_t depth;
+    size_t tile_rows;
+    size_t n_tiles;
+    /* Two band images per tile, of tile_rows + 2 * depth rows. */
+    Image **bands;
+};
+
+Tiling *tiling_create(size_t width, size_t height, int planar, size_t depth,
+                      const Thread_pool *pool) {
+    Tiling *tiling = malloc(sizeof(*tiling));
+    size_t n_threads = thread_pool_size(pool);
+    /* Rows of both band images that fit in cache, halo included. */
+    size_t cached_rows = TILE_CACHE_BYTES / (2 * 3 * (width + 2));
+    size_t i;
+
+    if (!tiling) {
+        return NULL;
+    }
+    assert(depth >= 1 && height >= 1);
+    tiling->width = width;
+    tiling->height = height;
+    tiling->depth = depth;
+    /*
+     * Tiles as tall as fit in cache with their overlap, but not so short
+     * that the overlap costs more than the cache saves, and enough of them
+     * to go around the threads.
+     */
+    tiling->tile_rows = cached_rows > (MIN_TILE_DEPTHS + 2) * depth
+                            ? cached_rows - 2 * depth
+                            : MIN_TILE_DEPTHS * depth;
+    if (tiling->tile_rows > (height + n_threads - 1) / n_threads) {
+        tiling->tile_rows = (height + n_threads - 1) / n_threads;
+    }
+    tiling->n_tiles = (height + tiling->tile_rows - 1) / tiling->tile_rows;
+    tiling->bands = calloc(2 * tiling->n_tiles, sizeof(*tiling->bands));
+    if (!tiling->bands) {
+        free(tiling);
+        return NULL;
+    }
+    for (i = 0; i < 2 * tiling->n_tiles; ++i) {
+        tiling->bands[i] = malloc_image_layout(
+            width, tiling->tile_rows + 2 * depth, 1, planar);
+        if (!tiling->bands[i]) {
+            tiling_free(tiling);
+            return NULL;
+        }
+    }
+    return tiling;
+}
+
+size_t tiling_tile_rows(const Tiling *tiling) {
+    return tiling->tile_rows;
+}
+
+/**
+ * Copy row src_y of src_image to row dst_y of dst_image, both of the same
+ * width and layout.
+ */
+static void copy_row(Image *dst_image, size_t dst_y, const Image *src_image,
+                     size_t src_y) {
+    int c;
+    if (dst_image->planar) {
+        for (c = 0; c < 3; ++c) {
+            memcpy(dst_image->planes.channel[c] + dst_y * dst_image->stride,
+                   src_image->planes.channel[c] + src_y * src_image->stride,
+                   dst_image->width);
+        }
+    } else {
+        memcpy(dst_image->pixels + dst_y * dst_image->stride,
+               src_image->pixels + src_y * src_image->stride,
+               dst_image->width * sizeof(Pixel));
+    }
+}
+
+/**
+ * One block of generations shared by all tile tasks.
+ */
+typedef struct Tile_job {
+    Tiling *tiling;
+    Image_evolver image_evolver;
+    Image **dst_images;
+    const Image *src_image;
+    size_t n;
+    const Rng *rng;
+    size_t frame;
+} Tile_job;
+
+static void evolve_tile(void *arg, size_t tile) {
+    const Tile_job *job = arg;
+    const Tiling *tiling = job->tiling;
+    Image **bands = tiling->bands + 2 * tile;
+    size_t height = tiling->height, n = job->n;
+    size_t first = tile * tiling->tile_rows;
+    size_t rows = height - first < tiling->tile_rows ? height - first
+                                                     : tiling->tile_rows;
+    /* The tile and n rows on either side, wrapping around the frame. */
+    size_t band_rows = rows + 2 * n;
+    size_t band_top = (first + height - n % height) % height;
+    size_t g, j;
+
+    for (g = 0; g < 2; ++g) {
+        bands[g]->band_top = band_top;
+        bands[g]->frame_height = height;
+    }
+    for (j = 0; j < band_rows; ++j) {
+        copy_row(bands[0], j, job->src_image, (band_top + j) % height);
+    }
+    refresh_halo_columns(bands[0], 0, band_rows);
+    /* Generation g is valid in rows [g, band_rows - g) of its band. */
+    for (g = 1; g <= n; ++g) {
+        Image *band = bands[g % 2];
+        (*job->image_evolver)(band, bands[(g - 1) % 2], job->rng,
+                              job->frame + g, g, band_rows - g);
+        refresh_halo_columns(band, g, band_rows - g);
+        if (job->dst_images[g - 1]) {
+            for (j = 0; j < rows; ++j) {
+                copy_row(job->dst_images[g - 1], first + j, band, n + j);
+            }
+        }
+    }
+}
+
+void evolve_tiles(Tiling *tiling, Thread_pool *pool,
+                  Image_evolver image_evolver, Image **dst_images,
+                  const Image *src_image, size_t n, const Rng *rng,
+                  size_t frame) {
+    Tile_job job;
+
+    assert(1 <= n && n <= tiling->depth);
+    assert(dst_images[n - 1]);
+    assert(src_image->width == tiling->width);
+    assert(src_image->height == tiling->height);
+    job.tiling = tiling;
+    job.image_evolver = image_evolver;
+    job.dst_images = dst_images;
+    job.src_image = src_image;
+    job.n = n;
+    job.rng = rng;
+    job.frame = frame;
+    thread_pool_run(pool, &evolve_tile, &job, tiling->n_tiles);
+    refresh_halo(dst_images[n - 1]);
+}
+
+void tiling_free(Tiling *tiling) {
+    size_t i;
+    for (i = 0; i < 2 * tiling->n_tiles; ++i) {
+        if (tiling->bands[i]) {
+            free_image(tiling->bands[i]);
+        }
+    }
+    free(tiling->bands);
+    free(tiling);
+}
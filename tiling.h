@@ -0,0 +1,54 @@
+#ifndef TILING_H
+#define TILING_H
+#include "evolve_image.h"
+#include "image.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+/**
+ * Temporal blocking: evolve a frame several generations at once, one band of
+ * rows at a time, so that each band stays in cache for all of them instead
+ * of every generation streaming whole frames through memory.
+ *
+ * A frame is cut into bands of rows (tiles). To advance by depth
+ * generations, each tile copies its rows plus depth more on either side
+ * (wrapping around the frame) into a pair of band images, and evolves them
+ * there, each generation valid one row further in from either end: a
+ * trapezoid in rows and time, whose last generation covers exactly the rows
+ * of the tile. The overlap is computed twice, by neighbouring tiles, which
+ * is what makes tiles independent; they run on the threads of a pool.
+ * Random bytes are keyed by frame row, so the frames are the same as from
+ * evolve_image_parallel, bit for bit.
+ *
+ * Memory traffic is a read of the source and a write of each frame kept per
+ * depth generations, rather than a read and a write per generation.
+ */
+typedef struct Tiling Tiling;
+
+/**
+ * Plan tiles for width x height frames, planar or not, advancing up to depth
+ * generations at a time, with at least one tile per thread of pool. Returns
+ * NULL if out of memory.
+ */
+Tiling *tiling_create(size_t width, size_t height, int planar, size_t depth,
+                      const Thread_pool *pool);
+
+/**
+ * Rows per tile, for reporting.
+ */
+size_t tiling_tile_rows(const Tiling *tiling);
+
+/**
+ * Evolve src_image, frame number frame, by n generations (at most the depth
+ * of tiling) with image_evolver, writing generation g to dst_images[g - 1].
+ * Entries other than the last may be NULL for generations not wanted. The
+ * halo of the last is refreshed, so that it can be the next source.
+ */
+void evolve_tiles(Tiling *tiling, Thread_pool *pool,
+                  Image_evolver image_evolver, Image **dst_images,
+                  const Image *src_image, size_t n, const Rng *rng,
+                  size_t frame);
+
+void tiling_free(Tiling *tiling);
+
+#endif /* TILING_H */
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "trace.h"
+
+/* Latencies are bucketed by powers of two of nanoseconds. */
+#define N_BUCKETS 48
+/* Threads told apart in the Chrome trace; more share the last id. */
+#define MAX_THREADS 256
+
+typedef struct Phase_stats {
+    size_t count;
+    double total;
+    double max;
+    /* Bucket k counts spans of [2^k, 2^(k + 1)) nanoseconds. */
+    size_t buckets[N_BUCKETS];
+} Phase_stats;
+
+typedef struct Counter {
+    const char *name;
+    unsigned type;
+    unsigned long config;
+} Counter;
+
+#ifdef __linux__
+static const Counter counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+#define N_COUNTERS (sizeof(counters) / sizeof(*counters))
+#else
+#define N_COUNTERS 0
+#endif
+
+static const char *phase_names[TRACE_N_PHASES] = {
+    "alloc", "evolve", "encode", "write", "output", "checkpt"};
+
+typedef struct Trace_state {
+    int enabled;
+    /* Time of trace_start; trace timestamps count from it. */
+    double origin;
+    pthread_mutex_t lock;
+    Phase_stats phases[TRACE_N_PHASES];
+
+    FILE *chrome;
+    size_t n_events;
+    pthread_t threads[MAX_THREADS];
+    size_t n_threads;
+
+    /* Counter file descriptors, -1 where unavailable. */
+    int counter_fds[N_COUNTERS + 1];
+    int counter_error;
+} Trace_state;
+
+static Trace_state state;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + 1e-9 * (double)time.tv_nsec;
+}
+
+/**
+ * Small number naming the calling thread in the Chrome trace. Called with
+ * lock held.
+ */
+static size_t thread_id(void) {
+    pthread_t self = pthread_self();
+    size_t i;
+    for (i = 0; i < state.n_threads; ++i) {
+        if (pthread_equal(state.threads[i], self)) {
+            return i;
+        }
+    }
+    if (state.n_threads == MAX_THREADS) {
+        return MAX_THREADS - 1;
+    }
+    state.threads[state.n_threads] = self;
+    return state.n_threads++;
+}
+
+/**
+ * Open the hardware counters, counting this process and the threads it
+ * starts from now on. Counters that cannot be opened stay at -1.
+ */
+static void open_counters(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    size_t i;
+
+    for (i = 0; i < N_COUNTERS; ++i) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        state.counter_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0,
+                                            -1, -1, 0);
+        if (state.counter_fds[i] < 0) {
+            state.counter_error = errno;
+        }
+    }
+#else
+    state.counter_error = ENOSYS;
+#endif
+}
+
+static void close_counters(FILE *summary) {
+#ifdef __linux__
+    uint64_t values[N_COUNTERS];
+    int valid[N_COUNTERS];
+    size_t i;
+
+    for (i = 0; i < N_COUNTERS; ++i) {
+        valid[i] = state.counter_fds[i] >= 0 &&
+                   read(state.counter_fds[i], values + i, sizeof(*values)) ==
+                       (ssize_t)sizeof(*values);
+        if (state.counter_fds[i] >= 0) {
+            close(state.counter_fds[i]);
+        }
+        if (summary && valid[i]) {
+            fprintf(summary, "  %-14s %15lu\n", counters[i].name,
+                    (unsigned long)values[i]);
+        }
+    }
+    /* cycles and instructions */
+    if (summary && valid[0] && valid[1] && values[0] > 0) {
+        fprintf(summary, "  %-14s %15.2f\n", "IPC",
+                (double)values[1] / (double)values[0]);
+    }
+#endif
+    if (summary && state.counter_error) {
+        fprintf(summary, "  Some hardware counters are unavailable: %s.\n",
+                strerror(state.counter_error));
+    }
+}
+
+int trace_start(const char *trace_path, int counters_wanted) {
+    size_t i;
+
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < N_COUNTERS; ++i) {
+        state.counter_fds[i] = -1;
+    }
+    if (trace_path) {
+        state.chrome = fopen(trace_path, "w");
+        if (!state.chrome) {
+            return 0;
+        }
+        fprintf(state.chrome, "{\"traceEvents\": [");
+    }
+    if (counters_wanted) {
+        open_counters();
+    }
+    pthread_mutex_init(&state.lock, NULL);
+    state.origin = now();
+    state.enabled = 1;
+    return 1;
+}
+
+double trace_begin(void) {
+    return state.enabled ? now() : 0;
+}
+
+void trace_end(Trace_phase phase, double start, size_t frame) {
+    Phase_stats *stats = state.phases + phase;
+    double end, seconds, ns;
+    int bucket;
+
+    if (!state.enabled) {
+        return;
+    }
+    end = now();
+    seconds = end - start;
+    for (bucket = 0, ns = 2; bucket < N_BUCKETS - 1 && ns <= 1e9 * seconds;
+         ++bucket, ns *= 2) {
+    }
+
+    pthread_mutex_lock(&state.lock);
+    ++stats->count;
+    stats->total += seconds;
+    if (seconds > stats->max) {
+        stats->max = seconds;
+    }
+    ++stats->buckets[bucket];
+    if (state.chrome) {
+        fprintf(state.chrome,
+                "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f,"
+                " \"dur\": %.3f, \"pid\": 1, \"tid\": %lu",
+                state.n_events ? "," : "", phase_names[phase],
+                1e6 * (start - state.origin), 1e6 * seconds,
+                (unsigned long)thread_id());
+        if (frame != TRACE_NO_FRAME) {
+            fprintf(state.chrome, ", \"args\": {\"frame\": %lu}",
+                    (unsigned long)frame);
+        }
+        fputc('}', state.chrome);
+        ++state.n_events;
+    }
+    pthread_mutex_unlock(&state.lock);
+}
+
+/**
+ * Upper bound in seconds of the span at fraction of the way through stats,
+ * from its histogram.
+ */
+static double percentile(const Phase_stats *stats, double fraction) {
+    size_t seen = 0;
+    double ns = 2;
+    int bucket;
+
+    for (bucket = 0; bucket < N_BUCKETS; ++bucket, ns *= 2) {
+        seen += stats->buckets[bucket];
+        if ((double)seen >= fraction * (double)stats->count) {
+            break;
+        }
+    }
+    return 1e-9 * ns < stats->max ? 1e-9 * ns : stats->max;
+}
+
+static void print_histogram(FILE *summary, const Phase_stats *stats) {
+    double ns = 2;
+    int bucket;
+
+    fprintf(summary, "  %-7s", "");
+    for (bucket = 0; bucket < N_BUCKETS; ++bucket, ns *= 2) {
+        if (stats->buckets[bucket] == 0) {
+            continue;
+        }
+        if (ns <= 1e6) {
+            fprintf(summary, " <%.3gus:%lu", ns / 1e3,
+                    (unsigned long)stats->buckets[bucket]);
+        } else {
+            fprintf(summary, " <%.3gms:%lu", ns / 1e6,
+                    (unsigned long)stats->buckets[bucket]);
+        }
+    }
+    fputc('\n', summary);
+}
+
+void trace_finish(FILE *summary) {
+    const Phase_stats *stats;
+    int phase;
+
+    if (!state.enabled) {
+        return;
+    }
+    state.enabled = 0;
+    if (state.chrome) {
+        fprintf(state.chrome, "\n]}\n");
+        fclose(state.chrome);
+    }
+    if (summary) {
+        fprintf(summary, "Phase      count   total s   mean ms    p50 ms"
+                         "    p90 ms    p99 ms    max ms\n");
+        for (phase = 0; phase < TRACE_N_PHASES; ++phase) {
+            stats = state.phases + phase;
+            if (stats->count == 0) {
+                continue;
+            }
+            fprintf(summary,
+                    "  %-7s %6lu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                    phase_names[phase], (unsigned long)stats->count,
+                    stats->total, 1e3 * stats->total / (double)stats->count,
+                    1e3 * percentile(stats, 0.5),
+                    1e3 * percentile(stats, 0.9),
+                    1e3 * percentile(stats, 0.99), 1e3 * stats->max);
+            print_histogram(summary, stats);
+        }
+    }
+    close_counters(summary);
+    pthread_mutex_destroy(&state.lock);
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Timing of the phases of a run: how long each allocation, frame evolution,
+ * encoding and write took, summed into per-phase latency histograms and
+ * optionally exported as a Chrome trace (chrome://tracing, Perfetto).
+ *
+ * Tracing is off until trace_start; until then spans cost one branch, so
+ * code shared with programs that never trace is instrumented regardless.
+ * Spans may be recorded from any thread.
+ */
+typedef enum Trace_phase {
+    /* Allocating frame buffers. */
+    TRACE_ALLOC,
+    /* Evolving one frame, halo included. */
+    TRACE_EVOLVE,
+    /* Turning pixels into output bytes (PNG, Y4M, P3). */
+    TRACE_ENCODE,
+    /* Handing bytes to stdio. */
+    TRACE_WRITE,
+    /* Producing one frame of output: its encode and write spans. */
+    TRACE_OUTPUT,
+    /* Copying a frame aside for a checkpoint (see checkpoint.h). */
+    TRACE_CHECKPOINT,
+    TRACE_N_PHASES
+} Trace_phase;
+
+/* Frame number of spans that do not belong to a frame. */
+#define TRACE_NO_FRAME ((size_t)-1)
+
+/**
+ * Start tracing. If trace_path is not NULL, spans are also written there as
+ * a Chrome trace. If counters is nonzero, count CPU cycles, instructions and
+ * cache misses for the whole process, where perf_event_open allows it.
+ * Call before starting any threads. Returns nonzero on success.
+ */
+int trace_start(const char *trace_path, int counters);
+
+/**
+ * Start of a span, to be passed to trace_end.
+ */
+double trace_begin(void);
+
+/**
+ * Record a span of phase from start (see trace_begin) to now.
+ */
+void trace_end(Trace_phase phase, double start, size_t frame);
+
+/**
+ * Stop tracing: finish the Chrome trace and print per-phase latency
+ * summaries and counters to summary (if not NULL). Call after all threads
+ * that recorded spans or were counted have exited.
+ */
+void trace_finish(FILE *summary);
+
+#endif /* TRACE_H */
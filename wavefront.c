@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200112L
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wavefront.h"
+
+/* Columns per chunk, at most: how far ahead of a neighbour a strip runs. */
+#define CHUNK_COLUMNS 2048
+/* Narrowest strip worth a thread of its own. */
+#define MIN_STRIP_COLUMNS 256
+/* Polls of a progress counter before giving up the CPU between polls. */
+#define SPINS_BEFORE_YIELD 1024
+#define CACHE_LINE_BYTES 64
+
+/* Rows done of one chunk, on a cache line of its own. */
+typedef struct Progress {
+    size_t rows;
+    char padding[CACHE_LINE_BYTES - sizeof(size_t)];
+} Progress;
+
+typedef struct Wavefront {
+    Image *image;
+    Row_evolver row_evolver;
+    Planar_row_evolver planar_row_evolver;
+    const Rng *rng;
+    /* Chunk c is columns [chunk_first[c], chunk_first[c + 1]). */
+    size_t n_chunks;
+    size_t *chunk_first;
+    size_t widest_chunk;
+    /* Strip s is chunks [strip_first[s], strip_first[s + 1]). */
+    size_t *strip_first;
+    Progress *progress;
+} Wavefront;
+
+/**
+ * Rows for evolving one chunk of n columns as a row of n + 2: the chunk and
+ * a column on either side, whose own results are thrown away. Every row is
+ * 3 * (widest chunk + 2) bytes, interleaved or planar.
+ */
+typedef struct Window {
+    unsigned char *bytes;
+    /* Interleaved and planar views of the same four rows. */
+    Pixel *pixels[4];
+    Planes planes[4];
+} Window;
+
+enum { WINDOW_SRC, WINDOW_DST, WINDOW_CHOICE, WINDOW_NOISE };
+
+static void wait_for_rows(const Progress *progress, size_t rows) {
+    unsigned spins = 0;
+    while (__atomic_load_n(&progress->rows, __ATOMIC_ACQUIRE) < rows) {
+        if (++spins > SPINS_BEFORE_YIELD) {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Row j of the chunk from first to last of an interleaved image.
+ */
+static void evolve_chunk(const Wavefront *wavefront, Window *window,
+                         size_t first, size_t last, size_t j) {
+    const Image *image = wavefront->image;
+    size_t width = image->width, n = last - first;
+    size_t left = (first + width - 1) % width, right = last % width;
+    Pixel *row = image->pixels + j * image->stride;
+    Pixel *gathered = window->pixels[WINDOW_SRC];
+    const Pixel *above, *src;
+
+    if (j == 0) {
+        rng_fill_row(wavefront->rng, 0, 0, RNG_INIT, row + first, first, n);
+        return;
+    }
+    above = row - image->stride;
+    /* Neighbours are in place, except around the ends of the row. */
+    if (first > 0 && last < width) {
+        src = above + first - 1;
+    } else {
+        gathered[0] = above[left];
+        memcpy(gathered + 1, above + first, n * sizeof(*gathered));
+        gathered[n + 1] = above[right];
+        src = gathered;
+    }
+    rng_fill_row(wavefront->rng, 0, j, RNG_CHOICE,
+                 window->pixels[WINDOW_CHOICE] + 1, first, n);
+    rng_fill_row(wavefront->rng, 0, j, RNG_NOISE,
+                 window->pixels[WINDOW_NOISE] + 1, first, n);
+    (*wavefront->row_evolver)(window->pixels[WINDOW_DST], src, n + 2,
+                              window->pixels[WINDOW_CHOICE],
+                              window->pixels[WINDOW_NOISE]);
+    memcpy(row + first, window->pixels[WINDOW_DST] + 1, n * sizeof(*row));
+}
+
+/**
+ * Same as evolve_chunk, for a planar image.
+ */
+static void evolve_planar_chunk(const Wavefront *wavefront, Window *window,
+                                size_t first, size_t last, size_t j) {
+    const Image *image = wavefront->image;
+    size_t width = image->width, n = last - first;
+    size_t left = (first + width - 1) % width, right = last % width;
+    Planes row = planes_row(image, j), above, src, choice, noise;
+    int c;
+
+    if (j == 0) {
+        for (c = 0; c < 3; ++c) {
+            row.channel[c] += first;
+        }
+        rng_fill_planes(wavefront->rng, 0, 0, RNG_INIT, &row, first, n);
+        return;
+    }
+    above = planes_row(image, j - 1);
+    for (c = 0; c < 3; ++c) {
+        if (first > 0 && last < width) {
+            src.channel[c] = above.channel[c] + first - 1;
+        } else {
+            src.channel[c] = window->planes[WINDOW_SRC].channel[c];
+            src.channel[c][0] = above.channel[c][left];
+            memcpy(src.channel[c] + 1, above.channel[c] + first, n);
+            src.channel[c][n + 1] = above.channel[c][right];
+        }
+        choice.channel[c] = window->planes[WINDOW_CHOICE].channel[c] + 1;
+        noise.channel[c] = window->planes[WINDOW_NOISE].channel[c] + 1;
+    }
+    rng_fill_planes(wavefront->rng, 0, j, RNG_CHOICE, &choice, first, n);
+    rng_fill_planes(wavefront->rng, 0, j, RNG_NOISE, &noise, first, n);
+    (*wavefront->planar_row_evolver)(window->planes + WINDOW_DST, &src, n + 2,
+                                     window->planes + WINDOW_CHOICE,
+                                     window->planes + WINDOW_NOISE);
+    for (c = 0; c < 3; ++c) {
+        memcpy(row.channel[c] + first,
+               window->planes[WINDOW_DST].channel[c] + 1, n);
+    }
+}
+
+/**
+ * Row j of chunk c, once the chunks around it are done with row j - 1.
+ */
+static void run_chunk(Wavefront *wavefront, Window *window, size_t c,
+                      size_t j) {
+    size_t n_chunks = wavefront->n_chunks;
+    size_t first = wavefront->chunk_first[c];
+    size_t last = wavefront->chunk_first[c + 1];
+
+    if (j > 0) {
+        wait_for_rows(wavefront->progress + (c + n_chunks - 1) % n_chunks, j);
+        wait_for_rows(wavefront->progress + (c + 1) % n_chunks, j);
+    }
+    if (wavefront->image->planar) {
+        evolve_planar_chunk(wavefront, window, first, last, j);
+    } else {
+        evolve_chunk(wavefront, window, first, last, j);
+    }
+    __atomic_store_n(&wavefront->progress[c].rows, j + 1, __ATOMIC_RELEASE);
+}
+
+static void run_strip(void *arg, size_t strip) {
+    Wavefront *wavefront = arg;
+    size_t first = wavefront->strip_first[strip];
+    size_t last = wavefront->strip_first[strip + 1];
+    size_t size = wavefront->widest_chunk + 2, c, j;
+    Window window;
+    int k;
+
+    /* Zeroed, so that the unused random bytes at either end are defined. */
+    window.bytes = calloc(4, 3 * size);
+    if (!window.bytes) {
+        fprintf(stderr, "Failed to allocate rows.\n");
+        exit(1);
+    }
+    for (k = 0; k < 4; ++k) {
+        window.pixels[k] = (Pixel *)(window.bytes + k * 3 * size);
+        split_planes(window.planes + k, window.bytes + k * 3 * size, size);
+    }
+    for (j = 0; j < wavefront->image->height; ++j) {
+        /* Edge chunks first: the neighbouring strips are waiting on them. */
+        run_chunk(wavefront, &window, first, j);
+        if (last - 1 > first) {
+            run_chunk(wavefront, &window, last - 1, j);
+        }
+        for (c = first + 1; c + 1 < last; ++c) {
+            run_chunk(wavefront, &window, c, j);
+        }
+    }
+    free(window.bytes);
+}
+
+/**
+ * Generate image (allocated by the caller, planar or not) with one strip
+ * per thread of pool, n_strips of them.
+ */
+static void generate_strips(Wavefront *wavefront, size_t n_strips,
+                            Thread_pool *pool) {
+    size_t width = wavefront->image->width;
+    size_t s, c, k, first, strip_width, n;
+
+    /* Strips as even as can be, each cut into chunks as even as can be. */
+    wavefront->n_chunks = 0;
+    for (s = 0; s < n_strips; ++s) {
+        strip_width = (s + 1) * width / n_strips - s * width / n_strips;
+        wavefront->n_chunks +=
+            (strip_width + CHUNK_COLUMNS - 1) / CHUNK_COLUMNS;
+    }
+    wavefront->chunk_first = malloc((wavefront->n_chunks + 1) *
+                                    sizeof(*wavefront->chunk_first));
+    wavefront->strip_first = malloc((n_strips + 1) *
+                                    sizeof(*wavefront->strip_first));
+    if (!wavefront->chunk_first || !wavefront->strip_first ||
+        posix_memalign((void **)&wavefront->progress, CACHE_LINE_BYTES,
+                       wavefront->n_chunks * sizeof(Progress))) {
+        fprintf(stderr, "Failed to allocate chunks.\n");
+        exit(1);
+    }
+    wavefront->widest_chunk = 0;
+    for (s = 0, c = 0; s < n_strips; ++s) {
+        first = s * width / n_strips;
+        strip_width = (s + 1) * width / n_strips - first;
+        n = (strip_width + CHUNK_COLUMNS - 1) / CHUNK_COLUMNS;
+        wavefront->strip_first[s] = c;
+        for (k = 0; k < n; ++k, ++c) {
+            wavefront->chunk_first[c] = first + k * strip_width / n;
+            if (wavefront->widest_chunk < strip_width / n + 1) {
+                wavefront->widest_chunk = strip_width / n + 1;
+            }
+        }
+    }
+    wavefront->strip_first[n_strips] = c;
+    wavefront->chunk_first[c] = width;
+    for (c = 0; c < wavefront->n_chunks; ++c) {
+        wavefront->progress[c].rows = 0;
+    }
+
+    /*
+     * One task per strip and no more strips than threads, so every strip
+     * gets a thread of its own and none waits on a strip yet to start.
+     */
+    thread_pool_run(pool, &run_strip, wavefront, n_strips);
+    free(wavefront->chunk_first);
+    free(wavefront->strip_first);
+    free(wavefront->progress);
+}
+
+/**
+ * Strips to cut rows width pixels wide into on pool, 1 if not worth it.
+ */
+static size_t count_strips(size_t width, const Thread_pool *pool) {
+    size_t n_strips = width / MIN_STRIP_COLUMNS;
+    if (n_strips > thread_pool_size(pool)) {
+        n_strips = thread_pool_size(pool);
+    }
+    return n_strips > 1 ? n_strips : 1;
+}
+
+Image *generate_image_wavefront(size_t width, size_t height,
+                                Row_evolver row_evolver, const Rng *rng,
+                                Thread_pool *pool) {
+    Wavefront wavefront;
+    size_t n_strips = count_strips(width, pool);
+
+    if (n_strips == 1) {
+        return generate_image(width, height, row_evolver, rng);
+    }
+    wavefront.image = malloc_image(width, height);
+    if (!wavefront.image) {
+        return NULL;
+    }
+    wavefront.row_evolver = row_evolver;
+    wavefront.planar_row_evolver = NULL;
+    wavefront.rng = rng;
+    generate_strips(&wavefront, n_strips, pool);
+    return wavefront.image;
+}
+
+Image *generate_planar_image_wavefront(size_t width, size_t height,
+                                       Planar_row_evolver row_evolver,
+                                       const Rng *rng, Thread_pool *pool) {
+    Wavefront wavefront;
+    size_t n_strips = count_strips(width, pool);
+
+    if (n_strips == 1) {
+        return generate_planar_image(width, height, row_evolver, rng);
+    }
+    wavefront.image = malloc_image_layout(width, height, 0, 1);
+    if (!wavefront.image) {
+        return NULL;
+    }
+    wavefront.row_evolver = NULL;
+    wavefront.planar_row_evolver = row_evolver;
+    wavefront.rng = rng;
+    generate_strips(&wavefront, n_strips, pool);
+    return wavefront.image;
+}
@@ -0,0 +1,43 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+#include "evolve_row.h"
+#include "image.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+/**
+ * Row-by-row generation on several threads. Each row depends on the one
+ * above, but a destination pixel only on the three source pixels above it,
+ * so rows need not be finished one at a time: rows are cut into chunks of
+ * columns, and chunk c of row j can be evolved as soon as chunks c - 1, c
+ * and c + 1 of row j - 1 are (wrapping around the ends of the row).
+ *
+ * Every thread owns a strip of adjacent chunks and works down the rows on
+ * its own. After each chunk it bumps the progress counter of that chunk, and
+ * before it waits only for the counters of the neighbouring strips' edge
+ * chunks, so threads run in a staggered wavefront, at most a row apart from
+ * their neighbours, instead of meeting at a barrier every row.
+ *
+ * Random bytes are keyed by pixel (see rng.h), and each chunk is evolved by
+ * the ordinary row evolver, so images are the same as from generate_image
+ * and generate_planar_image, bit for bit.
+ */
+
+/**
+ * Same image as generate_image, generated on the threads of pool. Falls back
+ * to generate_image if the rows are too narrow to share. Returns NULL if the
+ * image cannot be allocated.
+ */
+Image *generate_image_wavefront(size_t width, size_t height,
+                                Row_evolver row_evolver, const Rng *rng,
+                                Thread_pool *pool);
+
+/**
+ * Same image as generate_planar_image, generated on the threads of pool.
+ * Returns NULL if the image cannot be allocated.
+ */
+Image *generate_planar_image_wavefront(size_t width, size_t height,
+                                       Planar_row_evolver row_evolver,
+                                       const Rng *rng, Thread_pool *pool);
+
+#endif /* WAVEFRONT_H */